@@ -1,7 +1,8 @@
 #pragma once
 #include <unicorn\unicorn.h>
+#include <atomic>
 
-extern int g_allocation_tracker;
+extern std::atomic<int> g_allocation_tracker;
 
 uc_err uct_context_alloc(uc_engine *uc, uc_context **context);
 uc_err uct_context_free(uc_context *context);
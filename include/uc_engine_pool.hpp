@@ -0,0 +1,182 @@
+#pragma once
+#include <unicorn/unicorn.h>
+
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <uc_state.hpp>
+#include <vector>
+#include <vmimage.hpp>
+#include <vmtrace.hpp>
+
+#define EMU_STACK_BASE 0xFFFF000000000000ull
+#define EMU_STACK_SIZE (0x1000ull * 100)
+#define EMU_INITIAL_RSP (EMU_STACK_BASE + EMU_STACK_SIZE - 0x1000ull)
+
+namespace vm::emu {
+/// <summary>
+/// a unicorn-engine instance with the module image and a stack mapped into
+/// it... the image is mapped once when the engine is created and is never
+/// touched again...
+/// </summary>
+struct engine_t {
+  uc_engine* uc;
+
+  /// <summary>
+  /// where the image is mapped inside of the emulator...
+  /// </summary>
+  std::uintptr_t module_base, image_size;
+
+  /// <summary>
+  /// page aligned host memory backing the emulated stack... the stack is
+  /// mapped with uc_mem_map_ptr so resetting it is a plain memset...
+  /// </summary>
+  std::uint8_t* stack;
+
+  /// <summary>
+  /// cpu context with every register cleared and RSP set to EMU_INITIAL_RSP...
+  /// </summary>
+  uc_context* clean;
+
+  /// <summary>
+  /// private copy-on-write view of the image if the engine was created from a
+  /// vm::image_t, nullptr if the image is mapped read/execute only...
+  /// </summary>
+  void* image_view;
+  const vm::image_t* image;
+
+  /// <summary>
+  /// dirty page tracking for the stack (and the image view if there is one),
+  /// created with the engine if it has an image view, otherwise the first
+  /// time lease_t::state is called...
+  /// </summary>
+  std::unique_ptr<state_t> state;
+
+  /// <summary>
+  /// handler tracer of the engine, created by lease_t::tracer...
+  /// </summary>
+  std::unique_ptr<tracer_t> tracer;
+
+  std::vector<std::uint8_t> stack_data;
+};
+
+class engine_pool_t;
+
+/// <summary>
+/// an engine leased from an engine_pool_t... the engine goes back to the pool
+/// when the lease is destroyed...
+/// </summary>
+class lease_t {
+ public:
+  lease_t(engine_pool_t* pool, engine_t* engine);
+  lease_t(lease_t&& other) noexcept;
+  lease_t(const lease_t&) = delete;
+  lease_t& operator=(const lease_t&) = delete;
+  lease_t& operator=(lease_t&&) = delete;
+  ~lease_t();
+
+  explicit operator bool() const { return m_engine != nullptr; }
+  uc_engine* uc() const { return m_engine->uc; }
+  std::uint8_t* stack() const { return m_engine->stack; }
+  engine_t* engine() const { return m_engine; }
+
+  /// <summary>
+  /// emulator state manager of the leased engine... the first call installs
+  /// the write hooks, after which the manager lives as long as the engine. a
+  /// fresh lease always starts with a checkpoint of the clean state.
+  /// </summary>
+  state_t& state();
+
+  /// <summary>
+  /// handler tracer of the leased engine... the tracer and its decode cache
+  /// live as long as the engine, it is only recreated if a different mode is
+  /// asked for.
+  /// </summary>
+  tracer_t& tracer(trace_mode_t mode = trace_mode_t::block);
+
+ private:
+  engine_pool_t* m_pool;
+  engine_t* m_engine;
+};
+
+/// <summary>
+/// pool of unicorn-engine instances which all share the same module image...
+/// the image is mapped read/execute only straight out of the analyzer's own
+/// memory, so every engine in the pool shares the same pages. only the stack
+/// and the registers are reset between leases.
+///
+/// when the pool is created from a vm::image_t every engine instead maps its
+/// own copy-on-write view of the image, so the emulated code may also write to
+/// the image without the analyzer or any other engine seeing it. pages of the
+/// view written during a lease are reset to the shared image afterwards.
+///
+/// engines are created lazily up to max_engines (defaults to the number of
+/// hardware threads), after which lease() blocks until an engine is returned.
+/// </summary>
+class engine_pool_t {
+ public:
+  explicit engine_pool_t(std::uintptr_t module_base,
+                         std::uintptr_t image_size,
+                         std::uint32_t max_engines = 0u);
+  explicit engine_pool_t(const vm::image_t& image,
+                         std::uint32_t max_engines = 0u);
+  ~engine_pool_t();
+
+  engine_pool_t(const engine_pool_t&) = delete;
+  engine_pool_t& operator=(const engine_pool_t&) = delete;
+
+  /// <summary>
+  /// lease an engine with a clean stack and clean registers...
+  /// </summary>
+  /// <returns>returns a lease which evaluates to false if a new engine could
+  /// not be created...</returns>
+  lease_t lease();
+
+  /// <summary>
+  /// number of engines created by this pool so far...
+  /// </summary>
+  std::uint32_t size();
+
+  /// <summary>
+  /// creates a standalone engine which does not belong to any pool...
+  /// </summary>
+  /// <param name="module_base">linear virtual address of the module, the image
+  /// is mapped at this same address inside of the emulator...</param>
+  /// <param name="image_size">size of the module image in bytes...</param>
+  /// <returns>returns nullptr if the engine could not be created...</returns>
+  static engine_t* create(std::uintptr_t module_base,
+                          std::uintptr_t image_size);
+
+  /// <summary>
+  /// creates a standalone engine with a private copy-on-write view of the
+  /// image mapped at image.m_module_base...
+  /// </summary>
+  static engine_t* create(const vm::image_t& image);
+
+  /// <summary>
+  /// closes an engine created with engine_pool_t::create...
+  /// </summary>
+  static void destroy(engine_t* engine);
+
+  /// <summary>
+  /// clears the stack, resets written pages of the image view and restores
+  /// the clean register state of an engine...
+  /// </summary>
+  static void reset(engine_t* engine);
+
+ private:
+  friend class lease_t;
+  void release(engine_t* engine);
+
+  engine_t* create_engine() const;
+
+  const std::uintptr_t m_module_base, m_image_size;
+  const vm::image_t* m_image;
+  const std::uint32_t m_max_engines;
+
+  std::mutex m_lock;
+  std::condition_variable m_returned;
+  std::vector<engine_t*> m_engines, m_free;
+};
+}  // namespace vm::emu
@@ -0,0 +1,186 @@
+#pragma once
+#include <unicorn/unicorn.h>
+
+#include <array>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#define EMU_PAGE_SIZE 0x1000ull
+
+namespace vm::emu {
+using page_t = std::shared_ptr<const std::array<std::uint8_t, EMU_PAGE_SIZE>>;
+
+/// <summary>
+/// the registers and the pages of every tracked region at one point in time...
+/// pages are shared between forks until one of them writes to them, so a fork
+/// only owns the pages written since the fork it was taken from. regions with
+/// a clean copy only keep the pages which differ from it.
+/// </summary>
+class fork_t {
+ public:
+  ~fork_t();
+
+  uc_context* ctx() const { return m_ctx; }
+
+  /// <summary>
+  /// pages copied by this fork instead of shared with the one it was taken
+  /// from...
+  /// </summary>
+  std::size_t owned() const { return m_owned; }
+
+ private:
+  friend class state_t;
+
+  uc_context* m_ctx;
+
+  /// <summary>
+  /// pages of each tracked region in the order they were tracked, nullptr for
+  /// a page which is the same as the region's clean copy...
+  /// </summary>
+  std::vector<std::vector<page_t>> m_pages;
+  std::size_t m_owned;
+};
+
+/// <summary>
+/// emulator state manager... a UC_HOOK_MEM_WRITE hook records which pages of
+/// the tracked regions get written after a checkpoint, and keeps a copy of each
+/// of those pages as it was before its first write. rolling back restores only
+/// the dirty pages and the registers, so re-running a handler or forking at a
+/// virtual branch does not need a copy of the whole stack or a new engine.
+///
+/// only guest writes are seen by the hook, host side writes to tracked memory
+/// must go through write() to be undone by a rollback...
+/// </summary>
+class state_t {
+ public:
+  explicit state_t(uc_engine* uc);
+  ~state_t();
+
+  state_t(const state_t&) = delete;
+  state_t& operator=(const state_t&) = delete;
+
+  /// <summary>
+  /// track writes to a region of guest memory which is backed by host memory
+  /// (mapped with uc_mem_map_ptr)...
+  /// </summary>
+  /// <param name="base">page aligned guest address of the region...</param>
+  /// <param name="size">page aligned size of the region...</param>
+  /// <param name="host">host memory backing the region...</param>
+  /// <param name="clean">optional host memory holding the region as it is
+  /// now, forks share its pages and revert copies written pages back from
+  /// it...</param>
+  /// <returns>returns false if the hook could not be installed...</returns>
+  bool track(std::uintptr_t base,
+             std::size_t size,
+             std::uint8_t* host,
+             const std::uint8_t* clean = nullptr);
+
+  /// <summary>
+  /// saves the registers and forgets every dirty page...
+  /// </summary>
+  void checkpoint();
+
+  /// <summary>
+  /// restores every page dirtied since the last checkpoint and restores the
+  /// registers... the checkpoint stays valid and can be rolled back to again.
+  /// </summary>
+  void rollback();
+
+  /// <summary>
+  /// writes to tracked guest memory from the host side, recording the pages
+  /// as dirty so that a rollback undoes the write...
+  /// </summary>
+  bool write(std::uintptr_t addr, const void* data, std::size_t size);
+
+  /// <summary>
+  /// number of pages dirtied since the last checkpoint...
+  /// </summary>
+  std::size_t dirty() const;
+
+  /// <summary>
+  /// forks the registers and every tracked region... pages which were not
+  /// written since the engine was last restored to a fork are shared with that
+  /// fork, only the others are copied.
+  /// </summary>
+  /// <returns>returns nullptr if the registers could not be saved...</returns>
+  std::shared_ptr<const fork_t> fork();
+
+  /// <summary>
+  /// loads a fork into the engine and checkpoints... only the pages which
+  /// differ from the fork the engine holds are copied.
+  /// </summary>
+  void restore(const std::shared_ptr<const fork_t>& fork);
+
+  /// <summary>
+  /// the tracked memory was changed from the host side without write(), the
+  /// next restore copies every page...
+  /// </summary>
+  void forget();
+
+  /// <summary>
+  /// copies every page of the regions with a clean copy written since they
+  /// were tracked or last reverted back from it, checkpoints or not... call
+  /// forget and checkpoint afterwards.
+  /// </summary>
+  void revert();
+
+ private:
+  struct region_t {
+    state_t* state;
+    std::uintptr_t base;
+    std::size_t size;
+    std::uint8_t* host;
+    const std::uint8_t* clean;
+    uc_hook hook;
+
+    /// <summary>
+    /// one bit per page, set once the page has been written since the last
+    /// checkpoint...
+    /// </summary>
+    std::vector<std::uint64_t> bitmap;
+
+    /// <summary>
+    /// indexes of the dirty pages, in the order they were first written...
+    /// </summary>
+    std::vector<std::uint32_t> pages;
+
+    /// <summary>
+    /// contents of each dirty page at the time of the last checkpoint, one
+    /// page for each entry in pages...
+    /// </summary>
+    std::vector<std::uint8_t> backup;
+
+    /// <summary>
+    /// one bit per page, set once the page has been written since the engine
+    /// was last restored to a fork... checkpoints do not clear it.
+    /// </summary>
+    std::vector<std::uint64_t> touched;
+
+    /// <summary>
+    /// one bit per page, set once the page may differ from the clean copy...
+    /// only revert clears it.
+    /// </summary>
+    std::vector<std::uint64_t> written;
+  };
+
+  static void on_write(uc_engine* uc,
+                       uc_mem_type type,
+                       std::uint64_t addr,
+                       int size,
+                       std::int64_t value,
+                       region_t* region);
+
+  void mark(region_t& region, std::uintptr_t addr, std::size_t size);
+
+  uc_engine* m_uc;
+  uc_context* m_ctx;
+  std::vector<std::unique_ptr<region_t>> m_regions;
+
+  /// <summary>
+  /// fork the engine was last restored to, its pages are what the engine holds
+  /// except for the touched ones...
+  /// </summary>
+  std::shared_ptr<const fork_t> m_fork;
+};
+}  // namespace vm::emu
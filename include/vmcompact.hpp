@@ -0,0 +1,212 @@
+#pragma once
+#include <array>
+#include <fstream>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <uc_engine_pool.hpp>
+#include <vector>
+
+#define VM_COMPACT_REGS 18u
+#define VM_COMPACT_SLACK 0x100u
+
+namespace vm::compact {
+/// <summary>
+/// how the stack window of a snapshot is stored...
+/// </summary>
+enum class codec_t : std::uint8_t {
+  /// <summary>
+  /// as is...
+  /// </summary>
+  none,
+
+  /// <summary>
+  /// runs of zero bytes are stored as their length, the virtual stack and the
+  /// vm context around it are mostly zeros and small values...
+  /// </summary>
+  zrle
+};
+
+class budget_t;
+
+/// <summary>
+/// the state an engine needs to re-enter a virtual block... every general
+/// purpose register, RIP and RFLAGS, and the stack from just below the lower
+/// of RSP and VSP up to the top of the stack. everything below the window is
+/// dead, the vm only pushes downwards from there.
+/// </summary>
+class snapshot_t {
+ public:
+  /// <summary>
+  /// captures the leased engine's registers and stack window...
+  /// </summary>
+  /// <param name="vsp">native register used for VSP...</param>
+  /// <param name="budget">optional budget the stack window is accounted
+  /// against, it must outlive the snapshot...</param>
+  /// <returns>returns nullptr if the registers could not be read...</returns>
+  static std::shared_ptr<const snapshot_t> capture(
+      vm::emu::lease_t& lease,
+      zydis_reg_t vsp,
+      codec_t codec = codec_t::none,
+      budget_t* budget = nullptr);
+
+  ~snapshot_t();
+
+  /// <summary>
+  /// rehydrates the snapshot into the leased engine... registers which are not
+  /// captured are the engine's clean ones and the stack below the window is
+  /// zeroed. the engine's vm::emu::state_t is checkpointed afterwards.
+  /// </summary>
+  /// <returns>returns false if the stack window could not be decoded or
+  /// paged back in...</returns>
+  bool restore(vm::emu::lease_t& lease) const;
+
+  /// <summary>
+  /// captured value of a register...
+  /// </summary>
+  /// <param name="reg">unicorn register, one of the general purpose
+  /// registers, RIP or RFLAGS...</param>
+  std::uint64_t reg(int reg) const;
+
+  /// <summary>
+  /// bytes taken up by the snapshot in memory, the object itself included...
+  /// a spilled stack window takes up none.
+  /// </summary>
+  std::size_t size() const;
+
+  /// <summary>
+  /// true if the stack window is in the budget's spill file...
+  /// </summary>
+  bool spilled() const { return m_spilled; }
+
+  codec_t codec() const { return m_codec; }
+
+  /// <summary>
+  /// guest address and size of the stack window...
+  /// </summary>
+  std::uintptr_t window() const { return m_window; }
+  std::size_t window_size() const { return m_window_size; }
+
+ private:
+  std::array<std::uint64_t, VM_COMPACT_REGS> m_regs;
+  std::uintptr_t m_window;
+  std::uint32_t m_window_size;
+  codec_t m_codec;
+
+  // the budget pages the stack window out and back in behind const
+  // references, always with its lock held...
+  friend class budget_t;
+  mutable std::vector<std::uint8_t> m_data;
+  mutable budget_t* m_budget = nullptr;
+  mutable std::list<const snapshot_t*>::iterator m_lru;
+  mutable std::uint64_t m_offset = 0u;
+  mutable std::uint32_t m_stored = 0u;
+  mutable bool m_spilled = false;
+};
+
+/// <summary>
+/// caps the memory taken up by the stack windows of the snapshots captured
+/// against it... once the cap is exceeded the windows of the least recently
+/// used snapshots are written to a temporary file and freed, restoring a
+/// spilled snapshot reads its window back in. the registers of every snapshot
+/// stay in memory. the file only ever grows, space of windows paged back in is
+/// not reused.
+/// </summary>
+class budget_t {
+ public:
+  /// <summary>
+  /// creates an empty budget, nothing is spilled until more than cap bytes
+  /// of stack windows are held in memory...
+  /// </summary>
+  /// <param name="cap">bytes of stack windows kept in memory...</param>
+  /// <param name="dir">directory of the spill file, the system's temporary
+  /// directory if empty... the file is only created by the first
+  /// spill.</param>
+  explicit budget_t(std::size_t cap, const std::string& dir = {});
+
+  /// <summary>
+  /// deletes the spill file... the snapshots are not accounted against
+  /// anything afterwards, the windows of spilled ones are dropped and they can
+  /// no longer be restored.
+  /// </summary>
+  ~budget_t();
+
+  budget_t(const budget_t&) = delete;
+  budget_t& operator=(const budget_t&) = delete;
+
+  struct stats_t {
+    /// <summary>
+    /// bytes of stack windows in memory, the most there ever were, and bytes
+    /// in the spill file...
+    /// </summary>
+    std::uint64_t resident, peak, spilled;
+
+    /// <summary>
+    /// stack windows written to and read back from the spill file...
+    /// </summary>
+    std::uint64_t spills, loads;
+  };
+
+  stats_t stats();
+  std::size_t cap() const { return m_cap; }
+
+ private:
+  friend class snapshot_t;
+
+  /// <summary>
+  /// accounts a newly captured snapshot, then spills until the budget is met
+  /// again...
+  /// </summary>
+  void add(const snapshot_t* snapshot);
+
+  /// <summary>
+  /// drops a snapshot which is being destroyed...
+  /// </summary>
+  void remove(const snapshot_t* snapshot);
+
+  /// <summary>
+  /// pages the snapshot back in if needed, marks it the most recently used
+  /// and spills other snapshots until the budget is met again... m_lock must
+  /// be held.
+  /// </summary>
+  bool touch(const snapshot_t* snapshot);
+
+  /// <summary>
+  /// spills least recently used snapshots while the resident bytes exceed the
+  /// cap, stopping at keep... m_lock must be held.
+  /// </summary>
+  void evict(const snapshot_t* keep);
+
+  /// <summary>
+  /// write the stack window to the spill file and free it, or read it back...
+  /// m_lock must be held.
+  /// </summary>
+  bool spill(const snapshot_t* snapshot);
+  bool load(const snapshot_t* snapshot);
+
+  const std::size_t m_cap;
+  std::string m_path;
+  std::fstream m_file;
+  std::uint64_t m_end;
+
+  // resident snapshots, most recently used first, and spilled ones...
+  std::mutex m_lock;
+  std::list<const snapshot_t*> m_lru, m_cold;
+  stats_t m_stats;
+};
+
+/// <summary>
+/// zero run length encoding... a run of zero bytes followed by a run of
+/// literal bytes, both lengths as 16 bit values, until the input ends.
+/// </summary>
+std::vector<std::uint8_t> encode(const std::uint8_t* data, std::size_t size);
+
+/// <summary>
+/// decodes exactly size bytes into out...
+/// </summary>
+/// <returns>returns false if data does not decode to size bytes...</returns>
+bool decode(const std::vector<std::uint8_t>& data,
+            std::uint8_t* out,
+            std::size_t size);
+}  // namespace vm::compact
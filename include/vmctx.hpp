@@ -1,9 +1,69 @@
 #pragma once
 #include <vminstrs.hpp>
+#include <vmlocate.hpp>
 #include <vmutils.hpp>
 #include <array>
+#include <functional>
+#include <future>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <optional>
 
 namespace vm {
+/// <summary>
+/// everything vmctx_t learns from a vm enter... vm entries are PUSH IMM, CALL
+/// and many of them call into the same vm enter, which only has to be analyzed
+/// once for all of them.
+/// </summary>
+struct vmenter_t {
+  /// <summary>
+  /// the vm enter flattened and deobfuscated... when the analysis is shared
+  /// this starts at the CALL target, without the PUSH IMM of any vm entry.
+  /// </summary>
+  zydis_rtn_t rtn;
+
+  /// <summary>
+  /// native registers used for VIP and VSP by the vm enter...
+  /// </summary>
+  zydis_reg_t vip, vsp;
+
+  /// <summary>
+  /// order in which the native registers are pushed...
+  /// </summary>
+  std::array<ZydisRegister, 16> push_order;
+};
+
+/// <summary>
+/// vm enter analyses by the address of the vm enter the vm entries call...
+/// safe to share between threads.
+/// </summary>
+class vmenter_cache_t {
+ public:
+  /// <summary>
+  /// number of distinct vm enters seen so far...
+  /// </summary>
+  std::size_t size() const;
+
+ private:
+  friend class vmctx_t;
+  using analysis_t = std::shared_future<std::shared_ptr<const vmenter_t>>;
+
+  /// <summary>
+  /// analysis of the vm enter at addr... the first thread to ask runs analyze
+  /// after leaving a placeholder for it under the lock, every other thread
+  /// waits for that analysis instead of running its own.
+  /// </summary>
+  /// <returns>returns nullptr if the vm enter could not be
+  /// analyzed...</returns>
+  std::shared_ptr<const vmenter_t> get(
+      std::uintptr_t addr,
+      const std::function<std::shared_ptr<const vmenter_t>()>& analyze);
+
+  mutable std::mutex m_lock;
+  std::map<std::uintptr_t, analysis_t> m_enters;
+};
+
 class vmctx_t {
  public:
   explicit vmctx_t(std::uintptr_t module_base,
@@ -11,28 +71,50 @@ class vmctx_t {
                    std::uintptr_t image_size,
                    std::uintptr_t vm_entry_rva);
   bool init();
+
+  /// <summary>
+  /// same as init() but shares the analysis of the vm enter with every other
+  /// vmctx_t initialized with the same cache...
+  /// </summary>
+  bool init(vmenter_cache_t& cache);
+
   const std::uintptr_t m_module_base, m_image_base, m_vm_entry_rva,
       m_image_size, m_image_load_delta;
 
-  zydis_reg_t get_vip() const { return m_vip; }
-  zydis_reg_t get_vsp() const { return m_vsp; }
-  zydis_rtn_t get_vm_enter() const { return m_vm_entry; }
+  zydis_reg_t get_vip() const { return m_enter->vip; }
+  zydis_reg_t get_vsp() const { return m_enter->vsp; }
+  zydis_rtn_t get_vm_enter() const;
 
   const std::array<ZydisRegister, 16>& get_vmentry_push_order() const;
  private:
   /// <summary>
-  /// m_vip and m_vsp are set to the native registers used for them by the vm
-  /// enter... these will change during the execution inside of the vm but these
-  /// values stay the same as the ones used by vm enter...
+  /// flattens, deobfuscates and analyzes the vm enter starting at addr...
   /// </summary>
-  zydis_reg_t m_vip, m_vsp;
+  static std::shared_ptr<vmenter_t> analyze(std::uintptr_t addr);
 
   /// <summary>
-  /// the virtual machine enter flattened and deobfuscated...
+  /// the vm enter flattened and deobfuscated, along with VIP and VSP... these
+  /// registers change during the execution inside of the vm but the ones in
+  /// here stay the same as the ones used by vm enter...
   /// </summary>
-  zydis_rtn_t m_vm_entry;
+  std::shared_ptr<const vmenter_t> m_enter;
 
-  //using array container instead of c-style array in order to pass by reference.
-  std::array<ZydisRegister, 16> vmentry_push_order;
+  /// <summary>
+  /// PUSH IMM of this vm entry, only set if m_enter is shared and starts at
+  /// the CALL target...
+  /// </summary>
+  std::optional<zydis_instr_t> m_push;
 };
-}  // namespace vm
\ No newline at end of file
+
+/// <summary>
+/// initializes a vmctx_t for every vm entry, analyzing each distinct vm enter
+/// only once...
+/// </summary>
+/// <returns>returns the vmctx_t's which initialized, in the same order as
+/// entries...</returns>
+std::vector<vmctx_t> init_vmctxs(
+    std::uintptr_t module_base,
+    std::uintptr_t image_base,
+    std::uintptr_t image_size,
+    const std::vector<vm::locate::vm_enter_t>& entries);
+}  // namespace vm
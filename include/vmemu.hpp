@@ -0,0 +1,482 @@
+#pragma once
+#include <atomic>
+#include <functional>
+#include <mutex>
+#include <optional>
+#include <set>
+#include <uc_engine_pool.hpp>
+#include <vmcompact.hpp>
+#include <vmctx.hpp>
+#include <vmlocate.hpp>
+#include <vmmem.hpp>
+#include <vmprofdb.hpp>
+#include <vmsched.hpp>
+
+#define VM_MAX_BLK_HANDLERS 0x1000u
+#define VM_MAX_TABLE_ENTRIES 0x400u
+
+namespace vm::emu {
+/// <summary>
+/// receives a virtual block as soon as its virtual instructions and branches
+/// are known... the block drops its m_jmp.state right after the sink returns,
+/// the sink has to keep its own reference to it if it needs it.
+/// </summary>
+using sink_t = std::function<void(vm::instrs::vblk_t& blk)>;
+
+/// <summary>
+/// everything a virtual block depends on... two vm entries which reach the same
+/// VIP with the same registers and the same rolling key decode the same block.
+/// </summary>
+struct blk_key_t {
+  std::uintptr_t vip_addr;
+  zydis_reg_t vip, vsp;
+
+  /// <summary>
+  /// value of the rolling key register when the block starts...
+  /// </summary>
+  std::uint64_t rkey;
+
+  auto operator<=>(const blk_key_t&) const = default;
+};
+
+/// <summary>
+/// hash of a blk_key_t, for the set of blocks an exploration already queued...
+/// </summary>
+struct blk_key_hash_t {
+  std::size_t operator()(const blk_key_t& key) const {
+    return std::hash<std::uint64_t>{}(key.vip_addr ^
+                                      key.rkey * 0x9E3779B97F4A7C15ull) ^
+           (static_cast<std::size_t>(key.vip) << 16 | key.vsp);
+  }
+};
+
+/// <summary>
+/// finished virtual blocks shared by every emu_t exploring the same module...
+/// when a block and every block reachable from it are cached, an exploration
+/// takes them from here instead of emulating them again.
+/// </summary>
+class blk_cache_t {
+ public:
+  struct stats_t {
+    /// <summary>
+    /// blocks looked up, and how many of them were found along with every
+    /// block reachable from them...
+    /// </summary>
+    std::uint64_t lookups, hits;
+
+    /// <summary>
+    /// blocks and vm handlers taken from the cache instead of being emulated
+    /// and profiled again...
+    /// </summary>
+    std::uint64_t blks, vinstrs;
+  };
+
+  std::size_t size() const;
+  stats_t stats() const;
+
+ private:
+  friend class emu_t;
+
+  struct cached_blk_t {
+    vm::instrs::vblk_t blk;
+    std::vector<blk_key_t> successors;
+  };
+
+  /// <summary>
+  /// register holding the rolling key in the vm handler at rip, the register
+  /// the value fetched from VIP is first XOR'ed with...
+  /// </summary>
+  /// <returns>returns ZYDIS_REGISTER_NONE if the handler does not decrypt
+  /// anything fetched from VIP...</returns>
+  zydis_reg_t rkey(std::uintptr_t rip, zydis_reg_t vip);
+
+  /// <summary>
+  /// looks up the block at key and every block reachable from it, the block at
+  /// key first... keys is filled with the key of each block in blks.
+  /// </summary>
+  /// <returns>returns false if any of them is not cached...</returns>
+  bool find(const blk_key_t& key,
+            std::vector<std::shared_ptr<const cached_blk_t>>& blks,
+            std::vector<blk_key_t>& keys);
+
+  /// <summary>
+  /// caches a finished block without its JMP handler state... if another
+  /// thread got there first, its block is kept.
+  /// </summary>
+  void insert(const blk_key_t& key,
+              const vm::instrs::vblk_t& blk,
+              std::vector<blk_key_t> successors);
+
+  mutable std::mutex m_lock;
+  std::map<blk_key_t, std::shared_ptr<const cached_blk_t>> m_blks;
+  std::map<std::pair<std::uintptr_t, zydis_reg_t>, zydis_reg_t> m_rkeys;
+  std::atomic<std::uint64_t> m_lookups, m_hits, m_replayed, m_vinstrs;
+};
+
+/// <summary>
+/// explores every virtual code block reachable from one vm entry... each
+/// virtual block is emulated on an engine leased from the pool, starting from
+/// the state its predecessor's JMP left the engine in. with a scheduler every
+/// newly found block is a nested task, without one the blocks are explored one
+/// after the other on the calling thread.
+/// </summary>
+class emu_t {
+ public:
+  /// <summary>
+  /// creates an emulator for a single vm entry, nothing is emulated until
+  /// init() and get_trace() are called...
+  /// </summary>
+  /// <param name="vmctx">initialized vm context of the vm entry...</param>
+  /// <param name="engines">engines to emulate on, every engine must have the
+  /// module mapped at vmctx->m_module_base...</param>
+  /// <param name="sched">optional scheduler to explore blocks in parallel
+  /// on...</param>
+  /// <param name="policy">where the virtual instructions and branches of the
+  /// routine are allocated, blocks handed to a sink always use the
+  /// heap...</param>
+  /// <param name="cache">optional block cache shared with the other vm entries
+  /// of the module...</param>
+  /// <param name="codec">how the stack window of each block's JMP handler
+  /// state is stored...</param>
+  /// <param name="budget">optional memory budget... the state of every block
+  /// still to be explored is kept as a snapshot accounted against it instead
+  /// of a fork, as are the JMP handler states, and the least recently used
+  /// ones are spilled to disk.</param>
+  /// <param name="db">optional vm handler profile database... known handlers
+  /// are run without being traced, the others are profiled and added.</param>
+  explicit emu_t(const vm::vmctx_t* vmctx,
+                 engine_pool_t& engines,
+                 vm::sched::scheduler_t* sched = nullptr,
+                 vm::mem::policy_t policy = vm::mem::policy_t::arena,
+                 blk_cache_t* cache = nullptr,
+                 vm::compact::codec_t codec = vm::compact::codec_t::none,
+                 vm::compact::budget_t* budget = nullptr,
+                 vm::profdb::db_t* db = nullptr);
+  ~emu_t();
+
+  emu_t(const emu_t&) = delete;
+  emu_t& operator=(const emu_t&) = delete;
+
+  /// <summary>
+  /// emulates the vm enter up until the first vm handler...
+  /// </summary>
+  /// <returns>returns false if the vm enter could not be emulated...</returns>
+  bool init();
+
+  /// <summary>
+  /// explores every virtual code block of the virtual routine...
+  /// </summary>
+  /// <param name="vrtn">filled with the virtual blocks, sorted by virtual
+  /// instruction pointer with the first block first... release it with
+  /// vm::emu::release...</param>
+  /// <returns>returns false if init was not called or failed...</returns>
+  bool get_trace(vm::instrs::vrtn_t& vrtn);
+
+  /// <summary>
+  /// explores every virtual code block of the virtual routine and hands each
+  /// one to sink as soon as it is done, instead of keeping all of them... only
+  /// the blocks still to be explored are held in memory.
+  /// </summary>
+  /// <param name="sink">called once per block, never by more than one thread
+  /// at a time, in the order blocks finish in...</param>
+  /// <returns>returns false if init was not called or failed...</returns>
+  bool get_trace(const sink_t& sink);
+
+  struct table_stats_t {
+    /// <summary>
+    /// jump tables resolved and the table entries evaluated for them...
+    /// </summary>
+    std::uint64_t tables, entries;
+
+    /// <summary>
+    /// time spent resolving them...
+    /// </summary>
+    double seconds;
+  };
+
+  /// <summary>
+  /// what resolving the jump tables of the routine has cost so far...
+  /// </summary>
+  table_stats_t tables() const;
+
+  struct fork_stats_t {
+    /// <summary>
+    /// block entry states forked and the pages they copied, the rest of their
+    /// pages are shared...
+    /// </summary>
+    std::uint64_t forks, pages;
+
+    /// <summary>
+    /// time spent forking...
+    /// </summary>
+    double seconds;
+  };
+
+  /// <summary>
+  /// what forking the state at the start of every block has cost so far...
+  /// </summary>
+  fork_stats_t forks() const;
+
+ private:
+  /// <summary>
+  /// emulator state at the first instruction of a virtual block...
+  /// </summary>
+  struct entry_t {
+    /// <summary>
+    /// registers and stack, sharing every page the block before did not
+    /// write with the state that block started from...
+    /// </summary>
+    std::shared_ptr<const fork_t> state;
+
+    /// <summary>
+    /// used instead of state when exploring under a memory budget...
+    /// </summary>
+    std::shared_ptr<const vm::compact::snapshot_t> compact;
+
+    /// <summary>
+    /// native registers used for VIP and VSP...
+    /// </summary>
+    zydis_reg_t vip, vsp;
+
+    /// <summary>
+    /// first vm handler of the block and the value of VIP...
+    /// </summary>
+    std::uintptr_t rip, vip_addr;
+  };
+
+  /// <summary>
+  /// the last 64 bit READ of a block... if the block ends with a table branch,
+  /// this is where the table entry was loaded from.
+  /// </summary>
+  struct table_t {
+    /// <summary>
+    /// address read and the first vm handler after the READ...
+    /// </summary>
+    std::uintptr_t addr, next;
+
+    /// <summary>
+    /// native register used for VSP after the READ...
+    /// </summary>
+    zydis_reg_t vsp;
+
+    /// <summary>
+    /// native instructions executed from the start of the block up to and
+    /// including the READ...
+    /// </summary>
+    std::uint64_t executed;
+  };
+
+  /// <summary>
+  /// fork of the leased engine's registers, stack and written image pages, or
+  /// a snapshot of the registers and stack under a memory budget...
+  /// </summary>
+  std::shared_ptr<entry_t> snapshot(lease_t& lease,
+                                    zydis_reg_t vip,
+                                    zydis_reg_t vsp,
+                                    std::uintptr_t rip);
+
+  /// <summary>
+  /// puts the leased engine back into the state at entry...
+  /// </summary>
+  bool restore(lease_t& lease, const entry_t& entry);
+
+  /// <summary>
+  /// runs the vm handler at rip untraced if the profile database knows it,
+  /// the same as tracing it and then determining the virtual instruction
+  /// would have... hndlr is left without instructions.
+  /// </summary>
+  /// <param name="count">native instructions executed...</param>
+  /// <returns>returns false if the handler has to be traced, the engine is
+  /// then where it was...</returns>
+  bool profiled(lease_t& lease,
+                std::uintptr_t rip,
+                zydis_reg_t vip,
+                zydis_reg_t vsp,
+                vm::instrs::hndlr_trace_t& hndlr,
+                vm::instrs::vinstr_t& vinstr,
+                std::uintptr_t& next,
+                std::uint64_t& count);
+
+  /// <summary>
+  /// queues exploration of the block starting at entry, unless a block with
+  /// the same key has already been queued...
+  /// </summary>
+  void explore(std::shared_ptr<entry_t> entry);
+
+  /// <summary>
+  /// takes the block at entry from the cache or emulates it, then queues every
+  /// block it branches to and emits it...
+  /// </summary>
+  void visit(const entry_t& entry);
+
+  /// <summary>
+  /// emulates a single virtual block...
+  /// </summary>
+  /// <param name="successors">filled with the state at every block the block
+  /// branches to...</param>
+  /// <returns>returns false if not even the first vm handler could be
+  /// traced...</returns>
+  bool emulate(const entry_t& entry,
+               vm::instrs::vblk_t& blk,
+               std::vector<std::shared_ptr<entry_t>>& successors);
+
+  /// <summary>
+  /// the key of the block starting at entry...
+  /// </summary>
+  /// <returns>returns nothing if the rolling key register is unknown...
+  /// </returns>
+  std::optional<blk_key_t> key(const entry_t& entry);
+
+  /// <summary>
+  /// register holding the rolling key in the vm handler at rip, from the
+  /// block cache if there is one...
+  /// </summary>
+  zydis_reg_t rkey(std::uintptr_t rip, zydis_reg_t vip);
+
+  /// <summary>
+  /// emits the block at entry and every block reachable from it straight from
+  /// the cache, skipping those this exploration already queued... blocks from
+  /// the cache have no JMP handler state.
+  /// </summary>
+  /// <returns>returns false if any of them is not cached...</returns>
+  bool replay(const entry_t& entry);
+
+  /// <summary>
+  /// re-runs the virtual JMP at the end of blk with branch as the value on top
+  /// of the virtual stack, the engine must be rolled back to the first
+  /// instruction of the JMP handler...
+  /// </summary>
+  /// <returns>returns nullptr if branch does not lead to a vm handler inside
+  /// of the module...</returns>
+  std::shared_ptr<entry_t> follow(lease_t& lease,
+                                  const vm::instrs::vblk_t& blk,
+                                  std::uintptr_t branch);
+
+  /// <summary>
+  /// evaluates the entries of the jump table a block loaded its branch from...
+  /// the block is run once up to right after the table load, then only the
+  /// vm handlers between the load and the JMP are re-run for every entry.
+  /// </summary>
+  /// <param name="slice">native instructions executed between the READ and
+  /// the JMP...</param>
+  /// <returns>returns the branch each entry leads to by table index, the
+  /// entry the block loaded is at index 0 and first is the index of the
+  /// first entry...</returns>
+  std::vector<std::uintptr_t> resolve(lease_t& lease,
+                                      const entry_t& entry,
+                                      const vm::instrs::vblk_t& blk,
+                                      const table_t& table,
+                                      std::uint64_t slice,
+                                      std::int32_t& first);
+
+  /// <summary>
+  /// an empty block whose containers allocate from m_arena, or from the heap
+  /// when blocks go to a sink, and an empty handler trace which allocates from
+  /// the heap...
+  /// </summary>
+  vm::instrs::vblk_t make_blk() const;
+  vm::instrs::hndlr_trace_t make_hndlr() const;
+
+  /// <summary>
+  /// hands a finished block to the sink and drops its JMP handler state, or
+  /// keeps it if there is no sink...
+  /// </summary>
+  void emit(vm::instrs::vblk_t& blk);
+
+  /// <summary>
+  /// explores every block, emitting them as they finish...
+  /// </summary>
+  bool run();
+
+  /// <summary>
+  /// true if addr is inside of the module...
+  /// </summary>
+  bool inside(std::uintptr_t addr) const;
+
+  const vm::vmctx_t* m_vmctx;
+  engine_pool_t& m_engines;
+  vm::sched::scheduler_t* m_sched;
+  blk_cache_t* m_cache;
+  const vm::compact::codec_t m_codec;
+  vm::compact::budget_t* m_budget;
+  vm::profdb::db_t* m_db;
+  vm::sched::group_t m_group;
+
+  // declared before everything that allocates from it...
+  std::shared_ptr<std::pmr::memory_resource> m_arena;
+  std::shared_ptr<entry_t> m_entry;
+  const sink_t* m_sink;
+  std::mutex m_sink_lock;
+
+  // keys of the blocks already queued, checked by every block without taking
+  // m_lock... a VIP reached with another rolling key or other registers is a
+  // different block.
+  vm::sched::set_t<blk_key_t, blk_key_hash_t> m_visited;
+
+  std::mutex m_lock;
+  std::vector<vm::instrs::vblk_t> m_blks;
+  std::map<std::pair<std::uintptr_t, zydis_reg_t>, zydis_reg_t> m_rkeys;
+  std::vector<std::shared_ptr<entry_t>> m_worklist;
+
+  std::atomic<std::uint64_t> m_tables, m_table_entries, m_table_ns;
+  std::atomic<std::uint64_t> m_forks, m_fork_pages, m_fork_ns;
+};
+
+/// <summary>
+/// drops the block's reference to the state of its JMP handler...
+/// </summary>
+void release(vm::instrs::vblk_t& blk);
+
+/// <summary>
+/// drops the references to the states of the JMP handlers of the routine...
+/// </summary>
+void release(vm::instrs::vrtn_t& vrtn);
+}  // namespace vm::emu
+
+namespace vm {
+/// <summary>
+/// devirtualizes every vm entry of a module in parallel... each vm entry is a
+/// task on a work stealing scheduler and every virtual block is a nested task.
+/// </summary>
+/// <param name="image">mapped module...</param>
+/// <param name="entries">vm entries, usually from
+/// vm::locate::get_vm_entries...</param>
+/// <param name="threads">number of threads, defaults to the number of hardware
+/// threads...</param>
+/// <param name="policy">where the containers of each routine are
+/// allocated...</param>
+/// <param name="cache">optional block cache, blocks shared by several vm
+/// entries are then only emulated once...</param>
+/// <param name="budget">optional memory budget shared by every vm entry, state
+/// beyond it is spilled to disk...</param>
+/// <param name="db">optional vm handler profile database shared by every vm
+/// entry...</param>
+/// <returns>returns a virtual routine for every vm entry which could be
+/// explored, in the same order as entries no matter how many threads are
+/// used...</returns>
+std::vector<vm::instrs::vrtn_t> devirt(
+    const vm::image_t& image,
+    const std::vector<vm::locate::vm_enter_t>& entries,
+    std::uint32_t threads = 0u,
+    vm::mem::policy_t policy = vm::mem::policy_t::arena,
+    vm::emu::blk_cache_t* cache = nullptr,
+    vm::compact::budget_t* budget = nullptr,
+    vm::profdb::db_t* db = nullptr);
+
+/// <summary>
+/// same as above but on an existing scheduler, engine pool and vm enter cache,
+/// so that they can be reused for many calls on the same module... the engines
+/// must have image mapped and the pool should allow at least one engine more
+/// than the scheduler has threads.
+/// </summary>
+std::vector<vm::instrs::vrtn_t> devirt(
+    const vm::image_t& image,
+    const std::vector<vm::locate::vm_enter_t>& entries,
+    vm::sched::scheduler_t& sched,
+    vm::emu::engine_pool_t& engines,
+    vm::vmenter_cache_t& enters,
+    vm::mem::policy_t policy = vm::mem::policy_t::arena,
+    vm::emu::blk_cache_t* cache = nullptr,
+    vm::compact::budget_t* budget = nullptr,
+    vm::profdb::db_t* db = nullptr);
+}  // namespace vm
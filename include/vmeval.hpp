@@ -0,0 +1,109 @@
+#pragma once
+#include <array>
+#include <uc_engine_pool.hpp>
+#include <vmutils.hpp>
+
+namespace vm::emu {
+/// <summary>
+/// native evaluator for flattened handler instruction streams... the common
+/// vm handler instructions (mov/movzx/movsx, add/sub/xor/and/or/cmp/test,
+/// rol/ror, bswap, not/neg, lea, inc/dec, push/pop/pushfq/popfq, xchg and
+/// branches) are evaluated directly on a register file and on the host memory
+/// backing the engine's image and stack. anything else is handed to
+/// unicorn-engine one instruction at a time.
+///
+/// writes to memory go through the engine's vm::emu::state_t if it has one so
+/// that rollbacks still see them...
+/// </summary>
+class eval_t {
+ public:
+  explicit eval_t(lease_t& lease);
+
+  /// <summary>
+  /// reads the registers of the engine into the evaluator...
+  /// </summary>
+  void load();
+
+  /// <summary>
+  /// writes the registers of the evaluator back into the engine and drops the
+  /// translated code unicorn-engine has of memory written since the last
+  /// store...
+  /// </summary>
+  void store();
+
+  /// <summary>
+  /// evaluates a single instruction at m_rip... nothing is changed if the
+  /// instruction is not supported or touches memory which is not host backed.
+  /// </summary>
+  /// <returns>returns false if the instruction could not be evaluated...</returns>
+  bool step(const zydis_instr_t& instr);
+
+  /// <summary>
+  /// evaluates a routine flattened with keep_jmps, starting from the current
+  /// registers of the engine and storing the registers back when done...
+  /// instructions step() cannot evaluate are emulated by unicorn-engine.
+  /// </summary>
+  /// <param name="rtn">flattened routine...</param>
+  /// <returns>returns false if unicorn-engine failed or the execution left
+  /// the flattened path (for example a JCC which was not taken)...</returns>
+  bool run(const zydis_rtn_t& rtn);
+
+  /// <summary>
+  /// current value of a general purpose register...
+  /// </summary>
+  std::uint64_t reg(zydis_reg_t reg) const;
+
+  std::uint64_t rip() const { return m_rip; }
+  std::uint64_t rflags() const { return m_rflags; }
+
+  /// <summary>
+  /// number of instructions handed to unicorn-engine so far...
+  /// </summary>
+  std::uint32_t fallbacks() const { return m_fallbacks; }
+
+ private:
+  struct region_t {
+    std::uintptr_t base, size;
+    std::uint8_t* host;
+    bool writable;
+
+    /// <summary>
+    /// range written since the last store, empty if begin is not below
+    /// end...
+    /// </summary>
+    std::uintptr_t written_begin, written_end;
+  };
+
+  bool read_reg(zydis_reg_t reg, std::uint64_t& value) const;
+  bool write_reg(zydis_reg_t reg, std::uint64_t value);
+
+  std::uint8_t* translate(std::uintptr_t addr, std::size_t size, bool write);
+  bool read_mem(std::uintptr_t addr, std::size_t size, std::uint64_t& value);
+  bool write_mem(std::uintptr_t addr, std::size_t size, std::uint64_t value);
+
+  bool address(const zydis_instr_t& instr,
+               const zydis_decoded_operand_t& op,
+               std::uint64_t& addr) const;
+  bool read(const zydis_instr_t& instr,
+            const zydis_decoded_operand_t& op,
+            std::uint64_t& value);
+  bool write(const zydis_instr_t& instr,
+             const zydis_decoded_operand_t& op,
+             std::uint64_t value);
+
+  void set_flags(std::uint64_t result,
+                 std::uint32_t width,
+                 bool cf,
+                 bool of,
+                 bool af);
+  bool condition(ZydisMnemonic mnemonic, bool& taken) const;
+
+  uc_engine* m_uc;
+  engine_t* m_engine;
+  std::vector<region_t> m_regions;
+
+  std::array<std::uint64_t, 16> m_gpr;
+  std::uint64_t m_rip, m_rflags;
+  std::uint32_t m_fallbacks;
+};
+}  // namespace vm::emu
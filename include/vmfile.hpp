@@ -0,0 +1,35 @@
+#pragma once
+#include <cstdint>
+#include <memory>
+#include <string>
+
+namespace vm {
+/// <summary>
+/// a file mapped read only into memory... pages are only read in from disk
+/// when they are touched and are dropped again when the file is closed, so
+/// even very large binaries never need a heap copy of their own.
+/// </summary>
+class file_t {
+ public:
+  /// <summary>
+  /// maps a whole file read only...
+  /// </summary>
+  /// <param name="path">path to the file...</param>
+  /// <returns>returns nullptr if the file could not be opened or mapped, or
+  /// if it is empty...</returns>
+  static std::unique_ptr<file_t> open(const std::string& path);
+
+  ~file_t();
+  file_t(const file_t&) = delete;
+  file_t& operator=(const file_t&) = delete;
+
+  const std::uint8_t* data() const { return m_data; }
+  std::size_t size() const { return m_size; }
+
+ private:
+  file_t(const std::uint8_t* data, std::size_t size);
+
+  const std::uint8_t* m_data;
+  const std::size_t m_size;
+};
+}  // namespace vm
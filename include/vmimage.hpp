@@ -0,0 +1,147 @@
+#pragma once
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace vm::sched {
+class scheduler_t;
+}
+
+namespace vm {
+/// <summary>
+/// how base relocations are applied when an image is mapped...
+/// </summary>
+enum class reloc_mode_t {
+  /// <summary>
+  /// every relocation block is applied before map returns, one after the
+  /// other...
+  /// </summary>
+  eager,
+
+  /// <summary>
+  /// every relocation block is applied before map returns, one task per block
+  /// on the scheduler passed to map... without one map starts and joins a
+  /// scheduler of up to four workers for every image, which costs more than
+  /// relocating a small image eagerly. pass the scheduler the
+  /// image is analyzed with when mapping more than one image.
+  /// </summary>
+  parallel,
+
+  /// <summary>
+  /// a page is only relocated when it is first touched through
+  /// vm::image_t::touch... the decoder and the locator touch everything they
+  /// read, and creating an engine for the image relocates whatever is left.
+  /// </summary>
+  lazy
+};
+
+/// <summary>
+/// a PE image mapped into a single page aligned shared mapping and relocated
+/// to the address it was mapped at...
+///
+/// the emulator does not get its own copy of the image, instead map_view
+/// creates a private copy-on-write view of the very same pages which is then
+/// handed to unicorn-engine with uc_mem_map_ptr. pages are shared between the
+/// analyzer and every emulator until an emulator writes to one, and that write
+/// only ever lands in the emulator's private copy of the page...
+/// </summary>
+class image_t {
+ public:
+  /// <summary>
+  /// maps the headers and sections of a raw PE file and applies base
+  /// relocations...
+  /// </summary>
+  /// <param name="file">raw bytes of the PE file...</param>
+  /// <param name="file_size">size of the PE file in bytes...</param>
+  /// <param name="mode">how base relocations are applied...</param>
+  /// <param name="sched">optional scheduler to relocate on in parallel
+  /// mode...</param>
+  /// <returns>returns nullptr if the file is not a valid 64bit PE or if the
+  /// mapping could not be created...</returns>
+  static std::unique_ptr<image_t> map(
+      const std::uint8_t* file,
+      std::size_t file_size,
+      reloc_mode_t mode = reloc_mode_t::eager,
+      vm::sched::scheduler_t* sched = nullptr);
+
+  /// <summary>
+  /// memory maps a PE file and maps its image... the file is only mapped
+  /// while the sections are copied out of it, it is never read into the heap.
+  /// </summary>
+  /// <param name="path">path to the PE file...</param>
+  /// <param name="mode">how base relocations are applied...</param>
+  /// <param name="sched">optional scheduler to relocate on in parallel
+  /// mode...</param>
+  /// <returns>returns nullptr if the file could not be opened or if it is not
+  /// a valid 64bit PE...</returns>
+  static std::unique_ptr<image_t> load(
+      const std::string& path,
+      reloc_mode_t mode = reloc_mode_t::eager,
+      vm::sched::scheduler_t* sched = nullptr);
+
+  /// <summary>
+  /// relocates every page of a lazily relocated image which overlaps the given
+  /// range, or which holds a relocation that does... call this before reading
+  /// from an image which might be relocated lazily. does nothing for any
+  /// other memory and costs a single atomic load while no lazily relocated
+  /// image has pages left to relocate.
+  /// </summary>
+  static void touch(std::uintptr_t addr, std::size_t size);
+
+  /// <summary>
+  /// number of pages which still have to be relocated...
+  /// </summary>
+  std::size_t pending() const { return m_pending.load(); }
+
+  ~image_t();
+  image_t(const image_t&) = delete;
+  image_t& operator=(const image_t&) = delete;
+
+  /// <summary>
+  /// linear virtual address of the mapped image, image base from the optional
+  /// header and the page aligned size of the mapping...
+  /// </summary>
+  const std::uintptr_t m_module_base, m_image_base, m_image_size;
+
+  /// <summary>
+  /// creates a private copy-on-write view of the relocated image... writes to
+  /// the view are never visible to the analyzer or to other views...
+  /// </summary>
+  /// <returns>returns nullptr if the view could not be mapped...</returns>
+  void* map_view() const;
+
+  /// <summary>
+  /// unmaps a view created with map_view...
+  /// </summary>
+  void unmap_view(void* view) const;
+
+ private:
+  image_t(std::uintptr_t module_base,
+          std::uintptr_t image_base,
+          std::uintptr_t image_size,
+          std::intptr_t section);
+
+  /// <summary>
+  /// applies the relocations of every page in [begin, end)...
+  /// </summary>
+  void relocate(std::uintptr_t begin, std::uintptr_t end);
+
+  /// <summary>
+  /// memfd on linux or section handle on windows backing every view...
+  /// </summary>
+  const std::intptr_t m_section;
+
+  /// <summary>
+  /// lazy relocation state... the rva of every relocation block which still
+  /// has to be applied, by page, and a flag per page which is set once the
+  /// page has nothing left to relocate.
+  /// </summary>
+  std::mutex m_lock;
+  std::vector<std::vector<std::uint32_t>> m_relocs;
+  std::unique_ptr<std::atomic<bool>[]> m_relocated;
+  std::atomic<std::size_t> m_pending;
+};
+}  // namespace vm
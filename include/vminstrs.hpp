@@ -3,10 +3,16 @@
 
 #include <vmutils.hpp>
 #include <array>
+#include <memory>
+#include <memory_resource>
 
 #define VIRTUAL_REGISTER_COUNT 24
 #define VIRTUAL_SEH_REGISTER 24
 
+namespace vm::compact {
+class snapshot_t;
+}
+
 namespace vm::instrs {
 /// <summary>
 /// mnemonic representation of supported virtual instructions...
@@ -138,15 +144,11 @@ struct vblk_t {
 
   struct {
     /// <summary>
-    /// unicorn-engine cpu context of the first instruction of the jmp
-    /// handler...
-    /// </summary>
-    uc_context* ctx;
-
-    /// <summary>
-    /// unicorn-engine stack of the first instruction of the jmp handler...
+    /// registers and stack window at the first instruction of the jmp
+    /// handler, rehydrate it with vm::compact::snapshot_t::restore... nullptr
+    /// for blocks replayed from a vm::emu::blk_cache_t.
     /// </summary>
-    std::uint8_t* stack;
+    std::shared_ptr<const vm::compact::snapshot_t> state;
 
     struct {
       zydis_reg_t vip;
@@ -162,9 +164,11 @@ struct vblk_t {
   std::array<ZydisRegister, 16> vmexit_pop_order;
 
   /// <summary>
-  /// vector of virtual instructions for this basic block...
+  /// vector of virtual instructions for this basic block... allocated from the
+  /// memory resource of the routine, copies of the block allocate from the
+  /// heap.
   /// </summary>
-  std::vector<vm::instrs::vinstr_t> m_vinstrs;
+  std::pmr::vector<vm::instrs::vinstr_t> m_vinstrs;
 
   /// <summary>
   /// virtual branch type...
@@ -174,7 +178,7 @@ struct vblk_t {
   /// <summary>
   /// vector of virtual instruction pointers. one for each branch...
   /// </summary>
-  std::vector<std::uintptr_t> branches;
+  std::pmr::vector<std::uintptr_t> branches;
 };
 
 /// <summary>
@@ -186,6 +190,13 @@ struct vrtn_t {
   /// </summary>
   std::uint32_t m_rva;
 
+  /// <summary>
+  /// memory resource the containers of the blocks allocate from, kept alive
+  /// for as long as the routine... declared before m_blks so that it goes
+  /// last.
+  /// </summary>
+  std::shared_ptr<std::pmr::memory_resource> m_arena;
+
   /// <summary>
   /// vector of virtual code blocks... these virtual code blocks contain virtual
   /// instructions...
@@ -203,9 +214,16 @@ struct emu_instr_t {
   zydis_decoded_instr_t m_instr;
 
   /// <summary>
-  /// cpu context before execution of this instruction...
+  /// cpu context before execution of this instruction... this is nullptr for
+  /// instructions traced lazily, use vm::instrs::get_cpu to read it...
   /// </summary>
   uc_context* m_cpu;
+
+  /// <summary>
+  /// index of this instruction in the emulated instruction stream of the
+  /// handler, before any instructions were removed by deobfuscation...
+  /// </summary>
+  std::uint32_t m_idx;
 };
 
 /// <summary>
@@ -242,7 +260,24 @@ struct hndlr_trace_t {
   /// <summary>
   /// vector of emulated, diassembled instructions...
   /// </summary>
-  std::vector<emu_instr_t> m_instrs;
+  std::pmr::vector<emu_instr_t> m_instrs;
+
+  /// <summary>
+  /// creates the cpu context of the instruction at the given m_idx for traces
+  /// which do not snapshot every instruction... empty if every instruction
+  /// already has an m_cpu...
+  /// </summary>
+  std::function<uc_context*(std::uint32_t idx)> m_materialize;
+
+  /// <summary>
+  /// where the imm of the virtual instruction came from... the native register
+  /// holding it right before the instruction with m_idx idx executed. set by
+  /// the profiles whose virtual instructions have an imm.
+  /// </summary>
+  struct {
+    std::uint32_t idx;
+    zydis_reg_t reg;
+  } m_imm;
 };
 
 /// <summary>
@@ -315,16 +350,17 @@ extern profiler_t shrd;
 extern profiler_t vmexit;
 
 /// <summary>
-/// unsorted vector of profiles... they get sorted once at runtime...
+/// unsorted vector of profiles... this is never modified, use
+/// vm::instrs::registry for the profiles in the order they are matched...
 /// </summary>
-inline std::vector<profiler_t*> profiles = {
+inline const std::vector<profiler_t*> profiles = {
     &vmexit, &shl, &shld, &shr, &shrd, &imul, &nor,  &write, &svsp, &read, 
     &nand, &lvsp, &add, &jmp, &_or, &_and, &sreg, &lreg, &lcr0,  &lconst, &nop, &writedr7};
 
 /// <summary> 
 /// no i did not make this by hand, you cannot clown upon me!
 /// </summary>
-inline std::map<zydis_reg_t, uc_x86_reg> reg_map = {
+inline const std::map<zydis_reg_t, uc_x86_reg> reg_map = {
     {ZYDIS_REGISTER_AL, UC_X86_REG_AL},
     {ZYDIS_REGISTER_CL, UC_X86_REG_CL},
     {ZYDIS_REGISTER_DL, UC_X86_REG_DL},
@@ -394,6 +430,15 @@ inline std::map<zydis_reg_t, uc_x86_reg> reg_map = {
     {ZYDIS_REGISTER_R14, UC_X86_REG_R14},
     {ZYDIS_REGISTER_R15, UC_X86_REG_R15}};
 
+/// <summary>
+/// looks up the unicorn-engine register of a zydis register... registers which
+/// are not in reg_map give UC_X86_REG_INVALID instead of throwing.
+/// </summary>
+inline uc_x86_reg uc_reg(zydis_reg_t reg) {
+  const auto itr = reg_map.find(reg);
+  return itr != reg_map.end() ? itr->second : UC_X86_REG_INVALID;
+}
+
 /// <summary>
 /// deadstore and opaque branch removal from unicorn engine trace... this is the
 /// same algorithm as the one in vm::utils::deobfuscate...
@@ -402,10 +447,17 @@ inline std::map<zydis_reg_t, uc_x86_reg> reg_map = {
 void deobfuscate(hndlr_trace_t& trace);
 
 /// <summary>
-/// sorts the profiles by descending order of matchers... this will prevent a
+/// profiles sorted by descending order of matchers... this will prevent a
 /// smaller profiler with less matchers from being used when it should not be...
 ///
-/// this function can be called multiple times...
+/// the sorted copy is made the first time this is called (from any thread) and
+/// is never modified after that, so it can be read from any number of threads.
+/// </summary>
+const std::vector<profiler_t*>& registry();
+
+/// <summary>
+/// builds the profile registry ahead of time... calling this is optional, and
+/// it can be called multiple times from any thread...
 /// </summary>
 void init();
 
@@ -418,6 +470,21 @@ void init();
 /// <returns>returns vinstr_t structure...</returns>
 vinstr_t determine(hndlr_trace_t& hndlr);
 
+/// <summary>
+/// cpu context before execution of an instruction of the trace... materializes
+/// and caches the context if the instruction was traced lazily...
+/// </summary>
+/// <param name="hndlr">trace the instruction belongs to...</param>
+/// <param name="instr">instruction of the trace...</param>
+/// <returns>returns nullptr if the context could not be materialized...</returns>
+uc_context* get_cpu(hndlr_trace_t& hndlr, emu_instr_t& instr);
+
+/// <summary>
+/// frees every cpu context of the trace and clears the instruction stream...
+/// </summary>
+/// <param name="hndlr"></param>
+void release(hndlr_trace_t& hndlr);
+
 /// <summary>
 /// get profile from mnemonic...
 /// </summary>
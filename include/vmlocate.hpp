@@ -1,10 +1,16 @@
 #pragma once
 #include <nt/image.hpp>
+#include <vmfile.hpp>
 #include <vmutils.hpp>
 
 #define PUSH_4B_IMM "\x68\x00\x00\x00\x00"
 #define PUSH_4B_MASK "x????"
 
+// bump whenever the checks change which vm entries are found, cached vm
+// entries from older versions are then scanned for again...
+#define VMLOCATE_VERSION 1u
+#define VMLOCATE_CACHE_MAGIC 0x43454d56u  // "VMEC"
+
 namespace vm::locate {
 inline bool find(const zydis_rtn_t& rtn,
                  std::function<bool(const zydis_instr_t&)> callback) {
@@ -22,4 +28,34 @@ std::uintptr_t sigscan(void* base, std::uint32_t size, const char* pattern,
 
 std::vector<vm_enter_t> get_vm_entries(std::uintptr_t module_base,
                                        std::uint32_t module_size);
+
+/// <summary>
+/// locates vm entries straight from a raw PE file, without mapping or
+/// relocating it... rvas are translated to file offsets through the section
+/// table, so only the executable sections of the file are ever read.
+/// </summary>
+/// <param name="file">the PE file...</param>
+/// <returns>returns the same vm entries as the mapped image would...</returns>
+std::vector<vm_enter_t> get_vm_entries(const vm::file_t& file);
+
+/// <summary>
+/// hash of everything get_vm_entries reads from a raw PE file, the layout and
+/// raw bytes of its executable sections... fast, but not meant to hold up
+/// against collisions made on purpose.
+/// </summary>
+std::uint64_t hash(const vm::file_t& file);
+
+/// <summary>
+/// same as above but looks the vm entries up in a cache first... cached vm
+/// entries are keyed by hash and VMLOCATE_VERSION, so a file with different
+/// bytes or a newer locator never gets stale ones. on a miss the file is
+/// scanned and the vm entries are written to the cache atomically.
+/// </summary>
+/// <param name="cache">directory holding the cached vm entries, created if it
+/// does not exist...</param>
+/// <param name="hit">optional, set to whether the vm entries came from the
+/// cache...</param>
+std::vector<vm_enter_t> get_vm_entries(const vm::file_t& file,
+                                       const std::string& cache,
+                                       bool* hit = nullptr);
 }  // namespace vm::locate
\ No newline at end of file
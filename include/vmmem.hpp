@@ -0,0 +1,52 @@
+#pragma once
+#include <cstddef>
+#include <memory>
+#include <memory_resource>
+#include <mutex>
+
+#define VMMEM_ARENA_CHUNK 0x10000u
+
+namespace vm::mem {
+/// <summary>
+/// where the containers of a routine analysis get their memory from...
+/// </summary>
+enum class policy_t {
+  /// <summary>
+  /// every container allocates from the heap on its own...
+  /// </summary>
+  heap,
+
+  /// <summary>
+  /// every container of the routine allocates from one arena, which is
+  /// released in one go once the routine and every copy of it are gone...
+  /// </summary>
+  arena
+};
+
+/// <summary>
+/// monotonic arena which is safe to allocate from on many threads at once...
+/// memory handed out is only given back when the arena is destroyed.
+/// </summary>
+class arena_t : public std::pmr::memory_resource {
+ public:
+  arena_t();
+  arena_t(const arena_t&) = delete;
+  arena_t& operator=(const arena_t&) = delete;
+
+ private:
+  void* do_allocate(std::size_t bytes, std::size_t align) override;
+  void do_deallocate(void* ptr, std::size_t bytes, std::size_t align) override;
+  bool do_is_equal(const std::pmr::memory_resource& other) const
+      noexcept override;
+
+  std::mutex m_lock;
+  std::pmr::monotonic_buffer_resource m_arena;
+};
+
+/// <summary>
+/// creates the memory resource for one routine analysis...
+/// </summary>
+/// <returns>returns a new arena_t, or the heap which is never
+/// freed...</returns>
+std::shared_ptr<std::pmr::memory_resource> make(policy_t policy);
+}  // namespace vm::mem
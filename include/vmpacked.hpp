@@ -0,0 +1,123 @@
+#pragma once
+#include <iterator>
+#include <memory_resource>
+#include <vminstrs.hpp>
+
+// immediate sizes are at most 64 bits, the top bit says there is one...
+#define VM_PACKED_HAS_IMM 0x80u
+
+namespace vm::instrs {
+/// <summary>
+/// virtual instructions stored column by column... a mnemonic, a stack size
+/// and an immediate size byte per virtual instruction, and the immediates
+/// themselves only for the virtual instructions which have one. that is 3 to 11
+/// bytes per virtual instruction instead of the 24 of a vinstr_t, and passes
+/// which only look at mnemonics read nothing else.
+///
+/// nothing is stored packed, vblk_t::m_vinstrs stays a vector of vinstr_t...
+/// passes which scan the blocks of many routines over and over pack them
+/// themselves first.
+/// </summary>
+class packed_vinstrs_t {
+ public:
+  /// <summary>
+  /// yields the packed virtual instructions as vinstr_t's, front to back...
+  /// </summary>
+  class iterator_t {
+   public:
+    using iterator_category = std::forward_iterator_tag;
+    using value_type = vinstr_t;
+    using difference_type = std::ptrdiff_t;
+    using pointer = void;
+    using reference = vinstr_t;
+
+    iterator_t() : m_vinstrs(nullptr), m_idx(0u), m_imm(0u) {}
+    iterator_t(const packed_vinstrs_t* vinstrs,
+               std::size_t idx,
+               std::size_t imm)
+        : m_vinstrs(vinstrs), m_idx(idx), m_imm(imm) {}
+
+    vinstr_t operator*() const {
+      const auto imm_size = m_vinstrs->m_imm_sizes[m_idx];
+      const bool has_imm = imm_size & VM_PACKED_HAS_IMM;
+      return {m_vinstrs->m_mnemonics[m_idx],
+              m_vinstrs->m_stack_sizes[m_idx],
+              {has_imm, static_cast<u8>(imm_size & ~VM_PACKED_HAS_IMM),
+               has_imm ? m_vinstrs->m_imms[m_imm] : 0ull}};
+    }
+
+    iterator_t& operator++() {
+      m_imm += (m_vinstrs->m_imm_sizes[m_idx++] & VM_PACKED_HAS_IMM) != 0u;
+      return *this;
+    }
+
+    iterator_t operator++(int) {
+      auto prev = *this;
+      ++*this;
+      return prev;
+    }
+
+    bool operator==(const iterator_t& other) const {
+      return m_idx == other.m_idx;
+    }
+
+   private:
+    const packed_vinstrs_t* m_vinstrs;
+    std::size_t m_idx, m_imm;
+  };
+
+  explicit packed_vinstrs_t(
+      std::pmr::memory_resource* resource = std::pmr::get_default_resource());
+
+  /// <summary>
+  /// packs vinstrs...
+  /// </summary>
+  template <class T>
+  packed_vinstrs_t(
+      const T& vinstrs,
+      std::pmr::memory_resource* resource = std::pmr::get_default_resource())
+      : packed_vinstrs_t(resource) {
+    reserve(std::size(vinstrs));
+    for (const auto& vinstr : vinstrs)
+      push_back(vinstr);
+  }
+
+  void push_back(const vinstr_t& vinstr);
+  void reserve(std::size_t size);
+  void clear();
+
+  std::size_t size() const { return m_mnemonics.size(); }
+  bool empty() const { return m_mnemonics.empty(); }
+
+  iterator_t begin() const { return {this, 0u, 0u}; }
+  iterator_t end() const { return {this, size(), m_imms.size()}; }
+
+  /// <summary>
+  /// the columns themselves, for passes which only need some of them...
+  /// </summary>
+  const std::pmr::vector<mnemonic_t>& mnemonics() const { return m_mnemonics; }
+  const std::pmr::vector<u8>& stack_sizes() const { return m_stack_sizes; }
+
+  /// <summary>
+  /// size in bits of the immediate of every virtual instruction or'ed with
+  /// VM_PACKED_HAS_IMM, 0 if it has none...
+  /// </summary>
+  const std::pmr::vector<u8>& imm_sizes() const { return m_imm_sizes; }
+
+  /// <summary>
+  /// immediates of the virtual instructions which have one, in order...
+  /// </summary>
+  const std::pmr::vector<u64>& imms() const { return m_imms; }
+
+  /// <summary>
+  /// bytes used by the packed virtual instructions...
+  /// </summary>
+  std::size_t bytes() const;
+
+ private:
+  std::pmr::vector<mnemonic_t> m_mnemonics;
+  std::pmr::vector<u8> m_stack_sizes;
+  std::pmr::vector<u8> m_imm_sizes;
+  std::pmr::vector<u64> m_imms;
+};
+}  // namespace vm::instrs
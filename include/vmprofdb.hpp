@@ -0,0 +1,182 @@
+#pragma once
+#include <atomic>
+#include <cstddef>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <vminstrs.hpp>
+
+#define VMPROFDB_MAGIC 0x44504d56u  // "VMPD"
+#define VMPROFDB_VERSION 1u
+#define VMPROFDB_MAX_INSTRS 0x1000u
+
+namespace vm::profdb {
+// on disk layout... a header followed by every record, sorted by key, so the
+// same profiles always give the same bytes.
+
+struct header_t {
+  std::uint32_t magic;
+  std::uint32_t version;
+  std::uint64_t record_cnt;
+};
+
+/// <summary>
+/// identifies a vm handler across builds... a hash of its deobfuscated
+/// instruction bytes and the native registers used for VIP and VSP going in.
+/// </summary>
+struct key_t {
+  std::uint64_t hash;
+  std::uint16_t vip, vsp;
+  std::uint32_t pad;
+
+  auto operator<=>(const key_t&) const = default;
+};
+
+/// <summary>
+/// what profiling a vm handler found out, enough to run it again without
+/// tracing it... nothing in here depends on where the handler is, so a record
+/// applies to the same handler in another build.
+/// </summary>
+struct record_t {
+  key_t key;
+
+  /// <summary>
+  /// native registers used for VIP and VSP after the handler...
+  /// </summary>
+  std::uint16_t vip, vsp;
+
+  /// <summary>
+  /// native register holding the imm right before the instruction at imm_idx
+  /// of the deobfuscated handler executes...
+  /// </summary>
+  std::uint16_t imm_reg;
+  std::uint8_t mnemonic;
+  std::uint8_t stack_size;
+  std::uint8_t has_imm;
+  std::uint8_t imm_size;
+  std::uint16_t pad;
+  std::uint32_t imm_idx;
+};
+
+static_assert(sizeof(header_t) == 16u && sizeof(key_t) == 16u &&
+              sizeof(record_t) == 32u);
+
+/// <summary>
+/// where a known vm handler is in the module being explored...
+/// </summary>
+struct site_t {
+  /// <summary>
+  /// address of the JMP REG ending the handler and the native instructions
+  /// executed up to and including it...
+  /// </summary>
+  std::uintptr_t jmp;
+  std::uint32_t executed;
+
+  /// <summary>
+  /// native instructions executed before the imm is in the record's
+  /// imm_reg...
+  /// </summary>
+  std::uint32_t imm_at;
+};
+
+/// <summary>
+/// vm handler profiles which outlive a run... vm::emu::emu_t looks a handler
+/// up before tracing it and runs known handlers untraced, handlers it did
+/// have to trace are added. safe to use from many threads. what was found out
+/// about the handlers at each address is remembered until forget is called.
+/// </summary>
+class db_t {
+ public:
+  /// <summary>
+  /// opens the database at path... a file which does not exist yet is an
+  /// empty database, save creates it.
+  /// </summary>
+  /// <returns>returns nullptr if the file exists but is not a
+  /// database...</returns>
+  static std::unique_ptr<db_t> open(const std::string& path);
+
+  /// <summary>
+  /// writes every record back to the path the database was opened from...
+  /// </summary>
+  bool save();
+
+  /// <summary>
+  /// looks up the vm handler at rip entered with the given VIP and VSP...
+  /// </summary>
+  /// <returns>returns false if the handler is not known...</returns>
+  bool find(std::uintptr_t rip,
+            zydis_reg_t vip,
+            zydis_reg_t vsp,
+            record_t& record,
+            site_t& site);
+
+  /// <summary>
+  /// adds the profile of a traced vm handler, unless it is already known...
+  /// vm exits, handlers which did not run straight through from rip to a JMP
+  /// REG and handlers the imm of which cannot be located are left out.
+  /// </summary>
+  /// <param name="hndlr">trace of the handler after vm::instrs::determine,
+  /// its m_vip and m_vsp are the registers used after the handler...</param>
+  /// <param name="executed">native instructions the handler executed...</param>
+  void insert(std::uintptr_t rip,
+              zydis_reg_t vip,
+              zydis_reg_t vsp,
+              const vm::instrs::vinstr_t& vinstr,
+              const vm::instrs::hndlr_trace_t& hndlr,
+              std::uint32_t executed);
+
+  struct stats_t {
+    /// <summary>
+    /// lookups, the ones which found a record, and records added since the
+    /// database was opened...
+    /// </summary>
+    std::uint64_t lookups, hits, inserted;
+  };
+
+  /// <summary>
+  /// forgets the handlers at every address... call it before exploring
+  /// another module which could be mapped where the last one was.
+  /// </summary>
+  void forget();
+
+  stats_t stats() const;
+  std::size_t size();
+
+ private:
+  explicit db_t(const std::string& path);
+
+  /// <summary>
+  /// flattened vm handler at an address... memoized, the bytes of a handler
+  /// are the same every time within a run.
+  /// </summary>
+  struct handler_t {
+    /// <summary>
+    /// hash of the deobfuscated instruction bytes...
+    /// </summary>
+    std::uint64_t hash;
+
+    /// <summary>
+    /// address of every native instruction executed, in order and the JMP REG
+    /// last...
+    /// </summary>
+    std::vector<std::uintptr_t> path;
+
+    /// <summary>
+    /// indices into path of the instructions left after deobfuscation...
+    /// </summary>
+    std::vector<std::uint32_t> deobfuscated;
+  };
+
+  /// <returns>returns nullptr if the handler could not be
+  /// flattened...</returns>
+  std::shared_ptr<const handler_t> handler(std::uintptr_t rip);
+
+  const std::string m_path;
+  std::mutex m_lock;
+  std::map<key_t, record_t> m_records;
+  std::map<std::uintptr_t, std::shared_ptr<const handler_t>> m_handlers;
+  std::atomic<std::uint64_t> m_lookups, m_hits, m_inserted;
+};
+}  // namespace vm::profdb
@@ -1,8 +1,22 @@
 #pragma once
 #include <Zydis/Zydis.h>
 
+#include <vmcompact.hpp>
 #include <vmctx.hpp>
+#include <vmemu.hpp>
+#include <vmeval.hpp>
+#include <vmfile.hpp>
+#include <vmimage.hpp>
 #include <vminstrs.hpp>
 #include <vmlocate.hpp>
+#include <vmmem.hpp>
+#include <vmpacked.hpp>
+#include <vmprofdb.hpp>
+#include <vmsched.hpp>
+#include <vmshard.hpp>
+#include <vmstore.hpp>
+#include <vmtrace.hpp>
 #include <vmutils.hpp>
-#include <uc_allocation_tracker.hpp>
\ No newline at end of file
+#include <uc_allocation_tracker.hpp>
+#include <uc_engine_pool.hpp>
+#include <uc_state.hpp>
\ No newline at end of file
@@ -0,0 +1,172 @@
+#pragma once
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <unordered_set>
+#include <vector>
+
+#define VM_SCHED_SET_SHARDS 64u
+#define VM_SCHED_MAX_DEPTH 16u
+
+namespace vm::sched {
+using task_t = std::function<void()>;
+
+/// <summary>
+/// a set of tasks which can be waited on together... tasks spawned into a group
+/// may spawn more tasks into the same group.
+/// </summary>
+class group_t {
+ public:
+  group_t() : m_pending(0u) {}
+  group_t(const group_t&) = delete;
+  group_t& operator=(const group_t&) = delete;
+
+  /// <summary>
+  /// number of tasks of this group which have not finished yet...
+  /// </summary>
+  std::uint32_t pending() const { return m_pending.load(); }
+
+ private:
+  friend class scheduler_t;
+  std::atomic<std::uint32_t> m_pending;
+};
+
+/// <summary>
+/// work stealing task scheduler... every worker thread has its own deque, it
+/// pushes and pops its own tasks at the back (newest first, the data they touch
+/// is still warm) and steals from the front of the other workers' deques
+/// (oldest first, usually the biggest pieces of work) when it runs dry.
+///
+/// waiting on a group from inside of a task does not block the worker, it runs
+/// other tasks until the group is done... so tasks can spawn nested tasks and
+/// wait for them without running out of threads. once VM_SCHED_MAX_DEPTH tasks
+/// are nested on a thread like this, wait only runs tasks of its own group.
+/// </summary>
+class scheduler_t {
+ public:
+  /// <summary>
+  /// starts the worker threads, they sleep until work is submitted...
+  /// </summary>
+  /// <param name="threads">number of worker threads, defaults to the number of
+  /// hardware threads...</param>
+  explicit scheduler_t(std::uint32_t threads = 0u);
+  ~scheduler_t();
+
+  scheduler_t(const scheduler_t&) = delete;
+  scheduler_t& operator=(const scheduler_t&) = delete;
+
+  /// <summary>
+  /// queue a task... from a worker thread the task goes onto that worker's own
+  /// deque, from any other thread the workers get tasks round robin.
+  /// </summary>
+  void spawn(group_t& group, task_t task);
+
+  /// <summary>
+  /// runs tasks until every task of the group has finished... sleeps while
+  /// there is nothing to run and the group is not done yet.
+  /// </summary>
+  void wait(group_t& group);
+
+  /// <summary>
+  /// number of worker threads...
+  /// </summary>
+  std::uint32_t size() const { return m_workers.size(); }
+
+ private:
+  struct job_t {
+    task_t task;
+    group_t* group;
+  };
+
+  struct worker_t {
+    std::mutex lock;
+    std::deque<job_t> jobs;
+  };
+
+  bool pop(std::uint32_t idx, job_t& job);
+  bool steal(std::uint32_t idx, job_t& job);
+  bool find(std::uint32_t idx, job_t& job);
+
+  /// <summary>
+  /// takes a queued job of the given group from any worker's deque...
+  /// </summary>
+  bool take(std::uint32_t idx, const group_t& group, job_t& job);
+  void execute(job_t& job);
+  void run(std::uint32_t idx);
+
+  /// <summary>
+  /// index of the calling thread's worker in this scheduler, size() if the
+  /// calling thread is not one of its workers...
+  /// </summary>
+  std::uint32_t current() const;
+
+  std::vector<std::unique_ptr<worker_t>> m_workers;
+  std::vector<std::thread> m_threads;
+
+  /// <summary>
+  /// number of queued jobs, sleeping workers wake up when this is non zero...
+  /// threads waiting on a group sleep on m_wake as well, and also wake up when
+  /// a group finishes.
+  /// </summary>
+  std::atomic<std::uint32_t> m_queued;
+  std::atomic<std::uint32_t> m_next;
+
+  std::mutex m_lock;
+  std::condition_variable m_wake;
+  bool m_stop;
+};
+
+/// <summary>
+/// a set tasks can insert into concurrently... values are spread over shards by
+/// hash, each with its own lock, so that tasks rarely wait on each other.
+/// </summary>
+template <class T, class hash_t = std::hash<T>>
+class set_t {
+ public:
+  /// <summary>
+  /// inserts value into its shard unless it is already in the set...
+  /// </summary>
+  /// <returns>returns false if value was already in the set...</returns>
+  bool insert(const T& value) {
+    auto& shard = m_shards[hash_t{}(value) % VM_SCHED_SET_SHARDS];
+    std::lock_guard<std::mutex> lock(shard.lock);
+    return shard.values.insert(value).second;
+  }
+
+  bool contains(const T& value) {
+    auto& shard = m_shards[hash_t{}(value) % VM_SCHED_SET_SHARDS];
+    std::lock_guard<std::mutex> lock(shard.lock);
+    return shard.values.count(value) != 0u;
+  }
+
+  std::size_t size() {
+    std::size_t result = 0u;
+    for (auto& shard : m_shards) {
+      std::lock_guard<std::mutex> lock(shard.lock);
+      result += shard.values.size();
+    }
+    return result;
+  }
+
+  void clear() {
+    for (auto& shard : m_shards) {
+      std::lock_guard<std::mutex> lock(shard.lock);
+      shard.values.clear();
+    }
+  }
+
+ private:
+  // a cache line each so that neighbouring shards do not share one...
+  struct alignas(64) shard_t {
+    std::mutex lock;
+    std::unordered_set<T, hash_t> values;
+  };
+
+  shard_t m_shards[VM_SCHED_SET_SHARDS];
+};
+}  // namespace vm::sched
@@ -0,0 +1,64 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <vminstrs.hpp>
+#include <vmlocate.hpp>
+
+namespace vm::shard {
+/// <summary>
+/// the virtual routines of one binary...
+/// </summary>
+struct module_t {
+  /// <summary>
+  /// file name of the binary, without its directory so that shards written
+  /// on different machines still merge...
+  /// </summary>
+  std::string name;
+
+  /// <summary>
+  /// virtual routines sorted by vm entry rva... blocks carry no unicorn-engine
+  /// state, m_jmp.state is always nullptr.
+  /// </summary>
+  std::vector<vm::instrs::vrtn_t> vrtns;
+
+  /// <summary>
+  /// address the binary was mapped at while the routines were devirtualized,
+  /// m_jmp.rip of every block is relative to it... routines read back from a
+  /// store are image based, this is the image base then.
+  /// </summary>
+  std::uintptr_t module_base;
+};
+
+/// <summary>
+/// the vm entries which belong to shard idx of count... entries are spread by
+/// a hash of their rva, so every process can pick its own share out of the
+/// same entry list without talking to any other.
+/// </summary>
+std::vector<vm::locate::vm_enter_t> select(
+    const std::vector<vm::locate::vm_enter_t>& entries,
+    std::uint32_t idx,
+    std::uint32_t count);
+
+/// <summary>
+/// writes modules to a vm::store... modules are sorted by name and
+/// routines by rva first, so the same results always give the same bytes no
+/// matter in which order they were produced.
+/// </summary>
+/// <returns>returns false if the file could not be written...</returns>
+bool write(const std::string& path, std::vector<module_t>& modules);
+
+/// <summary>
+/// reads every module out of a vm::store...
+/// </summary>
+/// <returns>returns false if the file could not be mapped as a
+/// vm::store...</returns>
+bool read(const std::string& path, std::vector<module_t>& modules);
+
+/// <summary>
+/// combines shard files into one... routines of the same binary are joined,
+/// a routine found in more than one shard is only kept once.
+/// </summary>
+/// <returns>returns false if a shard could not be read or the output could
+/// not be written...</returns>
+bool merge(const std::vector<std::string>& shards, const std::string& path);
+}  // namespace vm::shard
@@ -0,0 +1,293 @@
+#pragma once
+#include <cstddef>
+#include <fstream>
+#include <memory>
+#include <span>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <vmfile.hpp>
+#include <vminstrs.hpp>
+
+#define VMSTORE_MAGIC 0x54534d56u  // "VMST"
+#define VMSTORE_VERSION 1u
+#define VMSTORE_ALIGN 8u
+
+namespace vm::store {
+// on disk layout... every record is 8 byte aligned and refers to others only
+// by file offset, so a mapped file is used as is. a store is a list of modules
+// (one per binary), each a list of routines, each a list of blocks. variable
+// sized data is written first and the tables pointing at it last, which lets
+// the writer stream blocks out as they come. nothing depends on where the
+// binary was mapped, addresses are rvas or image based.
+
+/// <summary>
+/// first record of every store... modules is 0 until the writer finishes, so
+/// a store that was never finished reads as invalid.
+/// </summary>
+struct header_t {
+  std::uint32_t magic;
+  std::uint32_t version;
+  std::uint64_t modules;
+  std::uint32_t module_cnt;
+  std::uint32_t pad;
+};
+
+struct module_t {
+  std::uint64_t name;
+  std::uint64_t rtns;
+  std::uint32_t name_size;
+  std::uint32_t rtn_cnt;
+};
+
+struct rtn_t {
+  std::uint64_t blks;
+  std::uint32_t rva;
+  std::uint32_t blk_cnt;
+};
+
+struct blk_t {
+  std::uint64_t img_based;
+  std::uint64_t jmp_img_based;
+  std::uint64_t vinstrs;
+  std::uint64_t branches;
+  std::uint32_t rva;
+  std::uint32_t vinstr_cnt;
+  std::uint32_t branch_cnt;
+  std::uint16_t vip, vsp;
+  std::uint16_t jmp_vip, jmp_vsp;
+  std::uint8_t branch_type;
+  std::uint8_t is_branch;
+  std::uint8_t pop_cnt;
+  std::uint8_t pad;
+  std::uint16_t pops[16];
+};
+
+// virtual instructions and branches are stored as vm::instrs::vinstr_t and
+// std::uintptr_t themselves, padding zeroed, so views can hand out spans...
+static_assert(sizeof(vm::instrs::vinstr_t) == 24u &&
+              offsetof(vm::instrs::vinstr_t, imm) == 8u);
+static_assert(sizeof(std::uintptr_t) == 8u);
+static_assert(sizeof(header_t) == 24u && sizeof(module_t) == 24u &&
+              sizeof(rtn_t) == 16u && sizeof(blk_t) == 88u);
+
+/// <summary>
+/// read only view of a block in a store... mirrors vm::instrs::vblk_t, minus
+/// the unicorn-engine state of the jmp handler.
+/// </summary>
+class blk_view_t {
+ public:
+  blk_view_t(const std::uint8_t* base, std::size_t size, const blk_t* blk)
+      : m_base(base), m_size(size), m_blk(blk) {}
+
+  bool is_branch() const { return m_blk->is_branch; }
+
+  struct vip_t {
+    std::uint32_t rva;
+    std::uintptr_t img_based;
+  };
+  vip_t vip() const { return {m_blk->rva, m_blk->img_based}; }
+
+  struct vm_t {
+    zydis_reg_t vip, vsp;
+  };
+  vm_t vm() const {
+    return {static_cast<zydis_reg_t>(m_blk->vip),
+            static_cast<zydis_reg_t>(m_blk->vsp)};
+  }
+
+  struct jmp_t {
+    vm_t vm;
+
+    /// <summary>
+    /// image based address of the first instruction of the jmp handler...
+    /// </summary>
+    std::uintptr_t img_based;
+  };
+  jmp_t jmp() const {
+    return {{static_cast<zydis_reg_t>(m_blk->jmp_vip),
+             static_cast<zydis_reg_t>(m_blk->jmp_vsp)},
+            m_blk->jmp_img_based};
+  }
+
+  std::array<ZydisRegister, 16> vmexit_pop_order() const;
+
+  vm::instrs::vbranch_type branch_type() const {
+    return static_cast<vm::instrs::vbranch_type>(m_blk->branch_type);
+  }
+
+  /// <summary>
+  /// virtual instructions of this block, straight out of the mapping...
+  /// </summary>
+  /// <returns>returns an empty span if the store is corrupt...</returns>
+  std::span<const vm::instrs::vinstr_t> vinstrs() const;
+
+  /// <summary>
+  /// branches of this block, straight out of the mapping...
+  /// </summary>
+  /// <returns>returns an empty span if the store is corrupt...</returns>
+  std::span<const std::uintptr_t> branches() const;
+
+  /// <summary>
+  /// copies the block out of the store... m_jmp.state is nullptr and
+  /// m_jmp.rip is image based.
+  /// </summary>
+  vm::instrs::vblk_t get() const;
+
+ private:
+  const std::uint8_t* m_base;
+  std::size_t m_size;
+  const blk_t* m_blk;
+};
+
+/// <summary>
+/// read only view of a routine in a store... mirrors vm::instrs::vrtn_t.
+/// </summary>
+class rtn_view_t {
+ public:
+  rtn_view_t(const std::uint8_t* base, std::size_t size, const rtn_t* rtn)
+      : m_base(base), m_size(size), m_rtn(rtn) {}
+
+  std::uint32_t rva() const { return m_rtn->rva; }
+  std::size_t size() const { return m_rtn->blk_cnt; }
+  blk_view_t operator[](std::size_t idx) const {
+    return {m_base, m_size,
+            reinterpret_cast<const blk_t*>(m_base + m_rtn->blks) + idx};
+  }
+
+  /// <summary>
+  /// copies the routine out of the store...
+  /// </summary>
+  vm::instrs::vrtn_t get() const;
+
+ private:
+  const std::uint8_t* m_base;
+  std::size_t m_size;
+  const rtn_t* m_rtn;
+};
+
+/// <summary>
+/// read only view of the routines of one binary in a store...
+/// </summary>
+class module_view_t {
+ public:
+  module_view_t(const std::uint8_t* base,
+                std::size_t size,
+                const module_t* module)
+      : m_base(base), m_size(size), m_module(module) {}
+
+  std::string_view name() const {
+    return {reinterpret_cast<const char*>(m_base + m_module->name),
+            m_module->name_size};
+  }
+
+  std::size_t size() const { return m_module->rtn_cnt; }
+  rtn_view_t operator[](std::size_t idx) const {
+    return {m_base, m_size,
+            reinterpret_cast<const rtn_t*>(m_base + m_module->rtns) + idx};
+  }
+
+ private:
+  const std::uint8_t* m_base;
+  std::size_t m_size;
+  const module_t* m_module;
+};
+
+/// <summary>
+/// a store mapped read only... nothing is parsed or copied, only the module
+/// and routine tables are bounds checked when the store is opened.
+/// </summary>
+class view_t {
+ public:
+  /// <summary>
+  /// maps a store...
+  /// </summary>
+  /// <returns>returns nullptr if the file could not be mapped, is not a store
+  /// of this version, was never finished or its tables are out of
+  /// bounds...</returns>
+  static std::unique_ptr<view_t> open(const std::string& path);
+
+  std::size_t size() const { return m_header->module_cnt; }
+  module_view_t operator[](std::size_t idx) const {
+    return {m_file->data(), m_file->size(),
+            reinterpret_cast<const module_t*>(m_file->data() +
+                                              m_header->modules) +
+                idx};
+  }
+
+ private:
+  explicit view_t(std::unique_ptr<vm::file_t> file);
+
+  std::unique_ptr<vm::file_t> m_file;
+  const header_t* m_header;
+};
+
+/// <summary>
+/// writes a store front to back... blocks are written out as soon as they are
+/// added, only the fixed size tables of the current routine and module are
+/// kept in memory until they end.
+/// </summary>
+class writer_t {
+ public:
+  /// <summary>
+  /// creates or truncates the store at path...
+  /// </summary>
+  /// <returns>returns nullptr if the file could not be created...</returns>
+  static std::unique_ptr<writer_t> open(const std::string& path);
+
+  /// <summary>
+  /// starts the next module, ending the current one...
+  /// </summary>
+  void begin(const std::string& name);
+
+  /// <summary>
+  /// adds a block to the current routine...
+  /// </summary>
+  /// <param name="module_base">address the binary was mapped at while the
+  /// block was explored, m_jmp.rip is stored image based...</param>
+  void add(const vm::instrs::vblk_t& blk, std::uintptr_t module_base);
+  void add(const blk_view_t& blk);
+
+  /// <summary>
+  /// ends the current routine, whose blocks were added since the last
+  /// end()...
+  /// </summary>
+  void end(std::uint32_t rva);
+
+  /// <summary>
+  /// adds every block of a routine and ends it...
+  /// </summary>
+  void add(const vm::instrs::vrtn_t& vrtn, std::uintptr_t module_base);
+  void add(const rtn_view_t& rtn);
+
+  /// <summary>
+  /// ends the current module, writes the module table and points the header
+  /// at it... nothing can be added afterwards.
+  /// </summary>
+  /// <returns>returns false if anything could not be written...</returns>
+  bool finish();
+
+ private:
+  explicit writer_t(std::ofstream&& file);
+
+  /// <summary>
+  /// writes size bytes and pads the file to VMSTORE_ALIGN...
+  /// </summary>
+  /// <returns>returns the file offset the data was written at...</returns>
+  std::uint64_t write(const void* data, std::size_t size);
+
+  void add(blk_t& blk,
+           std::span<const vm::instrs::vinstr_t> vinstrs,
+           std::span<const std::uintptr_t> branches);
+
+  void end_module();
+
+  std::ofstream m_file;
+  std::uint64_t m_offset;
+  bool m_in_module;
+  std::string m_name;
+  std::vector<blk_t> m_blks;
+  std::vector<rtn_t> m_rtns;
+  std::vector<module_t> m_modules;
+};
+}  // namespace vm::store
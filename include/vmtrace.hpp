@@ -0,0 +1,132 @@
+#pragma once
+#include <uc_state.hpp>
+#include <unordered_map>
+#include <vminstrs.hpp>
+
+namespace vm::emu {
+/// <summary>
+/// how the tracer hooks execution...
+/// </summary>
+enum class trace_mode_t {
+  /// <summary>
+  /// UC_HOOK_CODE on every instruction, every instruction is decoded and gets
+  /// its own cpu context snapshot as it executes...
+  /// </summary>
+  instr,
+
+  /// <summary>
+  /// UC_HOOK_BLOCK on every basic block, blocks are decoded once through the
+  /// decode cache and cpu contexts are only materialized for the instructions
+  /// a profile asks about, by replaying the handler from its checkpoint...
+  /// </summary>
+  block
+};
+
+/// <summary>
+/// basic blocks decoded once and kept by address...
+/// </summary>
+class decode_cache_t {
+ public:
+  /// <summary>
+  /// decoded instructions of the basic block at addr...
+  /// </summary>
+  /// <param name="addr">linear virtual address of the block, the module must
+  /// be mapped at the same address in the emulator and in the analyzer...</param>
+  /// <param name="size">size of the block in bytes...</param>
+  /// <returns>returns nullptr if the block could not be decoded...</returns>
+  const std::vector<zydis_decoded_instr_t>* get(std::uintptr_t addr,
+                                                std::uint32_t size);
+
+  std::size_t size() const { return m_blocks.size(); }
+
+ private:
+  struct block_t {
+    std::uint32_t size;
+    std::vector<zydis_decoded_instr_t> instrs;
+  };
+
+  std::unordered_map<std::uintptr_t, block_t> m_blocks;
+};
+
+/// <summary>
+/// traces a single vm handler at a time on one unicorn-engine... the hook for
+/// the chosen mode is installed once and stays installed for the lifetime of
+/// the tracer, it only records while trace() is running.
+/// </summary>
+class tracer_t {
+ public:
+  /// <summary>
+  /// installs the hook of the chosen mode on the engine...
+  /// </summary>
+  /// <param name="uc">engine to trace on...</param>
+  /// <param name="state">state manager of the engine, used to replay the
+  /// handler when a lazily traced cpu context is materialized...</param>
+  /// <param name="mode">hooking mode...</param>
+  /// <param name="module_base">only code inside of the module is traced...</param>
+  /// <param name="image_size">size of the module...</param>
+  tracer_t(uc_engine* uc,
+           state_t& state,
+           trace_mode_t mode,
+           std::uintptr_t module_base,
+           std::uintptr_t image_size);
+  ~tracer_t();
+
+  tracer_t(const tracer_t&) = delete;
+  tracer_t& operator=(const tracer_t&) = delete;
+
+  /// <summary>
+  /// emulates and traces one vm handler starting at rip... emulation stops on
+  /// the first instruction after the handler's JMP REG or RET. in block mode
+  /// this checkpoints the engine's vm::emu::state_t at rip.
+  /// </summary>
+  /// <param name="rip">first instruction of the vm handler...</param>
+  /// <param name="vip">native register used for VIP...</param>
+  /// <param name="vsp">native register used for VSP...</param>
+  /// <param name="hndlr">filled with the trace... release it with
+  /// vm::instrs::release before the next trace...</param>
+  /// <param name="next">first instruction of the next vm handler, zero if
+  /// the handler ended with a RET...</param>
+  /// <returns>returns false if emulation failed...</returns>
+  bool trace(std::uintptr_t rip,
+             zydis_reg_t vip,
+             zydis_reg_t vsp,
+             vm::instrs::hndlr_trace_t& hndlr,
+             std::uintptr_t& next);
+
+  trace_mode_t mode() const { return m_mode; }
+  decode_cache_t& cache() { return m_cache; }
+
+ private:
+  static void on_code(uc_engine* uc,
+                      std::uint64_t addr,
+                      std::uint32_t size,
+                      tracer_t* tracer);
+
+  static void on_block(uc_engine* uc,
+                       std::uint64_t addr,
+                       std::uint32_t size,
+                       tracer_t* tracer);
+
+  /// <summary>
+  /// replays the current handler from its checkpoint to snapshot the cpu
+  /// before the instruction at idx, then replays it to the end again...
+  /// </summary>
+  uc_context* materialize(std::uint32_t idx);
+
+  uc_engine* m_uc;
+  state_t& m_state;
+  const trace_mode_t m_mode;
+  uc_hook m_hook;
+  decode_cache_t m_cache;
+
+  /// <summary>
+  /// state of the trace in progress...
+  /// </summary>
+  vm::instrs::hndlr_trace_t* m_hndlr;
+  bool m_active, m_done, m_ret, m_failed;
+  std::uintptr_t m_next;
+  std::uint32_t m_executed;
+
+  const std::uintptr_t m_module_base, m_image_size;
+};
+}  // namespace vm::emu
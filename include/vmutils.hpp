@@ -30,22 +30,36 @@ struct zydis_instr_t {
 using zydis_rtn_t = std::vector<zydis_instr_t>;
 
 namespace vm::utils {
-inline thread_local std::shared_ptr<ZydisDecoder> g_decoder = nullptr;
-inline thread_local std::shared_ptr<ZydisFormatter> g_formatter = nullptr;
+/// <summary>
+/// every thread gets its own decoder and formatter, they are initialized the
+/// first time they are used on that thread...
+/// </summary>
+inline thread_local std::shared_ptr<ZydisDecoder> g_decoder = []() {
+  auto decoder = std::make_shared<ZydisDecoder>();
+  ZydisDecoderInit(decoder.get(), ZYDIS_MACHINE_MODE_LONG_64,
+                   ZYDIS_ADDRESS_WIDTH_64);
+  return decoder;
+}();
+
+inline thread_local std::shared_ptr<ZydisFormatter> g_formatter = []() {
+  auto formatter = std::make_shared<ZydisFormatter>();
+  ZydisFormatterInit(formatter.get(), ZYDIS_FORMATTER_STYLE_INTEL);
+  return formatter;
+}();
 
+/// <summary>
+/// the decoder and formatter initialize themselves now, this only makes sure
+/// they exist on the calling thread...
+/// </summary>
 inline void init() {
-  if (!vm::utils::g_decoder && !vm::utils::g_formatter) {
-    vm::utils::g_decoder = std::make_shared<ZydisDecoder>();
-    vm::utils::g_formatter = std::make_shared<ZydisFormatter>();
-
-    ZydisDecoderInit(vm::utils::g_decoder.get(), ZYDIS_MACHINE_MODE_LONG_64,
-                     ZYDIS_ADDRESS_WIDTH_64);
-
-    ZydisFormatterInit(vm::utils::g_formatter.get(),
-                       ZYDIS_FORMATTER_STYLE_INTEL);
-  }
+  g_decoder.get();
+  g_formatter.get();
 }
 
+/// <summary>
+/// reads a whole file into data... use vm::image_t::load to map a PE file
+/// without reading it into the heap first.
+/// </summary>
 inline bool open_binary_file(const std::string& file,
                              std::vector<uint8_t>& data) {
   std::ifstream fstr(file, std::ios::binary);
@@ -57,10 +71,9 @@ inline bool open_binary_file(const std::string& file,
   const auto file_size = fstr.tellg();
 
   fstr.seekg(NULL, std::ios::beg);
-  data.reserve(static_cast<uint32_t>(file_size));
-  data.insert(data.begin(), std::istream_iterator<uint8_t>(fstr),
-              std::istream_iterator<uint8_t>());
-  return true;
+  data.resize(static_cast<std::size_t>(file_size));
+  return static_cast<bool>(
+      fstr.read(reinterpret_cast<char*>(data.data()), data.size()));
 }
 
 /// <summary>
@@ -127,15 +140,49 @@ bool flatten(zydis_rtn_t& routine, std::uintptr_t routine_addr,
              bool keep_jmps = false, std::uint32_t max_instrs = 500,
              std::uintptr_t module_base = 0ull);
 
+/// <summary>
+/// gives flatten the bytes at an address... returns a pointer to the bytes
+/// and sets size to how many of them can be read, or returns nullptr if
+/// nothing is there.
+/// </summary>
+using reader_t = std::function<const std::uint8_t*(std::uintptr_t addr,
+                                                   std::size_t& size)>;
+
+/// <summary>
+/// flatten native instruction stream, reading every instruction through
+/// reader... addresses do not have to be mapped, for example they can be
+/// RVAs which the reader translates to offsets in a raw file.
+/// </summary>
+/// <param name="routine">filled with decoded instructions...</param>
+/// <param name="routine_addr">address to start flattening from...</param>
+/// <param name="reader">returns the bytes at an address...</param>
+/// <returns>returns true if flattened was successful...</returns>
+bool flatten(zydis_rtn_t& routine,
+             std::uintptr_t routine_addr,
+             const reader_t& reader,
+             bool keep_jmps = false,
+             std::uint32_t max_instrs = 500);
+
 /// <summary>
 /// deadstore deobfuscation of a flattened routine...
 /// </summary>
 /// <param name="routine">reference to a flattened instruction vector...</param>
 void deobfuscate(zydis_rtn_t& routine);
 
+/// <summary>
+/// checks the headers of a raw 64bit PE file before anything reads them... the
+/// MZ and PE signatures, the PE32+ magic and that the nt headers and the
+/// section table lie inside of the file.
+/// </summary>
+/// <param name="file">raw bytes of the PE file...</param>
+/// <param name="file_size">size of the PE file in bytes...</param>
+/// <returns>returns true if the headers can be read safely...</returns>
+bool valid_pe(const std::uint8_t* file, std::size_t file_size);
+
 /// <summary>
 /// small namespace that contains function wrappers to determine the validity of
-/// linear virtual addresses...
+/// linear virtual addresses... every thread keeps the sections of the last
+/// module it asked about sorted by address, so a lookup is a binary search.
 /// </summary>
 namespace scn {
 /// <summary>
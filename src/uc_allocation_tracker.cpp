@@ -1,7 +1,7 @@
 #include <uc_allocation_tracker.hpp>
 #include <cstdio>
 
-int g_allocation_tracker;
+std::atomic<int> g_allocation_tracker;
 
 uc_err uct_context_alloc(uc_engine *uc, uc_context **context)
 {
@@ -11,6 +11,9 @@ uc_err uct_context_alloc(uc_engine *uc, uc_context **context)
 }
 uc_err uct_context_free(uc_context *context)
 {
+  // lazily traced instructions have no context...
+  if (!context)
+    return UC_ERR_OK;
   --g_allocation_tracker;
   //std::printf("Allocations: %p\n", g_allocation_tracker);
   return uc_context_free(context);
@@ -18,5 +21,5 @@ uc_err uct_context_free(uc_context *context)
 
 void print_allocation_number()
 {
-  std::printf("uc_context allocations: %p\n", g_allocation_tracker);
+  std::printf("uc_context allocations: %p\n", g_allocation_tracker.load());
 }
\ No newline at end of file
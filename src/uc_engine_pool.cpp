@@ -0,0 +1,218 @@
+#include <uc_allocation_tracker.hpp>
+#include <uc_engine_pool.hpp>
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <thread>
+
+namespace vm::emu {
+lease_t::lease_t(engine_pool_t* pool, engine_t* engine)
+    : m_pool(pool), m_engine(engine) {}
+
+lease_t::lease_t(lease_t&& other) noexcept
+    : m_pool(other.m_pool), m_engine(other.m_engine) {
+  other.m_engine = nullptr;
+}
+
+lease_t::~lease_t() {
+  if (m_engine)
+    m_pool->release(m_engine);
+}
+
+// creates the state manager of an engine, tracking the stack and the image
+// view if there is one... the shared image is the view's clean copy.
+static void make_state(engine_t* engine) {
+  engine->state = std::make_unique<state_t>(engine->uc);
+  engine->state->track(EMU_STACK_BASE, EMU_STACK_SIZE, engine->stack);
+
+  if (engine->image_view)
+    engine->state->track(
+        engine->image->m_module_base, engine->image->m_image_size,
+        reinterpret_cast<std::uint8_t*>(engine->image_view),
+        reinterpret_cast<const std::uint8_t*>(engine->image->m_module_base));
+}
+
+state_t& lease_t::state() {
+  if (!m_engine->state)
+    make_state(m_engine);
+
+  return *m_engine->state;
+}
+
+tracer_t& lease_t::tracer(trace_mode_t mode) {
+  if (!m_engine->tracer || m_engine->tracer->mode() != mode) {
+    // the old hook has to be removed before the new one goes in...
+    m_engine->tracer.reset();
+    m_engine->tracer = std::make_unique<tracer_t>(
+        m_engine->uc, state(), mode, m_engine->module_base,
+        m_engine->image_size);
+  }
+  return *m_engine->tracer;
+}
+
+engine_pool_t::engine_pool_t(std::uintptr_t module_base,
+                             std::uintptr_t image_size,
+                             std::uint32_t max_engines)
+    : m_module_base(module_base),
+      m_image_size(image_size),
+      m_image(nullptr),
+      m_max_engines(max_engines ? max_engines
+                                : std::max(std::thread::hardware_concurrency(),
+                                           1u)) {}
+
+engine_pool_t::engine_pool_t(const vm::image_t& image,
+                             std::uint32_t max_engines)
+    : m_module_base(image.m_module_base),
+      m_image_size(image.m_image_size),
+      m_image(&image),
+      m_max_engines(max_engines ? max_engines
+                                : std::max(std::thread::hardware_concurrency(),
+                                           1u)) {}
+
+engine_pool_t::~engine_pool_t() {
+  for (auto engine : m_engines)
+    destroy(engine);
+}
+
+lease_t engine_pool_t::lease() {
+  std::unique_lock<std::mutex> lock(m_lock);
+  m_returned.wait(lock, [&]() -> bool {
+    return !m_free.empty() || m_engines.size() < m_max_engines;
+  });
+
+  if (!m_free.empty()) {
+    // most recently returned engine first, its translation cache is warm...
+    const auto engine = m_free.back();
+    m_free.pop_back();
+    return lease_t(this, engine);
+  }
+
+  const auto engine = create_engine();
+  if (engine)
+    m_engines.push_back(engine);
+
+  return lease_t(this, engine);
+}
+
+std::uint32_t engine_pool_t::size() {
+  std::lock_guard<std::mutex> lock(m_lock);
+  return m_engines.size();
+}
+
+void engine_pool_t::release(engine_t* engine) {
+  reset(engine);
+  {
+    std::lock_guard<std::mutex> lock(m_lock);
+    m_free.push_back(engine);
+  }
+  m_returned.notify_one();
+}
+
+engine_t* engine_pool_t::create_engine() const {
+  return m_image ? create(*m_image) : create(m_module_base, m_image_size);
+}
+
+// open a new unicorn-engine with the image mapped at module_base backed by the
+// host memory at image and a fresh stack...
+static engine_t* open_engine(std::uintptr_t module_base,
+                             std::uintptr_t image_size,
+                             void* image,
+                             std::uint32_t image_prot) {
+  auto engine = new engine_t{};
+  uc_err err;
+
+  if ((err = uc_open(UC_ARCH_X86, UC_MODE_64, &engine->uc))) {
+    std::printf("[!] failed to create unicorn-engine... reason = %s\n",
+                uc_strerror(err));
+    delete engine;
+    return nullptr;
+  }
+
+  // page align the stack allocation so that unicorn-engine is happy girl...
+  engine->stack_data.resize(EMU_STACK_SIZE + 0x1000);
+  engine->stack = reinterpret_cast<std::uint8_t*>(
+      (reinterpret_cast<std::uintptr_t>(engine->stack_data.data()) + 0xFFFull) &
+      ~0xFFFull);
+
+  const auto rsp = EMU_INITIAL_RSP;
+  const auto mapped_size = (image_size + 0xFFFull) & ~0xFFFull;
+  engine->module_base = module_base;
+  engine->image_size = mapped_size;
+
+  if ((err = uc_mem_map_ptr(engine->uc, module_base, mapped_size, image_prot,
+                            image)) ||
+      (err = uc_mem_map_ptr(engine->uc, EMU_STACK_BASE, EMU_STACK_SIZE,
+                            UC_PROT_ALL, engine->stack)) ||
+      (err = uc_reg_write(engine->uc, UC_X86_REG_RSP, &rsp)) ||
+      (err = uct_context_alloc(engine->uc, &engine->clean)) ||
+      (err = uc_context_save(engine->uc, engine->clean))) {
+    std::printf("[!] failed to map memory into unicorn-engine... reason = %s\n",
+                uc_strerror(err));
+    if (engine->clean)
+      uct_context_free(engine->clean);
+    uc_close(engine->uc);
+    delete engine;
+    return nullptr;
+  }
+
+  return engine;
+}
+
+engine_t* engine_pool_t::create(std::uintptr_t module_base,
+                                std::uintptr_t image_size) {
+  // the emulator can not ask for pages to be relocated as it touches them...
+  vm::image_t::touch(module_base, image_size);
+  return open_engine(module_base, image_size,
+                     reinterpret_cast<void*>(module_base),
+                     UC_PROT_READ | UC_PROT_EXEC);
+}
+
+engine_t* engine_pool_t::create(const vm::image_t& image) {
+  vm::image_t::touch(image.m_module_base, image.m_image_size);
+  const auto view = image.map_view();
+  if (!view)
+    return nullptr;
+
+  const auto engine =
+      open_engine(image.m_module_base, image.m_image_size, view, UC_PROT_ALL);
+  if (!engine) {
+    image.unmap_view(view);
+    return nullptr;
+  }
+
+  engine->image_view = view;
+  engine->image = &image;
+
+  // writes to the view have to be known from the start, reset only reverts
+  // the pages the state saw being written...
+  make_state(engine);
+  return engine;
+}
+
+void engine_pool_t::destroy(engine_t* engine) {
+  engine->tracer.reset();
+  engine->state.reset();
+  uct_context_free(engine->clean);
+  uc_close(engine->uc);
+  if (engine->image_view)
+    engine->image->unmap_view(engine->image_view);
+  delete engine;
+}
+
+void engine_pool_t::reset(engine_t* engine) {
+  std::memset(engine->stack, 0, EMU_STACK_SIZE);
+  uc_context_restore(engine->uc, engine->clean);
+
+  // pages of the image view written by this lease go back to the shared
+  // image, otherwise the next lease would see them... engines with a view
+  // always have a state, so only the written pages are copied.
+  if (engine->image_view)
+    engine->state->revert();
+
+  if (engine->state) {
+    engine->state->forget();
+    engine->state->checkpoint();
+  }
+}
+}  // namespace vm::emu
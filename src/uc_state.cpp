@@ -0,0 +1,262 @@
+#include <uc_allocation_tracker.hpp>
+#include <uc_state.hpp>
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+
+namespace vm::emu {
+// every page of a fresh stack is this one...
+static const page_t g_zero_page =
+    std::make_shared<const std::array<std::uint8_t, EMU_PAGE_SIZE>>();
+
+static bool test(const std::vector<std::uint64_t>& bits, std::size_t page) {
+  return bits[page / 64] & (1ull << (page % 64));
+}
+
+static void set(std::vector<std::uint64_t>& bits, std::size_t page) {
+  bits[page / 64] |= 1ull << (page % 64);
+}
+
+fork_t::~fork_t() {
+  uct_context_free(m_ctx);
+}
+
+state_t::state_t(uc_engine* uc) : m_uc(uc), m_ctx(nullptr) {
+  uc_err err;
+  if ((err = uct_context_alloc(m_uc, &m_ctx)) ||
+      (err = uc_context_save(m_uc, m_ctx))) {
+    std::printf("[!] failed to save unicorn-engine context... reason = %s\n",
+                uc_strerror(err));
+
+    // a context which was never saved must not be restored...
+    uct_context_free(m_ctx);
+    m_ctx = nullptr;
+  }
+}
+
+state_t::~state_t() {
+  for (auto& region : m_regions)
+    uc_hook_del(m_uc, region->hook);
+
+  uct_context_free(m_ctx);
+}
+
+bool state_t::track(std::uintptr_t base,
+                    std::size_t size,
+                    std::uint8_t* host,
+                    const std::uint8_t* clean) {
+  auto region = std::make_unique<region_t>();
+  region->state = this;
+  region->base = base;
+  region->size = size;
+  region->host = host;
+  region->clean = clean;
+  region->bitmap.resize((size / EMU_PAGE_SIZE + 63) / 64);
+  region->touched.resize(region->bitmap.size());
+  region->written.resize(region->bitmap.size());
+
+  if (uc_hook_add(m_uc, &region->hook, UC_HOOK_MEM_WRITE,
+                  reinterpret_cast<void*>(&state_t::on_write), region.get(),
+                  base, base + size - 1))
+    return false;
+
+  m_regions.push_back(std::move(region));
+  return true;
+}
+
+void state_t::checkpoint() {
+  if (m_ctx)
+    uc_context_save(m_uc, m_ctx);
+
+  for (auto& region : m_regions) {
+    for (auto page : region->pages)
+      region->bitmap[page / 64] &= ~(1ull << (page % 64));
+
+    region->pages.clear();
+    region->backup.clear();
+  }
+}
+
+void state_t::rollback() {
+  for (auto& region : m_regions) {
+    for (auto idx = 0u; idx < region->pages.size(); ++idx) {
+      const auto page = region->pages[idx];
+      std::memcpy(region->host + page * EMU_PAGE_SIZE,
+                  region->backup.data() + idx * EMU_PAGE_SIZE, EMU_PAGE_SIZE);
+      region->bitmap[page / 64] &= ~(1ull << (page % 64));
+    }
+
+    region->pages.clear();
+    region->backup.clear();
+  }
+
+  if (m_ctx)
+    uc_context_restore(m_uc, m_ctx);
+}
+
+bool state_t::write(std::uintptr_t addr, const void* data, std::size_t size) {
+  for (auto& region : m_regions) {
+    if (addr < region->base || addr + size > region->base + region->size)
+      continue;
+
+    mark(*region, addr, size);
+    std::memcpy(region->host + (addr - region->base), data, size);
+    return true;
+  }
+  return false;
+}
+
+std::shared_ptr<const fork_t> state_t::fork() {
+  auto result = std::make_shared<fork_t>();
+  result->m_ctx = nullptr;
+  result->m_owned = 0u;
+  if (uct_context_alloc(m_uc, &result->m_ctx) ||
+      uc_context_save(m_uc, result->m_ctx))
+    return {};
+
+  // a fork taken before a region was tracked can not be shared with...
+  const auto parent =
+      m_fork && m_fork->m_pages.size() == m_regions.size() ? m_fork : nullptr;
+
+  result->m_pages.resize(m_regions.size());
+  for (auto idx = 0u; idx < m_regions.size(); ++idx) {
+    const auto& region = *m_regions[idx];
+    const auto count = region.size / EMU_PAGE_SIZE;
+    auto& pages = result->m_pages[idx];
+    pages = parent ? parent->m_pages[idx] : std::vector<page_t>(count);
+
+    // only touched pages can differ from the parent, and only written pages
+    // from the clean copy... whole words of neither are skipped at once.
+    const auto& bits = parent ? region.touched : region.written;
+    const auto sparse = parent || region.clean;
+
+    for (auto page = 0u; page < count; ++page) {
+      if (sparse && !test(bits, page)) {
+        if (!bits[page / 64])
+          page |= 63u;
+        continue;
+      }
+
+      // a page written and then rolled back is still the same page...
+      const auto host = region.host + page * EMU_PAGE_SIZE;
+      auto& shared = pages[page];
+      if (region.clean &&
+          !std::memcmp(region.clean + page * EMU_PAGE_SIZE, host,
+                       EMU_PAGE_SIZE)) {
+        shared = nullptr;
+        continue;
+      }
+
+      if (shared && !std::memcmp(shared->data(), host, EMU_PAGE_SIZE))
+        continue;
+
+      if (!std::memcmp(g_zero_page->data(), host, EMU_PAGE_SIZE)) {
+        shared = g_zero_page;
+        continue;
+      }
+
+      auto copy = std::make_shared<std::array<std::uint8_t, EMU_PAGE_SIZE>>();
+      std::memcpy(copy->data(), host, EMU_PAGE_SIZE);
+      shared = std::move(copy);
+      ++result->m_owned;
+    }
+  }
+  return result;
+}
+
+void state_t::restore(const std::shared_ptr<const fork_t>& fork) {
+  if (fork->m_pages.size() != m_regions.size())
+    return;
+
+  const auto parent =
+      m_fork && m_fork->m_pages.size() == m_regions.size() ? m_fork : nullptr;
+
+  for (auto idx = 0u; idx < m_regions.size(); ++idx) {
+    auto& region = *m_regions[idx];
+    const auto& pages = fork->m_pages[idx];
+
+    for (auto page = 0u; page < pages.size(); ++page) {
+      if (parent && !test(region.touched, page) &&
+          parent->m_pages[idx][page] == pages[page])
+        continue;
+
+      // the clean page only has to be copied back if it was written...
+      const auto host = region.host + page * EMU_PAGE_SIZE;
+      if (!pages[page]) {
+        if (test(region.written, page))
+          std::memcpy(host, region.clean + page * EMU_PAGE_SIZE, EMU_PAGE_SIZE);
+        continue;
+      }
+
+      std::memcpy(host, pages[page]->data(), EMU_PAGE_SIZE);
+      set(region.written, page);
+    }
+
+    std::fill(region.touched.begin(), region.touched.end(), 0ull);
+  }
+
+  m_fork = fork;
+  uc_context_restore(m_uc, fork->m_ctx);
+  checkpoint();
+}
+
+void state_t::forget() {
+  m_fork = nullptr;
+}
+
+void state_t::revert() {
+  for (auto& region : m_regions) {
+    if (!region->clean)
+      continue;
+
+    for (auto page = 0u; page < region->size / EMU_PAGE_SIZE; ++page)
+      if (test(region->written, page))
+        std::memcpy(region->host + page * EMU_PAGE_SIZE,
+                    region->clean + page * EMU_PAGE_SIZE, EMU_PAGE_SIZE);
+
+    std::fill(region->touched.begin(), region->touched.end(), 0ull);
+    std::fill(region->written.begin(), region->written.end(), 0ull);
+  }
+}
+
+std::size_t state_t::dirty() const {
+  std::size_t result = 0u;
+  for (const auto& region : m_regions)
+    result += region->pages.size();
+  return result;
+}
+
+void state_t::on_write(uc_engine*,
+                       uc_mem_type,
+                       std::uint64_t addr,
+                       int size,
+                       std::int64_t,
+                       region_t* region) {
+  region->state->mark(*region, addr, size);
+}
+
+void state_t::mark(region_t& region, std::uintptr_t addr, std::size_t size) {
+  // a single write can straddle two pages...
+  const auto first = (addr - region.base) / EMU_PAGE_SIZE;
+  const auto last = std::min<std::uintptr_t>(
+      (addr + size - 1 - region.base) / EMU_PAGE_SIZE,
+      region.size / EMU_PAGE_SIZE - 1);
+
+  for (auto page = first; page <= last; ++page) {
+    auto& bits = region.bitmap[page / 64];
+    if (bits & (1ull << (page % 64)))
+      continue;
+
+    // the hook runs before the write lands, so this is the page as it was at
+    // the checkpoint...
+    bits |= 1ull << (page % 64);
+    set(region.touched, page);
+    set(region.written, page);
+    region.pages.push_back(page);
+    region.backup.insert(region.backup.end(),
+                         region.host + page * EMU_PAGE_SIZE,
+                         region.host + (page + 1) * EMU_PAGE_SIZE);
+  }
+}
+}  // namespace vm::emu
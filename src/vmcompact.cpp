@@ -0,0 +1,304 @@
+#include <vmcompact.hpp>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+
+#if defined(_WIN32)
+#include <Windows.h>
+#else
+#include <unistd.h>
+#endif
+
+namespace vm::compact {
+static int g_uc_regs[VM_COMPACT_REGS] = {
+    UC_X86_REG_RAX, UC_X86_REG_RCX, UC_X86_REG_RDX, UC_X86_REG_RBX,
+    UC_X86_REG_RSP, UC_X86_REG_RBP, UC_X86_REG_RSI, UC_X86_REG_RDI,
+    UC_X86_REG_R8,  UC_X86_REG_R9,  UC_X86_REG_R10, UC_X86_REG_R11,
+    UC_X86_REG_R12, UC_X86_REG_R13, UC_X86_REG_R14, UC_X86_REG_R15,
+    UC_X86_REG_RIP, UC_X86_REG_RFLAGS};
+
+// a run of zeros shorter than this is cheaper to keep as literals...
+static constexpr std::size_t g_min_zeros = 4u;
+static constexpr std::size_t g_max_run = 0xFFFFu;
+
+static void put(std::vector<std::uint8_t>& out, std::size_t value) {
+  out.push_back(value & 0xFF);
+  out.push_back(value >> 8);
+}
+
+std::vector<std::uint8_t> encode(const std::uint8_t* data, std::size_t size) {
+  std::vector<std::uint8_t> out;
+  std::size_t pos = 0u;
+  while (pos < size) {
+    std::size_t zeros = 0u;
+    while (pos + zeros < size && zeros < g_max_run && !data[pos + zeros])
+      ++zeros;
+    pos += zeros;
+
+    // literals go on until the next run of zeros worth encoding...
+    std::size_t literals = 0u;
+    while (pos + literals < size && literals < g_max_run) {
+      auto run = 0u;
+      while (run < g_min_zeros && pos + literals + run < size &&
+             !data[pos + literals + run])
+        ++run;
+
+      if (run == g_min_zeros)
+        break;
+      literals += run ? run : 1u;
+    }
+    literals = std::min(literals, std::min(g_max_run, size - pos));
+
+    put(out, zeros);
+    put(out, literals);
+    out.insert(out.end(), data + pos, data + pos + literals);
+    pos += literals;
+  }
+  return out;
+}
+
+bool decode(const std::vector<std::uint8_t>& data,
+            std::uint8_t* out,
+            std::size_t size) {
+  std::size_t in = 0u, pos = 0u;
+  while (in + 4u <= data.size()) {
+    const std::size_t zeros = data[in] | data[in + 1] << 8;
+    const std::size_t literals = data[in + 2] | data[in + 3] << 8;
+    in += 4u;
+
+    if (pos + zeros + literals > size || in + literals > data.size())
+      return false;
+
+    std::memset(out + pos, 0, zeros);
+    std::memcpy(out + pos + zeros, data.data() + in, literals);
+    pos += zeros + literals;
+    in += literals;
+  }
+  return in == data.size() && pos == size;
+}
+
+std::shared_ptr<const snapshot_t> snapshot_t::capture(vm::emu::lease_t& lease,
+                                                      zydis_reg_t vsp,
+                                                      codec_t codec,
+                                                      budget_t* budget) {
+  auto result = std::make_shared<snapshot_t>();
+  void* values[VM_COMPACT_REGS];
+  for (auto idx = 0u; idx < VM_COMPACT_REGS; ++idx)
+    values[idx] = &result->m_regs[idx];
+
+  std::uintptr_t vsp_addr = 0u;
+  if (uc_reg_read_batch(lease.uc(), g_uc_regs, values, VM_COMPACT_REGS) ||
+      uc_reg_read(lease.uc(), vm::instrs::uc_reg(vsp), &vsp_addr))
+    return {};
+
+  // RSP is the fifth register... the vm context sits between RSP and VSP.
+  const auto top = EMU_STACK_BASE + EMU_STACK_SIZE;
+  auto low = std::min<std::uintptr_t>(result->m_regs[4], vsp_addr);
+  low = low < EMU_STACK_BASE + VM_COMPACT_SLACK || low > top
+            ? EMU_STACK_BASE
+            : (low - VM_COMPACT_SLACK) & ~0xFull;
+
+  result->m_window = low;
+  result->m_window_size = top - low;
+  result->m_codec = codec;
+
+  const auto window = lease.stack() + (low - EMU_STACK_BASE);
+  if (codec == codec_t::zrle)
+    result->m_data = encode(window, result->m_window_size);
+  else
+    result->m_data.assign(window, window + result->m_window_size);
+
+  result->m_data.shrink_to_fit();
+  if (budget)
+    budget->add(result.get());
+
+  return result;
+}
+
+snapshot_t::~snapshot_t() {
+  if (m_budget)
+    m_budget->remove(this);
+}
+
+bool snapshot_t::restore(vm::emu::lease_t& lease) const {
+  const auto window = lease.stack() + (m_window - EMU_STACK_BASE);
+  std::memset(lease.stack(), 0, m_window - EMU_STACK_BASE);
+
+  // held while decoding so that the window is not spilled from under it...
+  std::unique_lock<std::mutex> lock;
+  if (m_budget) {
+    lock = std::unique_lock<std::mutex>(m_budget->m_lock);
+    if (!m_budget->touch(this))
+      return false;
+  } else if (m_spilled)
+    return false;
+
+  if (m_codec == codec_t::zrle) {
+    if (!decode(m_data, window, m_window_size))
+      return false;
+  } else if (m_data.size() == m_window_size)
+    std::memcpy(window, m_data.data(), m_window_size);
+  else
+    return false;
+
+  if (lock)
+    lock.unlock();
+
+  void* values[VM_COMPACT_REGS];
+  for (auto idx = 0u; idx < VM_COMPACT_REGS; ++idx)
+    values[idx] = const_cast<std::uint64_t*>(&m_regs[idx]);
+
+  uc_context_restore(lease.uc(), lease.engine()->clean);
+  uc_reg_write_batch(lease.uc(), g_uc_regs, values, VM_COMPACT_REGS);
+
+  // the stack was written behind the write hooks' back...
+  auto& state = lease.state();
+  state.forget();
+  state.checkpoint();
+  return true;
+}
+
+std::uint64_t snapshot_t::reg(int reg) const {
+  for (auto idx = 0u; idx < VM_COMPACT_REGS; ++idx)
+    if (g_uc_regs[idx] == reg)
+      return m_regs[idx];
+  return 0u;
+}
+
+std::size_t snapshot_t::size() const {
+  return sizeof(*this) + m_data.capacity();
+}
+
+budget_t::budget_t(std::size_t cap, const std::string& dir)
+    : m_cap(cap), m_end(0u), m_stats{} {
+  // the spill file is opened with trunc, the pid keeps budgets of other
+  // processes sharing the directory from truncating each other's file...
+  static std::atomic<std::uint32_t> next = 0u;
+#if defined(_WIN32)
+  const auto pid = GetCurrentProcessId();
+#else
+  const auto pid = getpid();
+#endif
+  const auto now = std::chrono::steady_clock::now().time_since_epoch().count();
+  const auto name = "vmprofiler-" + std::to_string(pid) + "-" +
+                    std::to_string(now) + "-" + std::to_string(next++) +
+                    ".spill";
+
+  std::error_code err;
+  const auto tmp = std::filesystem::temp_directory_path(err);
+  m_path = ((dir.empty() ? tmp : std::filesystem::path(dir)) / name).string();
+}
+
+budget_t::~budget_t() {
+  // spilled windows are dropped rather than paged back in, the snapshots
+  // outliving the budget are not going to be restored...
+  std::lock_guard<std::mutex> lock(m_lock);
+  for (const auto snapshot : m_lru)
+    snapshot->m_budget = nullptr;
+  for (const auto snapshot : m_cold)
+    snapshot->m_budget = nullptr;
+
+  if (m_file.is_open()) {
+    m_file.close();
+    std::error_code err;
+    std::filesystem::remove(m_path, err);
+  }
+}
+
+budget_t::stats_t budget_t::stats() {
+  std::lock_guard<std::mutex> lock(m_lock);
+  return m_stats;
+}
+
+void budget_t::add(const snapshot_t* snapshot) {
+  std::lock_guard<std::mutex> lock(m_lock);
+  snapshot->m_budget = this;
+  snapshot->m_lru = m_lru.insert(m_lru.begin(), snapshot);
+  m_stats.resident += snapshot->m_data.capacity();
+  m_stats.peak = std::max(m_stats.peak, m_stats.resident);
+  evict(snapshot);
+}
+
+void budget_t::remove(const snapshot_t* snapshot) {
+  std::lock_guard<std::mutex> lock(m_lock);
+  if (snapshot->m_spilled)
+    m_stats.spilled -= snapshot->m_stored;
+  m_stats.resident -= snapshot->m_data.capacity();
+  (snapshot->m_spilled ? m_cold : m_lru).erase(snapshot->m_lru);
+}
+
+bool budget_t::touch(const snapshot_t* snapshot) {
+  if (snapshot->m_spilled) {
+    if (!load(snapshot))
+      return false;
+    m_lru.splice(m_lru.begin(), m_cold, snapshot->m_lru);
+  } else
+    m_lru.splice(m_lru.begin(), m_lru, snapshot->m_lru);
+
+  evict(snapshot);
+  return true;
+}
+
+void budget_t::evict(const snapshot_t* keep) {
+  // the worklist hands out the newest blocks first, the oldest ones are the
+  // furthest from being needed again...
+  while (m_stats.resident > m_cap && !m_lru.empty()) {
+    const auto snapshot = m_lru.back();
+    if (snapshot == keep || !spill(snapshot))
+      break;
+    m_cold.splice(m_cold.end(), m_lru, snapshot->m_lru);
+  }
+}
+
+bool budget_t::spill(const snapshot_t* snapshot) {
+  if (!m_file.is_open()) {
+    m_file.open(m_path, std::ios::in | std::ios::out | std::ios::binary |
+                            std::ios::trunc);
+    if (!m_file) {
+      std::printf("[!] failed to create spill file %s\n", m_path.c_str());
+      return false;
+    }
+  }
+
+  auto& data = snapshot->m_data;
+  m_file.seekp(m_end);
+  if (!m_file.write(reinterpret_cast<const char*>(data.data()), data.size())) {
+    m_file.clear();
+    return false;
+  }
+
+  const auto freed = data.capacity();
+  snapshot->m_offset = m_end;
+  snapshot->m_stored = data.size();
+  snapshot->m_spilled = true;
+  std::vector<std::uint8_t>().swap(data);
+
+  m_end += snapshot->m_stored;
+  m_stats.resident -= freed;
+  m_stats.spilled += snapshot->m_stored;
+  ++m_stats.spills;
+  return true;
+}
+
+bool budget_t::load(const snapshot_t* snapshot) {
+  auto& data = snapshot->m_data;
+  data.resize(snapshot->m_stored);
+  m_file.seekg(snapshot->m_offset);
+  if (!m_file.read(reinterpret_cast<char*>(data.data()), data.size())) {
+    m_file.clear();
+    std::vector<std::uint8_t>().swap(data);
+    return false;
+  }
+
+  snapshot->m_spilled = false;
+  m_stats.resident += data.capacity();
+  m_stats.peak = std::max(m_stats.peak, m_stats.resident);
+  m_stats.spilled -= snapshot->m_stored;
+  ++m_stats.loads;
+  return true;
+}
+}  // namespace vm::compact
@@ -1,4 +1,5 @@
 #include <vmctx.hpp>
+#include <vmimage.hpp>
 
 namespace vm {
 vmctx_t::vmctx_t(std::uintptr_t module_base,
@@ -11,45 +12,150 @@ vmctx_t::vmctx_t(std::uintptr_t module_base,
       m_image_size(image_size),
       m_image_load_delta(m_module_base - m_image_base) {}
 
+std::size_t vmenter_cache_t::size() const {
+  std::lock_guard<std::mutex> lock(m_lock);
+  return m_enters.size();
+}
+
+std::shared_ptr<const vmenter_t> vmenter_cache_t::get(
+    std::uintptr_t addr,
+    const std::function<std::shared_ptr<const vmenter_t>()>& analyze) {
+  std::promise<std::shared_ptr<const vmenter_t>> promise;
+  analysis_t analysis;
+  {
+    std::lock_guard<std::mutex> lock(m_lock);
+    const auto [itr, inserted] = m_enters.try_emplace(addr);
+    if (inserted)
+      itr->second = promise.get_future().share();
+    else
+      analysis = itr->second;
+  }
+
+  // another thread analyzes it or already has...
+  if (analysis.valid())
+    return analysis.get();
+
+  auto enter = analyze();
+  promise.set_value(enter);
+  return enter;
+}
+
 bool vmctx_t::init() {
   vm::utils::init();
   vm::instrs::init();
 
-  // flatten and deobfuscate the vm entry...
-  if (!vm::utils::flatten(m_vm_entry, m_module_base + m_vm_entry_rva))
+  auto enter = analyze(m_module_base + m_vm_entry_rva);
+  if (!enter)
     return false;
 
-  vm::utils::deobfuscate(m_vm_entry);
+  m_enter = std::move(enter);
+  m_push.reset();
+  return true;
+}
+
+bool vmctx_t::init(vmenter_cache_t& cache) {
+  vm::utils::init();
+  vm::instrs::init();
+
+  // vm entries are PUSH IMM, CALL vm enter... anything else is analyzed on its
+  // own without the cache.
+  const auto entry = m_module_base + m_vm_entry_rva;
+  vm::image_t::touch(entry, ZYDIS_MAX_INSTRUCTION_LENGTH * 2);
+  zydis_decoded_instr_t push, call;
+  if (!ZYAN_SUCCESS(ZydisDecoderDecodeBuffer(vm::utils::g_decoder.get(),
+                                             reinterpret_cast<void*>(entry),
+                                             0x1000, &push)) ||
+      push.mnemonic != ZYDIS_MNEMONIC_PUSH ||
+      push.operands[0].type != ZYDIS_OPERAND_TYPE_IMMEDIATE)
+    return init();
+
+  if (!ZYAN_SUCCESS(ZydisDecoderDecodeBuffer(
+          vm::utils::g_decoder.get(),
+          reinterpret_cast<void*>(entry + push.length), 0x1000, &call)) ||
+      call.mnemonic != ZYDIS_MNEMONIC_CALL ||
+      call.operands[0].type != ZYDIS_OPERAND_TYPE_IMMEDIATE)
+    return init();
+
+  std::uintptr_t target = 0u;
+  ZydisCalcAbsoluteAddress(&call, &call.operands[0], entry + push.length,
+                           &target);
+
+  auto shared = cache.get(
+      target, [&]() -> std::shared_ptr<const vmenter_t> {
+        // analyze this vm entry as usual and drop its PUSH IMM, flatten does
+        // not keep the CALL so what is left is the vm enter itself. the PUSH
+        // IMM is never removed by deobfuscation and touches no register which
+        // the rest of the vm enter reads, so the result is the same for every
+        // vm entry.
+        auto enter = analyze(entry);
+        if (!enter || enter->rtn.empty() || enter->rtn.front().addr != entry)
+          return nullptr;
+
+        enter->rtn.erase(enter->rtn.begin());
+        return enter;
+      });
+
+  if (!shared)
+    return false;
+
+  m_enter = std::move(shared);
+  m_push = zydis_instr_t{
+      push, std::vector<u8>((u8*)entry, (u8*)entry + push.length), entry};
+  return true;
+}
+
+zydis_rtn_t vmctx_t::get_vm_enter() const {
+  if (!m_push)
+    return m_enter->rtn;
+
+  zydis_rtn_t rtn;
+  rtn.reserve(m_enter->rtn.size() + 1);
+  rtn.push_back(*m_push);
+  rtn.insert(rtn.end(), m_enter->rtn.begin(), m_enter->rtn.end());
+  return rtn;
+}
+
+std::shared_ptr<vmenter_t> vmctx_t::analyze(std::uintptr_t addr) {
+  auto enter = std::make_shared<vmenter_t>();
+  auto& rtn = enter->rtn;
+  auto& push_order = enter->push_order;
+  push_order.fill(ZYDIS_REGISTER_NONE);
+
+  // flatten and deobfuscate the vm entry...
+  if (!vm::utils::flatten(rtn, addr))
+    return {};
+
+  vm::utils::deobfuscate(rtn);
 
   //Get the order in which native registers are pushed
   int push_index = 0;
-  for (const auto& instr : m_vm_entry)
+  for (const auto& instr : rtn)
   {
     if (instr.instr.mnemonic == ZYDIS_MNEMONIC_PUSH &&
         instr.instr.operands[0].type == ZYDIS_OPERAND_TYPE_REGISTER &&
         vm::utils::is_64_bit_gp(instr.instr.operands[0].reg.value))
     {
-      if (std::find(vmentry_push_order.begin(), vmentry_push_order.begin() + push_index,
-          instr.instr.operands[0].reg.value) != vmentry_push_order.begin() + push_index)
+      if (std::find(push_order.begin(), push_order.begin() + push_index,
+          instr.instr.operands[0].reg.value) != push_order.begin() + push_index)
       {
         //Every register should only be pushed once
         std::printf("Error initializing vmctx_t: vmenter pushes could not be parsed.\n");
-        vm::utils::print(m_vm_entry);
-        return false;
+        vm::utils::print(rtn);
+        return {};
       }
-      vmentry_push_order[push_index++] = instr.instr.operands[0].reg.value;
+      push_order[push_index++] = instr.instr.operands[0].reg.value;
     }
     else if (instr.instr.mnemonic == ZYDIS_MNEMONIC_PUSHFQ)
     {
-      if (std::find(vmentry_push_order.begin(), vmentry_push_order.begin() + push_index,
-          instr.instr.operands[0].reg.value) != vmentry_push_order.begin() + push_index)
+      if (std::find(push_order.begin(), push_order.begin() + push_index,
+          instr.instr.operands[0].reg.value) != push_order.begin() + push_index)
       {
         // Same shit
         std::printf("Error initializing vmctx_t: vmenter pushes could not be parsed.\n");
-        vm::utils::print(m_vm_entry);
-        return false;
+        vm::utils::print(rtn);
+        return {};
       }
-      vmentry_push_order[push_index++] = ZYDIS_REGISTER_RFLAGS;
+      push_order[push_index++] = ZYDIS_REGISTER_RFLAGS;
     }
     if (push_index == 16)
       break;
@@ -57,7 +163,7 @@ bool vmctx_t::init() {
   
   // find mov reg, [rsp+0x90]. this register will be VIP...
   const auto vip_fetch = std::find_if(
-      m_vm_entry.begin(), m_vm_entry.end(),
+      rtn.begin(), rtn.end(),
       [&](const zydis_instr_t& instr) -> bool {
         return instr.instr.mnemonic == ZYDIS_MNEMONIC_MOV &&
                instr.instr.operands[0].type == ZYDIS_OPERAND_TYPE_REGISTER &&
@@ -66,15 +172,15 @@ bool vmctx_t::init() {
                instr.instr.operands[1].mem.disp.value == 0x90;
       });
 
-  if (vip_fetch == m_vm_entry.end())
-    return false;
+  if (vip_fetch == rtn.end())
+    return {};
 
-  m_vip = vip_fetch->instr.operands[0].reg.value;
+  enter->vip = vip_fetch->instr.operands[0].reg.value;
 
   // find the register that will be used for the virtual stack...
   // mov reg, rsp...
   const auto vsp_fetch = std::find_if(
-      m_vm_entry.begin(), m_vm_entry.end(),
+      rtn.begin(), rtn.end(),
       [&](const zydis_instr_t& instr) -> bool {
         return instr.instr.mnemonic == ZYDIS_MNEMONIC_MOV &&
                instr.instr.operands[0].type == ZYDIS_OPERAND_TYPE_REGISTER &&
@@ -82,14 +188,31 @@ bool vmctx_t::init() {
                instr.instr.operands[1].reg.value == ZYDIS_REGISTER_RSP;
       });
 
-  if (vsp_fetch == m_vm_entry.end())
-    return false;
+  if (vsp_fetch == rtn.end())
+    return {};
 
-  m_vsp = vsp_fetch->instr.operands[0].reg.value;
-  return true;
+  enter->vsp = vsp_fetch->instr.operands[0].reg.value;
+  return enter;
 }
 const std::array<ZydisRegister, 16>& vm::vmctx_t::get_vmentry_push_order() const
 {
-  return vmentry_push_order;
+  return m_enter->push_order;
+}
+
+std::vector<vmctx_t> init_vmctxs(
+    std::uintptr_t module_base,
+    std::uintptr_t image_base,
+    std::uintptr_t image_size,
+    const std::vector<vm::locate::vm_enter_t>& entries) {
+  vmenter_cache_t cache;
+  std::vector<vmctx_t> vmctxs;
+  vmctxs.reserve(entries.size());
+
+  for (const auto& entry : entries) {
+    vmctx_t vmctx(module_base, image_base, image_size, entry.rva);
+    if (vmctx.init(cache))
+      vmctxs.push_back(std::move(vmctx));
+  }
+  return vmctxs;
 }
 }  // namespace vm
\ No newline at end of file
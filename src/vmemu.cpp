@@ -0,0 +1,829 @@
+#include <uc_allocation_tracker.hpp>
+#include <vmemu.hpp>
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+
+namespace vm::emu {
+std::size_t blk_cache_t::size() const {
+  std::lock_guard<std::mutex> lock(m_lock);
+  return m_blks.size();
+}
+
+blk_cache_t::stats_t blk_cache_t::stats() const {
+  return {m_lookups.load(), m_hits.load(), m_replayed.load(), m_vinstrs.load()};
+}
+
+// MOV REG, [VIP] and then XOR REG, RKEY... every vm handler decrypts either its
+// operand or the next vm handler this way.
+static zydis_reg_t find_rkey(std::uintptr_t rip, zydis_reg_t vip) {
+  zydis_rtn_t rtn;
+  auto result = ZYDIS_REGISTER_NONE;
+  if (vm::utils::flatten(rtn, rip)) {
+    vm::utils::deobfuscate(rtn);
+    auto fetched = ZYDIS_REGISTER_NONE;
+    for (const auto& [instr, raw, addr] : rtn) {
+      if (fetched == ZYDIS_REGISTER_NONE) {
+        if (vm::utils::is_mov(instr) &&
+            instr.operands[0].type == ZYDIS_OPERAND_TYPE_REGISTER &&
+            instr.operands[1].type == ZYDIS_OPERAND_TYPE_MEMORY &&
+            instr.operands[1].mem.base == vip)
+          fetched = instr.operands[0].reg.value;
+        continue;
+      }
+
+      if (instr.mnemonic == ZYDIS_MNEMONIC_XOR &&
+          instr.operands[0].type == ZYDIS_OPERAND_TYPE_REGISTER &&
+          instr.operands[1].type == ZYDIS_OPERAND_TYPE_REGISTER &&
+          vm::utils::reg::compare(instr.operands[0].reg.value, fetched)) {
+        result = vm::utils::reg::to64(instr.operands[1].reg.value);
+        break;
+      }
+    }
+  }
+  return result;
+}
+
+zydis_reg_t blk_cache_t::rkey(std::uintptr_t rip, zydis_reg_t vip) {
+  {
+    std::lock_guard<std::mutex> lock(m_lock);
+    if (const auto itr = m_rkeys.find({rip, vip}); itr != m_rkeys.end())
+      return itr->second;
+  }
+
+  const auto result = find_rkey(rip, vip);
+  std::lock_guard<std::mutex> lock(m_lock);
+  return m_rkeys.insert({{rip, vip}, result}).first->second;
+}
+
+bool blk_cache_t::find(const blk_key_t& key,
+                       std::vector<std::shared_ptr<const cached_blk_t>>& blks,
+                       std::vector<blk_key_t>& keys) {
+  ++m_lookups;
+  blks.clear();
+
+  std::set<blk_key_t> seen = {key};
+  keys = {key};
+  {
+    std::lock_guard<std::mutex> lock(m_lock);
+    for (auto idx = 0u; idx < keys.size(); ++idx) {
+      const auto itr = m_blks.find(keys[idx]);
+      if (itr == m_blks.end())
+        return false;
+
+      blks.push_back(itr->second);
+      for (const auto& successor : itr->second->successors)
+        if (seen.insert(successor).second)
+          keys.push_back(successor);
+    }
+  }
+
+  ++m_hits;
+  return true;
+}
+
+void blk_cache_t::insert(const blk_key_t& key,
+                         const vm::instrs::vblk_t& blk,
+                         std::vector<blk_key_t> successors) {
+  // copied onto the heap, the arena of the block goes away with its routine...
+  // the JMP handler state belongs to the exploration which emulated the block,
+  // not to the ones which replay it.
+  auto cached = std::make_shared<cached_blk_t>(
+      cached_blk_t{blk, std::move(successors)});
+  cached->blk.m_jmp.state = nullptr;
+
+  std::lock_guard<std::mutex> lock(m_lock);
+  m_blks.insert({key, std::move(cached)});
+}
+
+emu_t::emu_t(const vm::vmctx_t* vmctx,
+             engine_pool_t& engines,
+             vm::sched::scheduler_t* sched,
+             vm::mem::policy_t policy,
+             blk_cache_t* cache,
+             vm::compact::codec_t codec,
+             vm::compact::budget_t* budget,
+             vm::profdb::db_t* db)
+    : m_vmctx(vmctx),
+      m_engines(engines),
+      m_sched(sched),
+      m_cache(cache),
+      m_codec(codec),
+      m_budget(budget),
+      m_db(db),
+      m_arena(vm::mem::make(policy)),
+      m_sink(nullptr),
+      m_tables(0u),
+      m_table_entries(0u),
+      m_table_ns(0u),
+      m_forks(0u),
+      m_fork_pages(0u),
+      m_fork_ns(0u) {}
+
+emu_t::~emu_t() {
+  // blocks still queued reference this object...
+  if (m_sched)
+    m_sched->wait(m_group);
+}
+
+bool emu_t::inside(std::uintptr_t addr) const {
+  return addr >= m_vmctx->m_module_base &&
+         addr < m_vmctx->m_module_base + m_vmctx->m_image_size;
+}
+
+vm::instrs::vblk_t emu_t::make_blk() const {
+  // the containers have to be constructed with the arena, assigning one to
+  // them later would keep the heap... blocks handed to a sink are dropped
+  // right after, the arena would keep every one of them until the routine
+  // is gone.
+  const auto resource =
+      m_sink ? std::pmr::new_delete_resource() : m_arena.get();
+
+  return {false,
+          {},
+          {},
+          {},
+          {},
+          std::pmr::vector<vm::instrs::vinstr_t>(resource),
+          vm::instrs::vbranch_type::none,
+          std::pmr::vector<std::uintptr_t>(resource)};
+}
+
+vm::instrs::hndlr_trace_t emu_t::make_hndlr() const {
+  // handler traces never outlive the block being traced, so they come from the
+  // heap and are given back as soon as the block is done...
+  return {nullptr,
+          nullptr,
+          0u,
+          ZYDIS_REGISTER_NONE,
+          ZYDIS_REGISTER_NONE,
+          std::pmr::vector<vm::instrs::emu_instr_t>(
+              std::pmr::new_delete_resource()),
+          nullptr,
+          {0u, ZYDIS_REGISTER_NONE}};
+}
+
+std::shared_ptr<emu_t::entry_t> emu_t::snapshot(lease_t& lease,
+                                                zydis_reg_t vip,
+                                                zydis_reg_t vsp,
+                                                std::uintptr_t rip) {
+  auto entry = std::make_shared<entry_t>();
+  entry->vip = vip;
+  entry->vsp = vsp;
+  entry->rip = rip;
+  entry->vip_addr = 0u;
+  uc_reg_read(lease.uc(), vm::instrs::uc_reg(vip), &entry->vip_addr);
+
+  // snapshots are what the budget knows how to spill, they are not counted
+  // as forks...
+  if (m_budget) {
+    entry->compact =
+        vm::compact::snapshot_t::capture(lease, vsp, m_codec, m_budget);
+    return entry->compact ? entry : nullptr;
+  }
+
+  const auto start = std::chrono::steady_clock::now();
+  entry->state = lease.state().fork();
+  if (!entry->state)
+    return {};
+
+  ++m_forks;
+  m_fork_pages += entry->state->owned();
+  m_fork_ns += std::chrono::duration_cast<std::chrono::nanoseconds>(
+                   std::chrono::steady_clock::now() - start)
+                   .count();
+  return entry;
+}
+
+bool emu_t::init() {
+  auto lease = m_engines.lease();
+  if (!lease)
+    return false;
+
+  const auto vm_enter = m_vmctx->get_vm_enter();
+  if (vm_enter.empty())
+    return false;
+
+  if (auto err = uc_emu_start(lease.uc(),
+                              m_vmctx->m_module_base + m_vmctx->m_vm_entry_rva,
+                              vm_enter.back().addr, 0ull, 0ull)) {
+    std::printf("[!] failed to emulate vm enter at rva 0x%x, err = %d\n",
+                m_vmctx->m_vm_entry_rva, err);
+    return false;
+  }
+
+  // the vm enter ends with JMP REG to the first vm handler...
+  std::uintptr_t rip = 0u;
+  const auto& jmp = vm_enter.back().instr;
+  uc_reg_read(lease.uc(), vm::instrs::uc_reg(jmp.operands[0].reg.value), &rip);
+
+  if (!inside(rip))
+    return false;
+
+  m_entry = snapshot(lease, m_vmctx->get_vip(), m_vmctx->get_vsp(), rip);
+  return m_entry != nullptr;
+}
+
+bool emu_t::restore(lease_t& lease, const entry_t& entry) {
+  if (entry.compact)
+    return entry.compact->restore(lease);
+
+  lease.state().restore(entry.state);
+  return true;
+}
+
+bool emu_t::profiled(lease_t& lease,
+                     std::uintptr_t rip,
+                     zydis_reg_t vip,
+                     zydis_reg_t vsp,
+                     vm::instrs::hndlr_trace_t& hndlr,
+                     vm::instrs::vinstr_t& vinstr,
+                     std::uintptr_t& next,
+                     std::uint64_t& count) {
+  vm::profdb::record_t record;
+  vm::profdb::site_t site;
+  if (!m_db || !m_db->find(rip, vip, vsp, record, site))
+    return false;
+
+  // the same checkpoint the tracer takes, a JMP handler is rolled back to
+  // it...
+  const auto uc = lease.uc();
+  auto& state = lease.state();
+  state.checkpoint();
+
+  std::uintptr_t pc = rip;
+  const auto run = [&](std::uint32_t instrs) -> bool {
+    return (!instrs || !uc_emu_start(uc, pc, 0ull, 0ull, instrs)) &&
+           !uc_reg_read(uc, UC_X86_REG_RIP, &pc);
+  };
+
+  // up to the instruction the imm is read at, on to the JMP REG and over
+  // it... the handler was not the one profiled if the JMP REG is not where
+  // it should be.
+  std::uint64_t imm = 0u;
+  const auto imm_at = record.has_imm ? site.imm_at : 0u;
+  if (!run(imm_at) ||
+      (record.has_imm &&
+       uc_reg_read(uc,
+                   vm::instrs::uc_reg(
+                       static_cast<zydis_reg_t>(record.imm_reg)),
+                   &imm)) ||
+      !run(site.executed - 1u - imm_at) || pc != site.jmp || !run(1u)) {
+    state.rollback();
+    return false;
+  }
+
+  vinstr = {};
+  vinstr.mnemonic = static_cast<vm::instrs::mnemonic_t>(record.mnemonic);
+  vinstr.stack_size = record.stack_size;
+  vinstr.imm.has_imm = record.has_imm;
+  vinstr.imm.size = record.imm_size;
+  if (record.has_imm) {
+    imm <<= (64 - record.imm_size);
+    imm >>= (64 - record.imm_size);
+    vinstr.imm.val = imm;
+  }
+
+  vm::instrs::release(hndlr);
+  hndlr.m_uc = uc;
+  hndlr.m_begin = rip;
+  hndlr.m_vip = static_cast<zydis_reg_t>(record.vip);
+  hndlr.m_vsp = static_cast<zydis_reg_t>(record.vsp);
+  hndlr.m_materialize = nullptr;
+  next = pc;
+  count = site.executed;
+  return true;
+}
+
+void emu_t::explore(std::shared_ptr<entry_t> entry) {
+  // without a rolling key register only VIP and the registers tell blocks
+  // apart...
+  const auto key = this->key(*entry);
+  if (!m_visited.insert(
+          key ? *key : blk_key_t{entry->vip_addr, entry->vip, entry->vsp, 0u}))
+    return;
+
+  if (!m_sched) {
+    std::lock_guard<std::mutex> lock(m_lock);
+    m_worklist.push_back(std::move(entry));
+    return;
+  }
+
+  m_sched->spawn(m_group, [this, entry]() { visit(*entry); });
+}
+
+zydis_reg_t emu_t::rkey(std::uintptr_t rip, zydis_reg_t vip) {
+  if (m_cache)
+    return m_cache->rkey(rip, vip);
+
+  {
+    std::lock_guard<std::mutex> lock(m_lock);
+    if (const auto itr = m_rkeys.find({rip, vip}); itr != m_rkeys.end())
+      return itr->second;
+  }
+
+  const auto result = find_rkey(rip, vip);
+  std::lock_guard<std::mutex> lock(m_lock);
+  return m_rkeys.insert({{rip, vip}, result}).first->second;
+}
+
+std::optional<blk_key_t> emu_t::key(const entry_t& entry) {
+  const auto rkey = this->rkey(entry.rip, entry.vip);
+  if (rkey == ZYDIS_REGISTER_NONE)
+    return {};
+
+  blk_key_t key{entry.vip_addr, entry.vip, entry.vsp, 0u};
+  if (entry.compact)
+    key.rkey = entry.compact->reg(vm::instrs::uc_reg(rkey));
+  else
+    uc_context_reg_read(entry.state->ctx(), vm::instrs::uc_reg(rkey),
+                        &key.rkey);
+  return key;
+}
+
+bool emu_t::replay(const entry_t& entry) {
+  if (!m_cache)
+    return false;
+
+  const auto key = this->key(entry);
+  std::vector<std::shared_ptr<const blk_cache_t::cached_blk_t>> cached;
+  std::vector<blk_key_t> keys;
+  if (!key || !m_cache->find(*key, cached, keys))
+    return false;
+
+  for (auto idx = 0u; idx < cached.size(); ++idx) {
+    // the first block was already marked visited by explore...
+    const auto& itr = cached[idx];
+    if (idx && !m_visited.insert(keys[idx]))
+      continue;
+
+    auto blk = make_blk();
+    blk.is_branch = itr->blk.is_branch;
+    blk.m_vip = itr->blk.m_vip;
+    blk.m_vm = itr->blk.m_vm;
+    blk.m_jmp = itr->blk.m_jmp;
+    blk.vmexit_pop_order = itr->blk.vmexit_pop_order;
+    blk.branch_type = itr->blk.branch_type;
+    blk.m_vinstrs.assign(itr->blk.m_vinstrs.begin(), itr->blk.m_vinstrs.end());
+    blk.branches.assign(itr->blk.branches.begin(), itr->blk.branches.end());
+
+    ++m_cache->m_replayed;
+    m_cache->m_vinstrs += blk.m_vinstrs.size();
+    emit(blk);
+  }
+  return true;
+}
+
+void emu_t::visit(const entry_t& entry) {
+  if (replay(entry))
+    return;
+
+  auto blk = make_blk();
+  std::vector<std::shared_ptr<entry_t>> successors;
+  if (!emulate(entry, blk, successors))
+    return;
+
+  // where a table branch goes depends on more than the key, and a block can
+  // only be replayed if every block after it can be found again...
+  if (const auto key = m_cache ? this->key(entry) : std::nullopt;
+      key && blk.branch_type != vm::instrs::vbranch_type::table) {
+    std::vector<blk_key_t> keys;
+    for (const auto& successor : successors)
+      if (const auto next = this->key(*successor))
+        keys.push_back(*next);
+
+    if (keys.size() == successors.size())
+      m_cache->insert(*key, blk, std::move(keys));
+  }
+
+  for (auto& successor : successors)
+    explore(std::move(successor));
+
+  emit(blk);
+}
+
+std::shared_ptr<emu_t::entry_t> emu_t::follow(lease_t& lease,
+                                              const vm::instrs::vblk_t& blk,
+                                              std::uintptr_t branch) {
+  std::uintptr_t vsp = 0u, next = 0u;
+  uc_reg_read(lease.uc(), vm::instrs::uc_reg(blk.m_jmp.m_vm.vsp), &vsp);
+  if (!lease.state().write(vsp, &branch, sizeof branch))
+    return {};
+
+  auto hndlr = make_hndlr();
+  const auto traced = lease.tracer().trace(
+      blk.m_jmp.rip, blk.m_jmp.m_vm.vip, blk.m_jmp.m_vm.vsp, hndlr, next);
+
+  std::shared_ptr<entry_t> entry;
+  if (traced && inside(next)) {
+    vm::instrs::deobfuscate(hndlr);
+    if (vm::instrs::determine(hndlr).mnemonic == vm::instrs::mnemonic_t::jmp)
+      entry = snapshot(lease, hndlr.m_vip, hndlr.m_vsp, next);
+  }
+
+  vm::instrs::release(hndlr);
+  return entry && inside(entry->vip_addr) ? entry : nullptr;
+}
+
+std::vector<std::uintptr_t> emu_t::resolve(lease_t& lease,
+                                          const entry_t& entry,
+                                          const vm::instrs::vblk_t& blk,
+                                          const table_t& table,
+                                          std::uint64_t slice,
+                                          std::int32_t& first) {
+  const auto uc = lease.uc();
+  auto& state = lease.state();
+
+  // restored once and run up to right after the table load, untraced...
+  std::uintptr_t rip = 0u, vsp = 0u;
+  if (!restore(lease, entry) ||
+      uc_emu_start(uc, entry.rip, 0ull, 0ull, table.executed) ||
+      uc_reg_read(uc, UC_X86_REG_RIP, &rip) || rip != table.next)
+    return {};
+
+  state.checkpoint();
+  uc_reg_read(uc, vm::instrs::uc_reg(table.vsp), &vsp);
+
+  // the READ left the table entry on top of the virtual stack, only the vm
+  // handlers after it can see a different one...
+  const auto eval = [&](std::int32_t idx, std::uintptr_t& target) -> bool {
+    std::uint64_t value = 0u;
+    std::uintptr_t top = 0u;
+    state.rollback();
+    if (uc_mem_read(uc, table.addr + static_cast<std::intptr_t>(idx) * 8,
+                    &value, sizeof value) ||
+        !state.write(vsp, &value, sizeof value) ||
+        (slice && uc_emu_start(uc, table.next, 0ull, 0ull, slice)))
+      return false;
+
+    uc_reg_read(uc, UC_X86_REG_RIP, &rip);
+    uc_reg_read(uc, vm::instrs::uc_reg(blk.m_jmp.m_vm.vsp), &top);
+    return rip == blk.m_jmp.rip &&
+           !uc_mem_read(uc, top, &target, sizeof target) && inside(target);
+  };
+
+  // a table ends where its entries stop leading into the module...
+  std::vector<std::uintptr_t> below, above;
+  std::uintptr_t target = 0u;
+  for (auto idx = 0; above.size() < VM_MAX_TABLE_ENTRIES && eval(idx, target);
+       ++idx)
+    above.push_back(target);
+
+  if (above.empty())
+    return {};
+
+  for (auto idx = -1;
+       above.size() + below.size() < VM_MAX_TABLE_ENTRIES && eval(idx, target);
+       --idx)
+    below.push_back(target);
+
+  first = -static_cast<std::int32_t>(below.size());
+  std::vector<std::uintptr_t> targets(below.rbegin(), below.rend());
+  targets.insert(targets.end(), above.begin(), above.end());
+  return targets;
+}
+
+bool emu_t::emulate(const entry_t& entry,
+                    vm::instrs::vblk_t& blk,
+                    std::vector<std::shared_ptr<entry_t>>& successors) {
+  auto lease = m_engines.lease();
+  if (!lease)
+    return false;
+
+  auto& state = lease.state();
+  auto& tracer = lease.tracer();
+
+  if (!restore(lease, entry))
+    return false;
+
+  const auto module_base = m_vmctx->m_module_base;
+  blk.m_vip.rva = entry.vip_addr - module_base;
+  blk.m_vip.img_based = blk.m_vip.rva + m_vmctx->m_image_base;
+  blk.m_vm = {entry.vip, entry.vsp};
+  blk.branch_type = vm::instrs::vbranch_type::none;
+
+  auto hndlr = make_hndlr();
+  std::uintptr_t rip = entry.rip, next = 0u;
+  zydis_reg_t vip = entry.vip, vsp = entry.vsp;
+
+  std::optional<table_t> table;
+  std::uint64_t executed = 0u;
+
+  for (auto idx = 0u; idx < VM_MAX_BLK_HANDLERS; ++idx, rip = next) {
+    // the address a READ is about to load from...
+    std::uintptr_t top = 0u, top_addr = 0u;
+    uc_reg_read(lease.uc(), vm::instrs::uc_reg(vsp), &top_addr);
+    uc_mem_read(lease.uc(), top_addr, &top, sizeof top);
+
+    std::uint64_t count = 0u;
+    vm::instrs::vinstr_t vinstr{};
+    if (!profiled(lease, rip, vip, vsp, hndlr, vinstr, next, count)) {
+      if (!tracer.trace(rip, vip, vsp, hndlr, next)) {
+        std::printf("[!] failed to trace vm handler at 0x%llx\n",
+                    static_cast<unsigned long long>(rip));
+        break;
+      }
+
+      // counted before deobfuscation removes any of them...
+      count = hndlr.m_instrs.size();
+      vm::instrs::deobfuscate(hndlr);
+      vinstr = vm::instrs::determine(hndlr);
+      if (m_db)
+        m_db->insert(rip, vip, vsp, vinstr, hndlr, count);
+    }
+
+    executed += count;
+    blk.m_vinstrs.push_back(vinstr);
+
+    if (vinstr.mnemonic == vm::instrs::mnemonic_t::read &&
+        vinstr.stack_size == 64)
+      table = table_t{top, next, hndlr.m_vsp, executed};
+
+    if (vinstr.mnemonic == vm::instrs::mnemonic_t::unknown) {
+      std::printf("[!] unknown vm handler at 0x%llx\n",
+                  static_cast<unsigned long long>(rip));
+      break;
+    }
+
+    if (vinstr.mnemonic == vm::instrs::mnemonic_t::vmexit) {
+      auto pop = blk.vmexit_pop_order.begin();
+      for (const auto& instr : hndlr.m_instrs) {
+        if (pop == blk.vmexit_pop_order.end())
+          break;
+
+        if (instr.m_instr.mnemonic == ZYDIS_MNEMONIC_POP)
+          *pop++ = instr.m_instr.operands[0].reg.value;
+        else if (instr.m_instr.mnemonic == ZYDIS_MNEMONIC_POPFQ)
+          *pop++ = ZYDIS_REGISTER_RFLAGS;
+      }
+      break;
+    }
+
+    if (vinstr.mnemonic != vm::instrs::mnemonic_t::jmp) {
+      vip = hndlr.m_vip;
+      vsp = hndlr.m_vsp;
+      if (!next)
+        break;
+      continue;
+    }
+
+    // the engine is now at the first vm handler of the block the JMP took...
+    auto taken = inside(next)
+                     ? snapshot(lease, hndlr.m_vip, hndlr.m_vsp, next)
+                     : nullptr;
+
+    // roll back to the first instruction of the JMP handler and keep it...
+    state.rollback();
+    blk.m_jmp.rip = rip;
+    blk.m_jmp.m_vm = {vip, vsp};
+    blk.m_jmp.state =
+        vm::compact::snapshot_t::capture(lease, vsp, m_codec, m_budget);
+
+    std::uintptr_t branch = 0u, vsp_addr = 0u;
+    uc_reg_read(lease.uc(), vm::instrs::uc_reg(vsp), &vsp_addr);
+    uc_mem_read(lease.uc(), vsp_addr, &branch, sizeof branch);
+
+    // a virtual JCC loads both branches with LCONSTQ and then selects one of
+    // them on the virtual stack... if the last two distinct ones both lead to
+    // a vm handler and one of them is the branch taken, this is a JCC.
+    std::vector<std::uintptr_t> lconsts;
+    for (auto itr = blk.m_vinstrs.rbegin();
+         itr != blk.m_vinstrs.rend() && lconsts.size() < 2; ++itr) {
+      if (itr->mnemonic != vm::instrs::mnemonic_t::lconst ||
+          itr->stack_size != 64)
+        continue;
+
+      const auto addr = itr->imm.val + m_vmctx->m_image_load_delta;
+      if (std::find(lconsts.begin(), lconsts.end(), addr) == lconsts.end())
+        lconsts.push_back(addr);
+    }
+
+    const auto is_lconst =
+        std::find(lconsts.begin(), lconsts.end(), branch) != lconsts.end();
+
+    if (taken && is_lconst && lconsts.size() == 2) {
+      const auto other = lconsts[0] == branch ? lconsts[1] : lconsts[0];
+      if (auto alt = follow(lease, blk, other)) {
+        blk.branch_type = vm::instrs::vbranch_type::jcc;
+        successors = {lconsts[0] == branch ? taken : alt,
+                      lconsts[0] == branch ? alt : taken};
+      }
+    }
+
+    // a branch loaded from a table inside of the module... every entry of
+    // the table is a branch, not only the one which was taken.
+    const auto resolvable =
+        successors.empty() && taken && !is_lconst && table &&
+        inside(table->addr);
+
+    if (const auto jmp = resolvable ? state.fork() : nullptr) {
+      const auto start = std::chrono::steady_clock::now();
+      std::int32_t first = 0;
+      const auto targets =
+          resolve(lease, entry, blk, *table,
+                  executed - count - table->executed, first);
+
+      // every other entry is followed from the first instruction of the JMP
+      // handler, the same as the other branch of a JCC...
+      state.restore(jmp);
+
+      std::map<std::uintptr_t, std::shared_ptr<entry_t>> followed = {
+          {branch, taken}};
+      const auto lead = [&](std::size_t pos) -> bool {
+        const auto itr = followed.find(targets[pos]);
+        if (itr != followed.end())
+          return itr->second != nullptr;
+
+        state.rollback();
+        return (followed[targets[pos]] = follow(lease, blk, targets[pos])) !=
+               nullptr;
+      };
+
+      // the entry the block loaded has to lead where the block went, then the
+      // table is walked outwards until an entry does not lead to a block...
+      auto begin = static_cast<std::size_t>(-first), end = begin + 1u;
+      if (begin < targets.size() && targets[begin] == branch) {
+        while (begin && lead(begin - 1u))
+          --begin;
+        while (end < targets.size() && lead(end))
+          ++end;
+
+        for (auto pos = begin; pos < end; ++pos) {
+          const auto& successor = followed[targets[pos]];
+          if (std::find(successors.begin(), successors.end(), successor) ==
+              successors.end())
+            successors.push_back(successor);
+        }
+        blk.branch_type = vm::instrs::vbranch_type::table;
+      }
+
+      ++m_tables;
+      m_table_entries += targets.size();
+      m_table_ns += std::chrono::duration_cast<std::chrono::nanoseconds>(
+                        std::chrono::steady_clock::now() - start)
+                        .count();
+    }
+
+    if (successors.empty() && taken) {
+      blk.branch_type = is_lconst ? vm::instrs::vbranch_type::absolute
+                                  : vm::instrs::vbranch_type::table;
+      successors = {taken};
+    }
+
+    if (successors.empty())
+      std::printf("[!] failed to follow virtual jmp at 0x%llx\n",
+                  static_cast<unsigned long long>(rip));
+
+    for (const auto& successor : successors)
+      blk.branches.push_back(successor->vip_addr - module_base +
+                             m_vmctx->m_image_base);
+
+    blk.is_branch = blk.branches.size() > 1;
+    break;
+  }
+
+  // a block without a single vm handler is not a block...
+  vm::instrs::release(hndlr);
+  return !blk.m_vinstrs.empty();
+}
+
+void emu_t::emit(vm::instrs::vblk_t& blk) {
+  if (!m_sink) {
+    std::lock_guard<std::mutex> lock(m_lock);
+    m_blks.push_back(std::move(blk));
+    return;
+  }
+
+  // not under m_lock, the sink may take a while and other blocks still need
+  // to queue their successors...
+  {
+    std::lock_guard<std::mutex> lock(m_sink_lock);
+    (*m_sink)(blk);
+  }
+  release(blk);
+}
+
+bool emu_t::run() {
+  if (!m_entry)
+    return false;
+
+  m_visited.clear();
+  m_blks.clear();
+  explore(m_entry);
+
+  if (m_sched)
+    m_sched->wait(m_group);
+
+  while (!m_worklist.empty()) {
+    const auto entry = m_worklist.back();
+    m_worklist.pop_back();
+    visit(*entry);
+  }
+  return true;
+}
+
+bool emu_t::get_trace(vm::instrs::vrtn_t& vrtn) {
+  m_sink = nullptr;
+  if (!run())
+    return false;
+
+  // blocks finish in whatever order the workers get to them... the first block
+  // goes first and the rest are sorted by VIP so the result is the same no
+  // matter how many threads explored it.
+  const auto first = m_entry->vip_addr - m_vmctx->m_module_base;
+  std::sort(m_blks.begin(), m_blks.end(),
+            [&](const vm::instrs::vblk_t& a, const vm::instrs::vblk_t& b) {
+              if ((a.m_vip.rva == first) != (b.m_vip.rva == first))
+                return a.m_vip.rva == first;
+              return a.m_vip.rva < b.m_vip.rva;
+            });
+
+  vrtn.m_rva = m_vmctx->m_vm_entry_rva;
+  vrtn.m_arena = m_arena;
+  vrtn.m_blks = std::move(m_blks);
+  m_blks.clear();
+  return true;
+}
+
+emu_t::table_stats_t emu_t::tables() const {
+  return {m_tables.load(), m_table_entries.load(), m_table_ns.load() / 1e9};
+}
+
+emu_t::fork_stats_t emu_t::forks() const {
+  return {m_forks.load(), m_fork_pages.load(), m_fork_ns.load() / 1e9};
+}
+
+bool emu_t::get_trace(const sink_t& sink) {
+  m_sink = &sink;
+  const auto result = run();
+  m_sink = nullptr;
+  return result;
+}
+
+void release(vm::instrs::vblk_t& blk) {
+  blk.m_jmp.state = nullptr;
+}
+
+void release(vm::instrs::vrtn_t& vrtn) {
+  for (auto& blk : vrtn.m_blks)
+    release(blk);
+}
+}  // namespace vm::emu
+
+namespace vm {
+std::vector<vm::instrs::vrtn_t> devirt(
+    const vm::image_t& image,
+    const std::vector<vm::locate::vm_enter_t>& entries,
+    std::uint32_t threads,
+    vm::mem::policy_t policy,
+    vm::emu::blk_cache_t* cache,
+    vm::compact::budget_t* budget,
+    vm::profdb::db_t* db) {
+  vm::sched::scheduler_t sched(threads);
+
+  // the thread waiting on the scheduler runs tasks too...
+  vm::emu::engine_pool_t engines(image, sched.size() + 1u);
+  vm::vmenter_cache_t enters;
+  return devirt(image, entries, sched, engines, enters, policy, cache,
+                budget, db);
+}
+
+std::vector<vm::instrs::vrtn_t> devirt(
+    const vm::image_t& image,
+    const std::vector<vm::locate::vm_enter_t>& entries,
+    vm::sched::scheduler_t& sched,
+    vm::emu::engine_pool_t& engines,
+    vm::vmenter_cache_t& enters,
+    vm::mem::policy_t policy,
+    vm::emu::blk_cache_t* cache,
+    vm::compact::budget_t* budget,
+    vm::profdb::db_t* db) {
+  vm::sched::group_t group;
+
+  std::vector<vm::instrs::vrtn_t> vrtns(entries.size());
+  std::vector<std::uint8_t> explored(entries.size(), false);
+
+  for (auto idx = 0u; idx < entries.size(); ++idx)
+    sched.spawn(group, [&, idx]() {
+      vm::vmctx_t vmctx(image.m_module_base, image.m_image_base,
+                        image.m_image_size, entries[idx].rva);
+      if (!vmctx.init(enters))
+        return;
+
+      vm::emu::emu_t emu(&vmctx, engines, &sched, policy, cache,
+                         vm::compact::codec_t::none, budget, db);
+      if (emu.init() && emu.get_trace(vrtns[idx]))
+        explored[idx] = true;
+    });
+
+  sched.wait(group);
+
+  std::vector<vm::instrs::vrtn_t> result;
+  for (auto idx = 0u; idx < entries.size(); ++idx)
+    if (explored[idx])
+      result.push_back(std::move(vrtns[idx]));
+
+  return result;
+}
+}  // namespace vm
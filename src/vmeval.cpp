@@ -0,0 +1,649 @@
+#include <vmeval.hpp>
+
+#include <algorithm>
+#include <bit>
+#include <cstring>
+
+#define EFLAGS_CF 0x1ull
+#define EFLAGS_PF 0x4ull
+#define EFLAGS_AF 0x10ull
+#define EFLAGS_ZF 0x40ull
+#define EFLAGS_SF 0x80ull
+#define EFLAGS_TF 0x100ull
+#define EFLAGS_OF 0x800ull
+#define EFLAGS_STATUS \
+  (EFLAGS_CF | EFLAGS_PF | EFLAGS_AF | EFLAGS_ZF | EFLAGS_SF | EFLAGS_OF)
+
+// flags popfq can change at cpl0: the status flags, TF, IF, DF, IOPL, NT, AC
+// and ID...
+#define EFLAGS_POPF_MASK (EFLAGS_STATUS | 0x247700ull)
+
+namespace vm::emu {
+// general purpose registers in encoding order, same order as zydis...
+static int g_uc_gprs[] = {
+    UC_X86_REG_RAX, UC_X86_REG_RCX, UC_X86_REG_RDX, UC_X86_REG_RBX,
+    UC_X86_REG_RSP, UC_X86_REG_RBP, UC_X86_REG_RSI, UC_X86_REG_RDI,
+    UC_X86_REG_R8,  UC_X86_REG_R9,  UC_X86_REG_R10, UC_X86_REG_R11,
+    UC_X86_REG_R12, UC_X86_REG_R13, UC_X86_REG_R14, UC_X86_REG_R15};
+
+static std::uint64_t mask(std::uint32_t width) {
+  return width >= 64 ? ~0ull : (1ull << width) - 1ull;
+}
+
+static bool msb(std::uint64_t value, std::uint32_t width) {
+  return (value >> (width - 1)) & 1ull;
+}
+
+static std::uint64_t sign_extend(std::uint64_t value, std::uint32_t width) {
+  return width >= 64 ? value
+                     : (msb(value, width) ? value | ~mask(width)
+                                          : value & mask(width));
+}
+
+// index of the 64bit register enclosing reg, -1 if reg is not a gpr...
+static int gpr_index(zydis_reg_t reg) {
+  const auto full =
+      ZydisRegisterGetLargestEnclosing(ZYDIS_MACHINE_MODE_LONG_64, reg);
+  if (!vm::utils::is_64_bit_gp(full))
+    return -1;
+  return full - ZYDIS_REGISTER_RAX;
+}
+
+static bool is_high_byte(zydis_reg_t reg) {
+  return reg == ZYDIS_REGISTER_AH || reg == ZYDIS_REGISTER_CH ||
+         reg == ZYDIS_REGISTER_DH || reg == ZYDIS_REGISTER_BH;
+}
+
+eval_t::eval_t(lease_t& lease)
+    : m_uc(lease.uc()),
+      m_engine(lease.engine()),
+      m_gpr{},
+      m_rip(0u),
+      m_rflags(0u),
+      m_fallbacks(0u) {
+  m_regions.push_back(
+      {m_engine->module_base, m_engine->image_size,
+       m_engine->image_view
+           ? reinterpret_cast<std::uint8_t*>(m_engine->image_view)
+           : reinterpret_cast<std::uint8_t*>(m_engine->module_base),
+       m_engine->image_view != nullptr, 0u, 0u});
+  m_regions.push_back(
+      {EMU_STACK_BASE, EMU_STACK_SIZE, m_engine->stack, true, 0u, 0u});
+}
+
+void eval_t::load() {
+  void* values[16];
+  for (auto idx = 0u; idx < m_gpr.size(); ++idx)
+    values[idx] = &m_gpr[idx];
+
+  uc_reg_read_batch(m_uc, g_uc_gprs, values, m_gpr.size());
+  uc_reg_read(m_uc, UC_X86_REG_RIP, &m_rip);
+  uc_reg_read(m_uc, UC_X86_REG_RFLAGS, &m_rflags);
+}
+
+void eval_t::store() {
+  void* values[16];
+  for (auto idx = 0u; idx < m_gpr.size(); ++idx)
+    values[idx] = &m_gpr[idx];
+
+  uc_reg_write_batch(m_uc, g_uc_gprs, values, m_gpr.size());
+  uc_reg_write(m_uc, UC_X86_REG_RIP, &m_rip);
+  uc_reg_write(m_uc, UC_X86_REG_RFLAGS, &m_rflags);
+
+  for (auto& region : m_regions) {
+    if (region.written_begin >= region.written_end)
+      continue;
+
+    uc_ctl_remove_cache(m_uc, region.written_begin, region.written_end);
+    region.written_begin = region.written_end = 0u;
+  }
+}
+
+std::uint64_t eval_t::reg(zydis_reg_t reg) const {
+  std::uint64_t value = 0u;
+  read_reg(reg, value);
+  return value;
+}
+
+bool eval_t::read_reg(zydis_reg_t reg, std::uint64_t& value) const {
+  const auto idx = gpr_index(reg);
+  if (idx < 0)
+    return false;
+
+  value = is_high_byte(reg)
+              ? (m_gpr[idx] >> 8) & 0xFFull
+              : m_gpr[idx] & mask(ZydisRegisterGetWidth(
+                                 ZYDIS_MACHINE_MODE_LONG_64, reg));
+  return true;
+}
+
+bool eval_t::write_reg(zydis_reg_t reg, std::uint64_t value) {
+  const auto idx = gpr_index(reg);
+  if (idx < 0)
+    return false;
+
+  const auto width = ZydisRegisterGetWidth(ZYDIS_MACHINE_MODE_LONG_64, reg);
+  auto& gpr = m_gpr[idx];
+
+  // 32bit writes zero extend, 8 and 16 bit writes only replace their bits...
+  if (is_high_byte(reg))
+    gpr = (gpr & ~0xFF00ull) | ((value & 0xFFull) << 8);
+  else if (width >= 32)
+    gpr = value & mask(width);
+  else
+    gpr = (gpr & ~mask(width)) | (value & mask(width));
+  return true;
+}
+
+std::uint8_t* eval_t::translate(std::uintptr_t addr,
+                                std::size_t size,
+                                bool write) {
+  for (const auto& region : m_regions)
+    if (addr >= region.base && addr + size <= region.base + region.size)
+      return write && !region.writable ? nullptr
+                                       : region.host + (addr - region.base);
+  return nullptr;
+}
+
+bool eval_t::read_mem(std::uintptr_t addr,
+                      std::size_t size,
+                      std::uint64_t& value) {
+  const auto host = translate(addr, size, false);
+  if (!host)
+    return false;
+
+  value = 0u;
+  std::memcpy(&value, host, size);
+  return true;
+}
+
+bool eval_t::write_mem(std::uintptr_t addr,
+                       std::size_t size,
+                       std::uint64_t value) {
+  const auto host = translate(addr, size, true);
+  if (!host)
+    return false;
+
+  // unicorn-engine may have translated code out of the bytes written, its
+  // translations of them are dropped by the next store()...
+  for (auto& region : m_regions) {
+    if (addr < region.base || addr + size > region.base + region.size)
+      continue;
+
+    const auto empty = region.written_begin >= region.written_end;
+    region.written_begin =
+        empty ? addr : std::min<std::uintptr_t>(region.written_begin, addr);
+    region.written_end = empty ? addr + size
+                               : std::max<std::uintptr_t>(region.written_end,
+                                                          addr + size);
+    break;
+  }
+
+  if (m_engine->state && m_engine->state->write(addr, &value, size))
+    return true;
+
+  std::memcpy(host, &value, size);
+  return true;
+}
+
+bool eval_t::address(const zydis_instr_t& instr,
+                     const zydis_decoded_operand_t& op,
+                     std::uint64_t& addr) const {
+  // fs/gs based memory is not backed by anything the evaluator knows about...
+  if (op.mem.segment == ZYDIS_REGISTER_FS ||
+      op.mem.segment == ZYDIS_REGISTER_GS)
+    return false;
+
+  std::uint64_t base = 0u, index = 0u;
+  if (op.mem.base == ZYDIS_REGISTER_RIP)
+    base = instr.addr + instr.instr.length;
+  else if (op.mem.base != ZYDIS_REGISTER_NONE && !read_reg(op.mem.base, base))
+    return false;
+
+  if (op.mem.index != ZYDIS_REGISTER_NONE &&
+      !read_reg(op.mem.index, index))
+    return false;
+
+  addr = base + index * op.mem.scale +
+         (op.mem.disp.has_displacement ? op.mem.disp.value : 0ll);
+  addr &= mask(instr.instr.address_width);
+  return true;
+}
+
+bool eval_t::read(const zydis_instr_t& instr,
+                  const zydis_decoded_operand_t& op,
+                  std::uint64_t& value) {
+  switch (op.type) {
+    case ZYDIS_OPERAND_TYPE_REGISTER:
+      return read_reg(op.reg.value, value);
+    case ZYDIS_OPERAND_TYPE_MEMORY: {
+      std::uint64_t addr;
+      return address(instr, op, addr) && read_mem(addr, op.size / 8, value);
+    }
+    case ZYDIS_OPERAND_TYPE_IMMEDIATE:
+      value = op.imm.value.u;
+      return true;
+    default:
+      return false;
+  }
+}
+
+bool eval_t::write(const zydis_instr_t& instr,
+                   const zydis_decoded_operand_t& op,
+                   std::uint64_t value) {
+  switch (op.type) {
+    case ZYDIS_OPERAND_TYPE_REGISTER:
+      return write_reg(op.reg.value, value);
+    case ZYDIS_OPERAND_TYPE_MEMORY: {
+      std::uint64_t addr;
+      return address(instr, op, addr) && write_mem(addr, op.size / 8, value);
+    }
+    default:
+      return false;
+  }
+}
+
+void eval_t::set_flags(std::uint64_t result,
+                       std::uint32_t width,
+                       bool cf,
+                       bool of,
+                       bool af) {
+  result &= mask(width);
+  m_rflags &= ~EFLAGS_STATUS;
+  m_rflags |= (cf ? EFLAGS_CF : 0ull) | (of ? EFLAGS_OF : 0ull) |
+              (af ? EFLAGS_AF : 0ull) | (!result ? EFLAGS_ZF : 0ull) |
+              (msb(result, width) ? EFLAGS_SF : 0ull) |
+              (std::popcount(result & 0xFFull) % 2 ? 0ull : EFLAGS_PF);
+}
+
+bool eval_t::condition(ZydisMnemonic mnemonic, bool& taken) const {
+  const bool cf = m_rflags & EFLAGS_CF, pf = m_rflags & EFLAGS_PF,
+             zf = m_rflags & EFLAGS_ZF, sf = m_rflags & EFLAGS_SF,
+             of = m_rflags & EFLAGS_OF;
+
+  switch (mnemonic) {
+    case ZYDIS_MNEMONIC_JO:
+      taken = of;
+      break;
+    case ZYDIS_MNEMONIC_JNO:
+      taken = !of;
+      break;
+    case ZYDIS_MNEMONIC_JB:
+      taken = cf;
+      break;
+    case ZYDIS_MNEMONIC_JNB:
+      taken = !cf;
+      break;
+    case ZYDIS_MNEMONIC_JZ:
+      taken = zf;
+      break;
+    case ZYDIS_MNEMONIC_JNZ:
+      taken = !zf;
+      break;
+    case ZYDIS_MNEMONIC_JBE:
+      taken = cf || zf;
+      break;
+    case ZYDIS_MNEMONIC_JNBE:
+      taken = !cf && !zf;
+      break;
+    case ZYDIS_MNEMONIC_JS:
+      taken = sf;
+      break;
+    case ZYDIS_MNEMONIC_JNS:
+      taken = !sf;
+      break;
+    case ZYDIS_MNEMONIC_JP:
+      taken = pf;
+      break;
+    case ZYDIS_MNEMONIC_JNP:
+      taken = !pf;
+      break;
+    case ZYDIS_MNEMONIC_JL:
+      taken = sf != of;
+      break;
+    case ZYDIS_MNEMONIC_JNL:
+      taken = sf == of;
+      break;
+    case ZYDIS_MNEMONIC_JLE:
+      taken = zf || sf != of;
+      break;
+    case ZYDIS_MNEMONIC_JNLE:
+      taken = !zf && sf == of;
+      break;
+    default:
+      return false;
+  }
+  return true;
+}
+
+bool eval_t::step(const zydis_instr_t& zinstr) {
+  const auto& instr = zinstr.instr;
+  const auto& ops = instr.operands;
+  const auto next = zinstr.addr + instr.length;
+
+  // every path below either fails before changing anything, or does its one
+  // memory write before touching any register...
+  switch (instr.mnemonic) {
+    case ZYDIS_MNEMONIC_NOP:
+      break;
+    case ZYDIS_MNEMONIC_MOV: {
+      std::uint64_t value;
+      if (!read(zinstr, ops[1], value) || !write(zinstr, ops[0], value))
+        return false;
+      break;
+    }
+    case ZYDIS_MNEMONIC_MOVZX: {
+      std::uint64_t value;
+      if (!read(zinstr, ops[1], value) ||
+          !write(zinstr, ops[0], value & mask(ops[1].size)))
+        return false;
+      break;
+    }
+    case ZYDIS_MNEMONIC_MOVSX:
+    case ZYDIS_MNEMONIC_MOVSXD: {
+      std::uint64_t value;
+      if (!read(zinstr, ops[1], value) ||
+          !write(zinstr, ops[0], sign_extend(value, ops[1].size)))
+        return false;
+      break;
+    }
+    case ZYDIS_MNEMONIC_LEA: {
+      std::uint64_t addr;
+      if (!address(zinstr, ops[1], addr) || !write_reg(ops[0].reg.value, addr))
+        return false;
+      break;
+    }
+    case ZYDIS_MNEMONIC_ADD:
+    case ZYDIS_MNEMONIC_SUB:
+    case ZYDIS_MNEMONIC_CMP: {
+      const auto width = ops[0].size;
+      std::uint64_t a, b;
+      if (!read(zinstr, ops[0], a) || !read(zinstr, ops[1], b))
+        return false;
+
+      a &= mask(width);
+      b &= mask(width);
+
+      const auto add = instr.mnemonic == ZYDIS_MNEMONIC_ADD;
+      const auto result = (add ? a + b : a - b) & mask(width);
+
+      if (instr.mnemonic != ZYDIS_MNEMONIC_CMP &&
+          !write(zinstr, ops[0], result))
+        return false;
+
+      set_flags(result, width, add ? result < a : a < b,
+                add ? msb((a ^ result) & (b ^ result), width)
+                    : msb((a ^ b) & (a ^ result), width),
+                (a ^ b ^ result) & 0x10ull);
+      break;
+    }
+    case ZYDIS_MNEMONIC_AND:
+    case ZYDIS_MNEMONIC_OR:
+    case ZYDIS_MNEMONIC_XOR:
+    case ZYDIS_MNEMONIC_TEST: {
+      const auto width = ops[0].size;
+      std::uint64_t a, b;
+      if (!read(zinstr, ops[0], a) || !read(zinstr, ops[1], b))
+        return false;
+
+      std::uint64_t result;
+      switch (instr.mnemonic) {
+        case ZYDIS_MNEMONIC_OR:
+          result = a | b;
+          break;
+        case ZYDIS_MNEMONIC_XOR:
+          result = a ^ b;
+          break;
+        default:
+          result = a & b;
+          break;
+      }
+
+      result &= mask(width);
+      if (instr.mnemonic != ZYDIS_MNEMONIC_TEST &&
+          !write(zinstr, ops[0], result))
+        return false;
+
+      set_flags(result, width, false, false, false);
+      break;
+    }
+    case ZYDIS_MNEMONIC_INC:
+    case ZYDIS_MNEMONIC_DEC: {
+      const auto width = ops[0].size;
+      std::uint64_t a;
+      if (!read(zinstr, ops[0], a))
+        return false;
+
+      a &= mask(width);
+      const auto inc = instr.mnemonic == ZYDIS_MNEMONIC_INC;
+      const auto result = (inc ? a + 1 : a - 1) & mask(width);
+
+      if (!write(zinstr, ops[0], result))
+        return false;
+
+      // inc and dec leave CF alone...
+      set_flags(result, width, m_rflags & EFLAGS_CF,
+                inc ? msb(~a & result, width) : msb(a & ~result, width),
+                (a ^ 1ull ^ result) & 0x10ull);
+      break;
+    }
+    case ZYDIS_MNEMONIC_NEG: {
+      const auto width = ops[0].size;
+      std::uint64_t a;
+      if (!read(zinstr, ops[0], a))
+        return false;
+
+      a &= mask(width);
+      const auto result = (0ull - a) & mask(width);
+
+      if (!write(zinstr, ops[0], result))
+        return false;
+
+      set_flags(result, width, a != 0, msb(a & result, width),
+                (a ^ result) & 0x10ull);
+      break;
+    }
+    case ZYDIS_MNEMONIC_NOT: {
+      std::uint64_t a;
+      if (!read(zinstr, ops[0], a) || !write(zinstr, ops[0], ~a))
+        return false;
+      break;
+    }
+    case ZYDIS_MNEMONIC_ROL:
+    case ZYDIS_MNEMONIC_ROR: {
+      const auto width = ops[0].size;
+      std::uint64_t a, count;
+      if (!read(zinstr, ops[0], a) || !read(zinstr, ops[1], count))
+        return false;
+
+      a &= mask(width);
+      count &= width == 64 ? 0x3Full : 0x1Full;
+
+      // a masked count of zero does nothing at all, not even to the flags...
+      if (!count)
+        break;
+
+      const auto rot = count % width;
+      const auto rol = instr.mnemonic == ZYDIS_MNEMONIC_ROL;
+      const auto result =
+          rot ? (rol ? (a << rot) | (a >> (width - rot))
+                     : (a >> rot) | (a << (width - rot))) &
+                    mask(width)
+              : a;
+
+      if (!write(zinstr, ops[0], result))
+        return false;
+
+      const bool cf = rol ? result & 1ull : msb(result, width);
+      const bool of = rol ? msb(result, width) != cf
+                          : msb(result, width) != msb(result, width - 1);
+
+      m_rflags &= ~(EFLAGS_CF | EFLAGS_OF);
+      m_rflags |= (cf ? EFLAGS_CF : 0ull) | (of ? EFLAGS_OF : 0ull);
+      break;
+    }
+    case ZYDIS_MNEMONIC_BSWAP: {
+      std::uint64_t a;
+      if (!read(zinstr, ops[0], a))
+        return false;
+
+      std::uint64_t result = 0u;
+      for (auto byte = 0u; byte < ops[0].size / 8; ++byte)
+        result = (result << 8) | ((a >> (byte * 8)) & 0xFFull);
+
+      if (!write(zinstr, ops[0], result))
+        return false;
+      break;
+    }
+    case ZYDIS_MNEMONIC_XCHG: {
+      std::uint64_t a, b;
+      if (!read(zinstr, ops[0], a) || !read(zinstr, ops[1], b))
+        return false;
+
+      // the memory operand (if there is one) is always written first...
+      if (ops[1].type == ZYDIS_OPERAND_TYPE_MEMORY) {
+        if (!write(zinstr, ops[1], a) || !write(zinstr, ops[0], b))
+          return false;
+      } else if (!write(zinstr, ops[0], b) || !write(zinstr, ops[1], a))
+        return false;
+      break;
+    }
+    case ZYDIS_MNEMONIC_PUSH:
+    case ZYDIS_MNEMONIC_PUSHFQ: {
+      const auto size = instr.operand_width / 8;
+      std::uint64_t value;
+
+      // pushfq never shows RF or VM...
+      if (instr.mnemonic == ZYDIS_MNEMONIC_PUSHFQ)
+        value = m_rflags & ~0x30000ull;
+      else if (!read(zinstr, ops[0], value))
+        return false;
+
+      const auto rsp = m_gpr[ZYDIS_REGISTER_RSP - ZYDIS_REGISTER_RAX] - size;
+      if (!write_mem(rsp, size, value))
+        return false;
+
+      m_gpr[ZYDIS_REGISTER_RSP - ZYDIS_REGISTER_RAX] = rsp;
+      break;
+    }
+    case ZYDIS_MNEMONIC_POP:
+    case ZYDIS_MNEMONIC_POPFQ: {
+      const auto size = instr.operand_width / 8;
+      auto& rsp = m_gpr[ZYDIS_REGISTER_RSP - ZYDIS_REGISTER_RAX];
+      std::uint64_t value;
+
+      if (!read_mem(rsp, size, value))
+        return false;
+
+      if (instr.mnemonic == ZYDIS_MNEMONIC_POPFQ) {
+        // single stepping is left to unicorn-engine...
+        if (size != 8 || value & EFLAGS_TF)
+          return false;
+
+        rsp += size;
+        m_rflags = (m_rflags & ~EFLAGS_POPF_MASK) |
+                   (value & EFLAGS_POPF_MASK) | 0x2ull;
+        break;
+      }
+
+      // pop into memory computes the address after rsp is incremented...
+      if (ops[0].type != ZYDIS_OPERAND_TYPE_REGISTER)
+        return false;
+
+      rsp += size;
+      write_reg(ops[0].reg.value, value);
+      break;
+    }
+    case ZYDIS_MNEMONIC_CLC:
+      m_rflags &= ~EFLAGS_CF;
+      break;
+    case ZYDIS_MNEMONIC_STC:
+      m_rflags |= EFLAGS_CF;
+      break;
+    case ZYDIS_MNEMONIC_CMC:
+      m_rflags ^= EFLAGS_CF;
+      break;
+    case ZYDIS_MNEMONIC_JMP: {
+      std::uint64_t target;
+      if (ops[0].type == ZYDIS_OPERAND_TYPE_IMMEDIATE) {
+        if (!ZYAN_SUCCESS(ZydisCalcAbsoluteAddress(&instr, &ops[0],
+                                                   zinstr.addr, &target)))
+          return false;
+      } else if (!read(zinstr, ops[0], target))
+        return false;
+
+      m_rip = target;
+      return true;
+    }
+    case ZYDIS_MNEMONIC_CALL: {
+      std::uint64_t target;
+      if (ops[0].type == ZYDIS_OPERAND_TYPE_IMMEDIATE) {
+        if (!ZYAN_SUCCESS(ZydisCalcAbsoluteAddress(&instr, &ops[0],
+                                                   zinstr.addr, &target)))
+          return false;
+      } else if (!read(zinstr, ops[0], target))
+        return false;
+
+      const auto rsp = m_gpr[ZYDIS_REGISTER_RSP - ZYDIS_REGISTER_RAX] - 8;
+      if (!write_mem(rsp, 8, next))
+        return false;
+
+      m_gpr[ZYDIS_REGISTER_RSP - ZYDIS_REGISTER_RAX] = rsp;
+      m_rip = target;
+      return true;
+    }
+    case ZYDIS_MNEMONIC_RET: {
+      auto& rsp = m_gpr[ZYDIS_REGISTER_RSP - ZYDIS_REGISTER_RAX];
+      std::uint64_t target;
+      if (!read_mem(rsp, 8, target))
+        return false;
+
+      rsp += 8 + (instr.operand_count &&
+                          ops[0].type == ZYDIS_OPERAND_TYPE_IMMEDIATE
+                      ? ops[0].imm.value.u
+                      : 0ull);
+      m_rip = target;
+      return true;
+    }
+    default: {
+      bool taken;
+      if (!condition(instr.mnemonic, taken))
+        return false;
+
+      std::uint64_t target = next;
+      if (taken && !ZYAN_SUCCESS(ZydisCalcAbsoluteAddress(
+                       &instr, &ops[0], zinstr.addr, &target)))
+        return false;
+
+      m_rip = target;
+      return true;
+    }
+  }
+
+  m_rip = next;
+  return true;
+}
+
+bool eval_t::run(const zydis_rtn_t& rtn) {
+  load();
+  for (const auto& instr : rtn) {
+    // a branch went somewhere the flattened routine did not...
+    if (m_rip != instr.addr) {
+      store();
+      return false;
+    }
+
+    if (step(instr))
+      continue;
+
+    store();
+    ++m_fallbacks;
+    if (uc_emu_start(m_uc, instr.addr, 0ull, 0ull, 1ull))
+      return false;
+    load();
+  }
+
+  store();
+  return true;
+}
+}  // namespace vm::emu
@@ -0,0 +1,75 @@
+#include <vmfile.hpp>
+
+#if defined(_WIN32)
+#include <Windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace vm {
+std::unique_ptr<file_t> file_t::open(const std::string& path) {
+#if defined(_WIN32)
+  const auto file =
+      CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr,
+                  OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+  if (file == INVALID_HANDLE_VALUE)
+    return {};
+
+  LARGE_INTEGER size;
+  if (!GetFileSizeEx(file, &size) || !size.QuadPart) {
+    CloseHandle(file);
+    return {};
+  }
+
+  const auto mapping =
+      CreateFileMappingW(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+  CloseHandle(file);
+  if (!mapping)
+    return {};
+
+  // the view keeps the mapping alive...
+  const auto view = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+  CloseHandle(mapping);
+  if (!view)
+    return {};
+
+  return std::unique_ptr<file_t>(
+      new file_t(reinterpret_cast<const std::uint8_t*>(view), size.QuadPart));
+#else
+  const auto fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd == -1)
+    return {};
+
+  struct stat st;
+  if (fstat(fd, &st) == -1 || !st.st_size) {
+    close(fd);
+    return {};
+  }
+
+  // the mapping keeps the file alive...
+  const auto view = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (view == MAP_FAILED)
+    return {};
+
+  // headers and sections are copied out front to back...
+  madvise(view, st.st_size, MADV_SEQUENTIAL);
+  return std::unique_ptr<file_t>(
+      new file_t(reinterpret_cast<const std::uint8_t*>(view), st.st_size));
+#endif
+}
+
+file_t::file_t(const std::uint8_t* data, std::size_t size)
+    : m_data(data), m_size(size) {}
+
+file_t::~file_t() {
+#if defined(_WIN32)
+  UnmapViewOfFile(m_data);
+#else
+  munmap(const_cast<std::uint8_t*>(m_data), m_size);
+#endif
+}
+}  // namespace vm
@@ -0,0 +1,354 @@
+#include <vmfile.hpp>
+#include <vmimage.hpp>
+#include <vmsched.hpp>
+#include <vmutils.hpp>
+
+#include <cstring>
+#include <shared_mutex>
+
+#if defined(_WIN32)
+#include <Windows.h>
+#else
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+#define IMAGE_PAGE_SHIFT 12u
+
+// base_rva and size_block, the entries of a relocation block follow them...
+#define IMAGE_RELOC_HEADER 8u
+
+// most workers a scheduler started by map itself gets... relocating is bound
+// by memory bandwidth long before it runs out of cores.
+#define IMAGE_RELOC_THREADS 4u
+
+namespace vm {
+// lazily relocated images which are still alive, and how many of them still
+// have pages left to relocate...
+static std::shared_mutex g_lazy_lock;
+static std::vector<image_t*> g_lazy_images;
+static std::atomic<std::uint32_t> g_lazy = 0u;
+
+// applies a single relocation block to an image of image_size bytes mapped at
+// module_base... relocations which would write past the image are skipped.
+static void apply(std::uintptr_t module_base,
+                  std::uintptr_t image_base,
+                  std::uintptr_t image_size,
+                  win::reloc_block_t* reloc_block) {
+  std::for_each(reloc_block->begin(), reloc_block->end(),
+                [&](win::reloc_entry_t& entry) {
+                  switch (entry.type) {
+                    case win::reloc_type_id::rel_based_dir64: {
+                      const std::uintptr_t rva =
+                          entry.offset + reloc_block->base_rva;
+                      if (rva + sizeof(std::uintptr_t) > image_size)
+                        break;
+
+                      auto reloc_at = reinterpret_cast<std::uintptr_t*>(
+                          rva + module_base);
+                      *reloc_at = module_base + ((*reloc_at) - image_base);
+                      break;
+                    }
+                    default:
+                      break;
+                  }
+                });
+}
+
+// create an anonymous shared memory object and map all of it read/write...
+static std::uint8_t* create_section(std::size_t size, std::intptr_t& section) {
+#if defined(_WIN32)
+  const auto handle = CreateFileMappingW(
+      INVALID_HANDLE_VALUE, nullptr, PAGE_READWRITE,
+      static_cast<DWORD>(size >> 32), static_cast<DWORD>(size), nullptr);
+  if (!handle)
+    return nullptr;
+
+  const auto view = MapViewOfFile(handle, FILE_MAP_ALL_ACCESS, 0, 0, size);
+  if (!view) {
+    CloseHandle(handle);
+    return nullptr;
+  }
+
+  section = reinterpret_cast<std::intptr_t>(handle);
+  return reinterpret_cast<std::uint8_t*>(view);
+#else
+  const auto fd = memfd_create("vmprofiler-image", MFD_CLOEXEC);
+  if (fd == -1)
+    return nullptr;
+
+  if (ftruncate(fd, size) == -1) {
+    close(fd);
+    return nullptr;
+  }
+
+  const auto view =
+      mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  if (view == MAP_FAILED) {
+    close(fd);
+    return nullptr;
+  }
+
+  section = fd;
+  return reinterpret_cast<std::uint8_t*>(view);
+#endif
+}
+
+static void close_section(std::uint8_t* view,
+                          std::size_t size,
+                          std::intptr_t section) {
+#if defined(_WIN32)
+  UnmapViewOfFile(view);
+  CloseHandle(reinterpret_cast<HANDLE>(section));
+#else
+  munmap(view, size);
+  close(static_cast<int>(section));
+#endif
+}
+
+std::unique_ptr<image_t> image_t::map(const std::uint8_t* file,
+                                      std::size_t file_size,
+                                      reloc_mode_t mode,
+                                      vm::sched::scheduler_t* sched) {
+  if (!vm::utils::valid_pe(file, file_size))
+    return {};
+
+  const auto img = reinterpret_cast<const win::image_t<>*>(file);
+  const auto nt_headers = img->get_nt_headers();
+  const auto sections = nt_headers->get_sections();
+  const auto num_sections = nt_headers->file_header.num_sections;
+  const auto size_headers = nt_headers->optional_header.size_headers;
+  const std::uintptr_t image_base = nt_headers->optional_header.image_base;
+  const std::uintptr_t image_size =
+      (nt_headers->optional_header.size_image + 0xFFFull) & ~0xFFFull;
+
+  // the section table is read out of the mapped headers later on, so the
+  // headers copied into the image have to hold all of it...
+  const auto headers_end = reinterpret_cast<const std::uint8_t*>(
+                               sections + num_sections) -
+                           file;
+
+  if (!image_base || !image_size || size_headers > file_size ||
+      size_headers > image_size ||
+      static_cast<std::uintptr_t>(headers_end) > size_headers)
+    return {};
+
+  std::intptr_t section;
+  const auto module = create_section(image_size, section);
+  if (!module)
+    return {};
+
+  const auto module_base = reinterpret_cast<std::uintptr_t>(module);
+  std::memcpy(module, file, size_headers);
+  std::for_each(sections, sections + num_sections,
+                [&](const win::section_header_t& section_header) {
+                  // never read past the end of the file or write past the end
+                  // of the image...
+                  if (section_header.ptr_raw_data >= file_size ||
+                      section_header.virtual_address >= image_size)
+                    return;
+
+                  const auto size = std::min<std::uintptr_t>(
+                      {section_header.size_raw_data,
+                       file_size - section_header.ptr_raw_data,
+                       image_size - section_header.virtual_address});
+
+                  std::memcpy(module + section_header.virtual_address,
+                              file + section_header.ptr_raw_data, size);
+                });
+
+  auto image = std::unique_ptr<image_t>(
+      new image_t(module_base, image_base, image_size, section));
+
+  auto win_img = reinterpret_cast<win::image_t<>*>(module);
+  auto basereloc_dir =
+      win_img->get_directory(win::directory_id::directory_entry_basereloc);
+
+  if (!basereloc_dir || !basereloc_dir->rva ||
+      basereloc_dir->rva >= image_size)
+    return image;
+
+  // every relocation block which lies inside of both the directory and the
+  // image, up to the first one which does not...
+  std::vector<win::reloc_block_t*> reloc_blocks;
+  const std::uintptr_t reloc_end = std::min<std::uintptr_t>(
+      static_cast<std::uintptr_t>(basereloc_dir->rva) + basereloc_dir->size,
+      image_size);
+  for (std::uintptr_t rva = basereloc_dir->rva;
+       rva + IMAGE_RELOC_HEADER <= reloc_end;) {
+    const auto reloc_block =
+        reinterpret_cast<win::reloc_block_t*>(module_base + rva);
+    if (!reloc_block->base_rva ||
+        reloc_block->size_block < IMAGE_RELOC_HEADER ||
+        reloc_block->size_block > reloc_end - rva)
+      break;
+
+    reloc_blocks.push_back(reloc_block);
+    rva += reloc_block->size_block;
+  }
+
+  switch (mode) {
+    case reloc_mode_t::eager: {
+      // apply relocations to all sections...
+      for (const auto reloc_block : reloc_blocks)
+        apply(module_base, image_base, image_size, reloc_block);
+      break;
+    }
+    case reloc_mode_t::parallel: {
+      // without a scheduler of the caller's a small one is started for this
+      // image alone... not worth it at all for a single block.
+      std::unique_ptr<vm::sched::scheduler_t> local;
+      if (!sched) {
+        const auto threads = std::min<std::size_t>(
+            {std::max(std::thread::hardware_concurrency(), 1u),
+             IMAGE_RELOC_THREADS, reloc_blocks.size()});
+
+        if (threads <= 1u) {
+          for (const auto reloc_block : reloc_blocks)
+            apply(module_base, image_base, image_size, reloc_block);
+          break;
+        }
+
+        local = std::make_unique<vm::sched::scheduler_t>(
+            static_cast<std::uint32_t>(threads));
+        sched = local.get();
+      }
+
+      // relocated values never overlap, so no two blocks ever write the same
+      // bytes... not even for a value which straddles two pages.
+      vm::sched::group_t group;
+      for (const auto reloc_block : reloc_blocks)
+        sched->spawn(group, [=]() {
+          apply(module_base, image_base, image_size, reloc_block);
+        });
+
+      sched->wait(group);
+      break;
+    }
+    case reloc_mode_t::lazy: {
+      const auto pages = image_size >> IMAGE_PAGE_SHIFT;
+      image->m_relocs.resize(pages);
+      image->m_relocated = std::make_unique<std::atomic<bool>[]>(pages);
+
+      for (const auto reloc_block : reloc_blocks) {
+        const auto page = reloc_block->base_rva >> IMAGE_PAGE_SHIFT;
+        if (page < pages)
+          image->m_relocs[page].push_back(
+              reinterpret_cast<std::uintptr_t>(reloc_block) - module_base);
+      }
+
+      std::size_t pending = 0u;
+      for (auto page = 0u; page < pages; ++page) {
+        image->m_relocated[page] = image->m_relocs[page].empty();
+        pending += !image->m_relocated[page];
+      }
+
+      if (!(image->m_pending = pending))
+        break;
+
+      std::unique_lock<std::shared_mutex> lock(g_lazy_lock);
+      g_lazy_images.push_back(image.get());
+      ++g_lazy;
+      break;
+    }
+  }
+
+  return image;
+}
+
+std::unique_ptr<image_t> image_t::load(const std::string& path,
+                                       reloc_mode_t mode,
+                                       vm::sched::scheduler_t* sched) {
+  const auto file = file_t::open(path);
+  if (!file)
+    return {};
+
+  return map(file->data(), file->size(), mode, sched);
+}
+
+void image_t::touch(std::uintptr_t addr, std::size_t size) {
+  if (!g_lazy.load(std::memory_order_acquire))
+    return;
+
+  std::shared_lock<std::shared_mutex> lock(g_lazy_lock);
+  for (const auto image : g_lazy_images)
+    if (addr < image->m_module_base + image->m_image_size &&
+        addr + size > image->m_module_base)
+      image->relocate(addr, addr + size);
+}
+
+void image_t::relocate(std::uintptr_t begin, std::uintptr_t end) {
+  // a relocated value can start up to 7 bytes before the range and still
+  // overlap it, the page holding its relocation has to be applied as well...
+  begin = begin < m_module_base + 7u ? m_module_base : begin - 7u;
+  end = std::min(end, m_module_base + m_image_size);
+  if (begin >= end)
+    return;
+
+  const auto first = (begin - m_module_base) >> IMAGE_PAGE_SHIFT;
+  const auto last = (end - 1u - m_module_base) >> IMAGE_PAGE_SHIFT;
+  for (auto page = first; page <= last; ++page) {
+    if (m_relocated[page].load(std::memory_order_acquire))
+      continue;
+
+    std::lock_guard<std::mutex> lock(m_lock);
+    if (m_relocated[page].load(std::memory_order_relaxed))
+      continue;
+
+    for (const auto rva : m_relocs[page])
+      apply(m_module_base, m_image_base, m_image_size,
+            reinterpret_cast<win::reloc_block_t*>(m_module_base + rva));
+
+    m_relocs[page].clear();
+    m_relocs[page].shrink_to_fit();
+    m_relocated[page].store(true, std::memory_order_release);
+
+    if (!--m_pending)
+      --g_lazy;
+  }
+}
+
+image_t::image_t(std::uintptr_t module_base,
+                 std::uintptr_t image_base,
+                 std::uintptr_t image_size,
+                 std::intptr_t section)
+    : m_module_base(module_base),
+      m_image_base(image_base),
+      m_image_size(image_size),
+      m_section(section),
+      m_pending(0u) {}
+
+image_t::~image_t() {
+  if (m_relocated) {
+    std::unique_lock<std::shared_mutex> lock(g_lazy_lock);
+    g_lazy_images.erase(
+        std::remove(g_lazy_images.begin(), g_lazy_images.end(), this),
+        g_lazy_images.end());
+
+    if (m_pending)
+      --g_lazy;
+  }
+
+  close_section(reinterpret_cast<std::uint8_t*>(m_module_base), m_image_size,
+                m_section);
+}
+
+void* image_t::map_view() const {
+#if defined(_WIN32)
+  return MapViewOfFile(reinterpret_cast<HANDLE>(m_section), FILE_MAP_COPY, 0, 0,
+                       m_image_size);
+#else
+  const auto view = mmap(nullptr, m_image_size, PROT_READ | PROT_WRITE,
+                         MAP_PRIVATE, static_cast<int>(m_section), 0);
+  return view == MAP_FAILED ? nullptr : view;
+#endif
+}
+
+void image_t::unmap_view(void* view) const {
+#if defined(_WIN32)
+  UnmapViewOfFile(view);
+#else
+  munmap(view, m_image_size);
+#endif
+}
+}  // namespace vm
@@ -122,20 +122,30 @@ void deobfuscate(hndlr_trace_t& trace) {
   } while (last_size != trace.m_instrs.size());
 }
 
-void init() {
-  if (static std::atomic_bool once = true; once.exchange(false))
-    std::sort(profiles.begin(), profiles.end(),
-              [&](profiler_t* a, profiler_t* b) -> bool {
+const std::vector<profiler_t*>& registry() {
+  // initialization of a function local static is thread safe and every reader
+  // happens after it...
+  static const std::vector<profiler_t*> sorted = []() {
+    auto result = profiles;
+    std::sort(result.begin(), result.end(),
+              [](profiler_t* a, profiler_t* b) -> bool {
                 return a->matchers.size() > b->matchers.size();
               });
+    return result;
+  }();
+  return sorted;
+}
+
+void init() {
+  registry();
 }
 
 vinstr_t determine(hndlr_trace_t& hndlr) {
-  std::vector<emu_instr_t> trimmed_instrs = hndlr.m_instrs;
   // find the last MOV REG, DWORD PTR [VIP] in the instruction stream, then
-  // remove any instructions from this instruction to the JMP/RET...
+  // leave out any instructions from this instruction to the JMP/RET... the
+  // stream is only narrowed, not copied.
   const auto rva_fetch = std::find_if(
-  trimmed_instrs.rbegin(), trimmed_instrs.rend(),
+  hndlr.m_instrs.rbegin(), hndlr.m_instrs.rend(),
   [& vip = hndlr.m_vip](
       const vm::instrs::emu_instr_t& instr) -> bool {
     const auto& i = instr.m_instr;
@@ -145,18 +155,21 @@ vinstr_t determine(hndlr_trace_t& hndlr) {
            i.operands[1].mem.base == vip && i.operands[1].size == 32;
   });
 
-  if (rva_fetch != trimmed_instrs.rend())
-      trimmed_instrs.erase((rva_fetch + 1).base(), trimmed_instrs.end());
+  const auto trimmed_begin = hndlr.m_instrs.begin();
+  const auto trimmed_end = rva_fetch != hndlr.m_instrs.rend()
+                               ? (rva_fetch + 1).base()
+                               : hndlr.m_instrs.end();
+  const auto& profiles = registry();
   auto profile = std::find_if(
     profiles.begin(), profiles.end(), [&](profiler_t* profile) -> bool {
       for (auto& matcher : profile->matchers) {
         const auto matched =
-            std::find_if(trimmed_instrs.begin(), trimmed_instrs.end(),
+            std::find_if(trimmed_begin, trimmed_end,
                          [&](const emu_instr_t& instr) -> bool {
                            const auto& i = instr.m_instr;
                            return matcher(hndlr.m_vip, hndlr.m_vsp, i);
                          });
-        if (matched == trimmed_instrs.end())
+        if (matched == trimmed_end)
           return false;
       }
       return true;
@@ -189,10 +202,23 @@ vinstr_t determine(hndlr_trace_t& hndlr) {
   return result.has_value() ? result.value() : vinstr_t{mnemonic_t::unknown};
 }
 
+uc_context* get_cpu(hndlr_trace_t& hndlr, emu_instr_t& instr) {
+  if (!instr.m_cpu && hndlr.m_materialize)
+    instr.m_cpu = hndlr.m_materialize(instr.m_idx);
+  return instr.m_cpu;
+}
+
+void release(hndlr_trace_t& hndlr) {
+  for (auto& instr : hndlr.m_instrs)
+    uct_context_free(instr.m_cpu);
+  hndlr.m_instrs.clear();
+}
+
 profiler_t* get_profile(mnemonic_t mnemonic) {
   if (mnemonic == mnemonic_t::unknown)
     return nullptr;
 
+  const auto& profiles = registry();
   const auto res = std::find_if(profiles.begin(), profiles.end(),
                                 [&](profiler_t* profile) -> bool {
                                   return profile->mnemonic == mnemonic;
@@ -1,11 +1,23 @@
+#include <atomic>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
 #include <string>
+#include <vmfile.hpp>
+#include <vmimage.hpp>
 #include <vmlocate.hpp>
 
+#if defined(_WIN32)
+#include <Windows.h>
+#else
+#include <unistd.h>
+#endif
+
 namespace vm::locate {
 std::uintptr_t sigscan(void* base, std::uint32_t size, const char* pattern,
                        const char* mask) {
-  static const auto check_mask = [&](const char* base, const char* pattern,
-                                     const char* mask) -> bool {
+  static const auto check_mask = [](const char* base, const char* pattern,
+                                    const char* mask) -> bool {
     for (; *mask; ++base, ++pattern, ++mask)
       if (*mask == 'x' && *base != *pattern) return false;
     return true;
@@ -21,12 +33,12 @@ std::uintptr_t sigscan(void* base, std::uint32_t size, const char* pattern,
   return {};
 }
 
-std::vector<vm_enter_t> get_vm_entries(std::uintptr_t module_base,
-                                       std::uint32_t module_size) {
-  std::uintptr_t result = module_base;
-  std::vector<vm_enter_t> entries;
-
-  static const auto push_regs = [&](const zydis_rtn_t& rtn) -> bool {
+// checks the candidate vm entry at addr, which starts with PUSH IMM, reading
+// every instruction through reader... push_val is set to the encrypted rva.
+static bool check(std::uintptr_t addr,
+                  const vm::utils::reader_t& reader,
+                  std::uint32_t& push_val) {
+  static const auto push_regs = [](const zydis_rtn_t& rtn) -> bool {
     for (unsigned reg = ZYDIS_REGISTER_RAX; reg < ZYDIS_REGISTER_R15; ++reg) {
       auto res = std::find_if(
           rtn.begin(), rtn.end(), [&](const zydis_instr_t& instr) -> bool {
@@ -42,136 +54,385 @@ std::vector<vm_enter_t> get_vm_entries(std::uintptr_t module_base,
     return true;
   };
 
+  // Make sure that the form of the vmenter is a jmp immediately followed by a call imm
+  std::size_t size = 0u;
+  const auto code = reader(addr + 5, size);
+  ZydisDecodedInstruction after_push;
+  if (!code || !ZYAN_SUCCESS(ZydisDecoderDecodeBuffer(
+                   vm::utils::g_decoder.get(), code,
+                   std::min<std::size_t>(size, 5), &after_push)))
+    return false;
+
+  if (after_push.mnemonic != ZYDIS_MNEMONIC_CALL ||
+      after_push.operands[0].type != ZYDIS_OPERAND_TYPE_IMMEDIATE)
+    return false;
+
+  zydis_rtn_t rtn;
+  if (!vm::utils::flatten(rtn, addr, reader, false, 500)) return false;
+
+  // the last instruction in the stream should be a JMP to a register or a
+  // return instruction...
+  const auto& last_instr = rtn[rtn.size() - 1];
+  if (!((last_instr.instr.mnemonic == ZYDIS_MNEMONIC_JMP &&
+         last_instr.instr.operands[0].type == ZYDIS_OPERAND_TYPE_REGISTER) ||
+        last_instr.instr.mnemonic == ZYDIS_MNEMONIC_RET))
+    return false;
+
+  std::uint8_t num_pushs = 0u;
+  std::for_each(rtn.begin(), rtn.end(), [&](const zydis_instr_t& instr) {
+    if (instr.instr.mnemonic == ZYDIS_MNEMONIC_PUSH &&
+        instr.instr.operands[0].type == ZYDIS_OPERAND_TYPE_IMMEDIATE)
+      ++num_pushs;
+  });
+
+  /*
+  only one legit imm pushes for every vm entry...
+  > 0x822c :                                    push 0xFFFFFFFF890001FA <---
+  > 0x7fc9 :                                    call xxxxx
+  > 0x48e4 :                                    push r13
+  > 0x4690 :                                    push rsi
+  > 0x4e53 :                                    push r14
+  > 0x74fb :                                    push rcx
+  > 0x607c :                                    push rsp
+  > 0x4926 :                                    pushfq
+  > 0x4dc2 :                                    push rbp
+  > 0x5c8c :                                    push r12
+  > 0x52ac :                                    push r10
+  > 0x51a5 :                                    push r9
+  > 0x5189 :                                    push rdx
+  > 0x7d5f :                                    push r8
+  > 0x4505 :                                    push rdi
+  > 0x4745 :                                    push r11
+  > 0x478b :                                    push rax
+  > 0x7a53 :                                    push rbx
+  > 0x500d :                                    push r15
+  */
+  if (num_pushs != 1) return false;
+
+  // check for a pushfq...
+  // > 0x4926 :                                    pushfq <---
+  if (!vm::locate::find(rtn, [&](const zydis_instr_t& instr) -> bool {
+        return instr.instr.mnemonic == ZYDIS_MNEMONIC_PUSHFQ;
+      }))
+    return false;
+
+  /*
+  check to see if we push all of these registers...
+  > 0x48e4 :                                    push r13
+  > 0x4690 :                                    push rsi
+  > 0x4e53 :                                    push r14
+  > 0x74fb :                                    push rcx
+  > 0x607c :                                    push rsp
+  > 0x4926 :                                    pushfq
+  > 0x4dc2 :                                    push rbp
+  > 0x5c8c :                                    push r12
+  > 0x52ac :                                    push r10
+  > 0x51a5 :                                    push r9
+  > 0x5189 :                                    push rdx
+  > 0x7d5f :                                    push r8
+  > 0x4505 :                                    push rdi
+  > 0x4745 :                                    push r11
+  > 0x478b :                                    push rax
+  > 0x7a53 :                                    push rbx
+  > 0x500d :                                    push r15
+  */
+  if (!push_regs(rtn)) return false;
+
+  // check for a mov reg, rsp
+  if (!vm::locate::find(rtn, [&](const zydis_instr_t& instr) -> bool {
+        return instr.instr.mnemonic == ZYDIS_MNEMONIC_MOV &&
+               instr.instr.operands[0].type == ZYDIS_OPERAND_TYPE_REGISTER &&
+               instr.instr.operands[1].type == ZYDIS_OPERAND_TYPE_REGISTER &&
+               instr.instr.operands[1].reg.value == ZYDIS_REGISTER_RSP;
+      }))
+    return false;
+
+  // check for a mov reg, [rsp+0x90]
+  if (!vm::locate::find(rtn, [&](const zydis_instr_t& instr) -> bool {
+        return instr.instr.mnemonic == ZYDIS_MNEMONIC_MOV &&
+               instr.instr.operands[0].type == ZYDIS_OPERAND_TYPE_REGISTER &&
+               instr.instr.operands[1].type == ZYDIS_OPERAND_TYPE_MEMORY &&
+               instr.instr.operands[1].mem.base == ZYDIS_REGISTER_RSP &&
+               instr.instr.operands[1].mem.disp.value == 0x90;
+      }))
+    return false;
+
+  // check for invalid instructions... such as INT instructions...
+  if (vm::locate::find(rtn, [&](const zydis_instr_t& instr) -> bool {
+        const auto& i = instr.instr;
+        return i.mnemonic >= ZYDIS_MNEMONIC_INT &&
+               i.mnemonic <= ZYDIS_MNEMONIC_INT3;
+      }))
+    return false;
+
+  // if code execution gets to here then we can assume this is a legit vm
+  // entry...
+  push_val = (std::uint32_t)rtn[0].instr.operands[0].imm.value.u;
+  return true;
+}
+
+// adds a vm entry unless an existing entry already pushes the same encrypted
+// rva...
+static void add(std::vector<vm_enter_t>& entries,
+                std::uint32_t rva,
+                std::uint32_t push_val) {
+  if (std::find_if(entries.begin(), entries.end(),
+                   [&](const vm_enter_t& vm_enter) -> bool {
+                     return vm_enter.encrypted_rva == push_val;
+                   }) != entries.end())
+    return;
+
+  entries.push_back({rva, push_val});
+}
+
+std::vector<vm_enter_t> get_vm_entries(std::uintptr_t module_base,
+                                       std::uint32_t module_size) {
+  std::uintptr_t result = module_base;
+  std::vector<vm_enter_t> entries;
+
+  // only executable sections can hold vm entries, so only those have to be
+  // relocated up front if the image is relocated lazily...
+  const auto win_image = reinterpret_cast<win::image_t<>*>(module_base);
+  const auto sections = win_image->get_nt_headers()->get_sections();
+  for (auto idx = 0u; idx < win_image->get_file_header()->num_sections; ++idx)
+    if (sections[idx].characteristics.mem_execute)
+      vm::image_t::touch(module_base + sections[idx].virtual_address,
+                         sections[idx].virtual_size);
+
+  const auto reader = [&](std::uintptr_t addr,
+                          std::size_t& size) -> const std::uint8_t* {
+    if (!vm::utils::scn::executable(module_base, addr))
+      return nullptr;
+
+    size = 0x1000;
+    return reinterpret_cast<const std::uint8_t*>(addr);
+  };
+
   do {
     result = sigscan((void*)++result, module_size - (result - module_base),
                      PUSH_4B_IMM, PUSH_4B_MASK);
 
-    zydis_rtn_t rtn;
+    std::uint32_t push_val = 0u;
     if (!vm::utils::scn::executable(module_base, result)) continue;
+    if (check(result, reader, push_val))
+      add(entries, result - module_base, push_val);
+  } while (result);
+  return entries;
+}
+
+// the same sections of a raw PE file vm::utils::scn::executable accepts, in
+// address order...
+static std::vector<const win::section_header_t*> code_sections(
+    const vm::file_t& file) {
+  const auto data = file.data();
+  if (!vm::utils::valid_pe(data, file.size()))
+    return {};
+
+  // the headers are laid out the same in the file as they are in the image...
+  const auto img = reinterpret_cast<const win::image_t<>*>(data);
+  const auto nt_headers = img->get_nt_headers();
+  const auto num_sections = nt_headers->file_header.num_sections;
+  const auto sections = nt_headers->get_sections();
+
+  std::vector<const win::section_header_t*> code;
+  for (auto idx = 0u; idx < num_sections; ++idx)
+    if (sections[idx].characteristics.mem_execute &&
+        !sections[idx].characteristics.mem_discardable)
+      code.push_back(&sections[idx]);
+
+  std::sort(code.begin(), code.end(),
+            [](const win::section_header_t* a, const win::section_header_t* b) {
+              return a->virtual_address < b->virtual_address;
+            });
+  return code;
+}
 
-    // Make sure that the form of the vmenter is a jmp immediately followed by a call imm
-    ZydisDecodedInstruction after_push;
-    if (ZYAN_SUCCESS(ZydisDecoderDecodeBuffer(vm::utils::g_decoder.get(), 
-                          (void*)(result + 5), 5, &after_push)))
-    {
-      if (after_push.mnemonic != ZYDIS_MNEMONIC_CALL ||
-        after_push.operands[0].type != ZYDIS_OPERAND_TYPE_IMMEDIATE)
+std::vector<vm_enter_t> get_vm_entries(const vm::file_t& file) {
+  const auto data = file.data();
+  const auto file_size = file.size();
+  const auto code = code_sections(file);
+
+  // addresses are rvas, translated to file offsets through the section table.
+  // only raw data backs an rva, the zero filled tail of a section does not...
+  const auto reader = [&](std::uintptr_t rva,
+                          std::size_t& size) -> const std::uint8_t* {
+    for (const auto section : code) {
+      if (rva < section->virtual_address ||
+          rva >= section->virtual_address + section->virtual_size)
         continue;
+
+      const auto delta = rva - section->virtual_address;
+      const auto offset = section->ptr_raw_data + delta;
+      if (delta >= section->size_raw_data || offset >= file_size)
+        return nullptr;
+
+      size = std::min<std::size_t>(section->size_raw_data - delta,
+                                   file_size - offset);
+      return data + offset;
     }
-    else
+    return nullptr;
+  };
+
+  std::vector<vm_enter_t> entries;
+  for (const auto section : code) {
+    if (section->ptr_raw_data >= file_size)
       continue;
 
-    if (!vm::utils::flatten(rtn, result, false, 500, module_base)) continue;
+    const auto size = std::min<std::size_t>(
+        {section->virtual_size, section->size_raw_data,
+         file_size - section->ptr_raw_data});
 
-    // the last instruction in the stream should be a JMP to a register or a
-    // return instruction...
-    const auto& last_instr = rtn[rtn.size() - 1];
-    if (!((last_instr.instr.mnemonic == ZYDIS_MNEMONIC_JMP &&
-           last_instr.instr.operands[0].type == ZYDIS_OPERAND_TYPE_REGISTER) ||
-          last_instr.instr.mnemonic == ZYDIS_MNEMONIC_RET))
-      continue;
+    const auto raw = data + section->ptr_raw_data;
+    for (auto idx = 0u; idx < size; ++idx) {
+      if (raw[idx] != static_cast<std::uint8_t>(PUSH_4B_IMM[0]))
+        continue;
 
-    std::uint8_t num_pushs = 0u;
-    std::for_each(rtn.begin(), rtn.end(), [&](const zydis_instr_t& instr) {
-      if (instr.instr.mnemonic == ZYDIS_MNEMONIC_PUSH &&
-          instr.instr.operands[0].type == ZYDIS_OPERAND_TYPE_IMMEDIATE)
-        ++num_pushs;
-    });
-
-    /*
-    only one legit imm pushes for every vm entry...
-    > 0x822c :                                    push 0xFFFFFFFF890001FA <---
-    > 0x7fc9 :                                    call xxxxx
-    > 0x48e4 :                                    push r13
-    > 0x4690 :                                    push rsi
-    > 0x4e53 :                                    push r14
-    > 0x74fb :                                    push rcx
-    > 0x607c :                                    push rsp
-    > 0x4926 :                                    pushfq
-    > 0x4dc2 :                                    push rbp
-    > 0x5c8c :                                    push r12
-    > 0x52ac :                                    push r10
-    > 0x51a5 :                                    push r9
-    > 0x5189 :                                    push rdx
-    > 0x7d5f :                                    push r8
-    > 0x4505 :                                    push rdi
-    > 0x4745 :                                    push r11
-    > 0x478b :                                    push rax
-    > 0x7a53 :                                    push rbx
-    > 0x500d :                                    push r15
-    */
-    if (num_pushs != 1) continue;
-
-    // check for a pushfq...
-    // > 0x4926 :                                    pushfq <---
-    if (!vm::locate::find(rtn, [&](const zydis_instr_t& instr) -> bool {
-          return instr.instr.mnemonic == ZYDIS_MNEMONIC_PUSHFQ;
-        }))
-      continue;
+      std::uint32_t push_val = 0u;
+      const auto rva = section->virtual_address + idx;
+      if (check(rva, reader, push_val))
+        add(entries, rva, push_val);
+    }
+  }
+  return entries;
+}
 
-    /*
-    check to see if we push all of these registers...
-    > 0x48e4 :                                    push r13
-    > 0x4690 :                                    push rsi
-    > 0x4e53 :                                    push r14
-    > 0x74fb :                                    push rcx
-    > 0x607c :                                    push rsp
-    > 0x4926 :                                    pushfq
-    > 0x4dc2 :                                    push rbp
-    > 0x5c8c :                                    push r12
-    > 0x52ac :                                    push r10
-    > 0x51a5 :                                    push r9
-    > 0x5189 :                                    push rdx
-    > 0x7d5f :                                    push r8
-    > 0x4505 :                                    push rdi
-    > 0x4745 :                                    push r11
-    > 0x478b :                                    push rax
-    > 0x7a53 :                                    push rbx
-    > 0x500d :                                    push r15
-    */
-    if (!push_regs(rtn)) continue;
-
-    // check for a mov reg, rsp
-    if (!vm::locate::find(rtn, [&](const zydis_instr_t& instr) -> bool {
-          return instr.instr.mnemonic == ZYDIS_MNEMONIC_MOV &&
-                 instr.instr.operands[0].type == ZYDIS_OPERAND_TYPE_REGISTER &&
-                 instr.instr.operands[1].type == ZYDIS_OPERAND_TYPE_REGISTER &&
-                 instr.instr.operands[1].reg.value == ZYDIS_REGISTER_RSP;
-        }))
-      continue;
+// on disk layout of a cached vm entry list... a header followed by the vm
+// entries in the order the scan found them.
+struct cache_header_t {
+  std::uint32_t magic;
+  std::uint32_t version;
+  std::uint64_t hash;
+  std::uint64_t entry_cnt;
+};
 
-    // check for a mov reg, [rsp+0x90]
-    if (!vm::locate::find(rtn, [&](const zydis_instr_t& instr) -> bool {
-          return instr.instr.mnemonic == ZYDIS_MNEMONIC_MOV &&
-                 instr.instr.operands[0].type == ZYDIS_OPERAND_TYPE_REGISTER &&
-                 instr.instr.operands[1].type == ZYDIS_OPERAND_TYPE_MEMORY &&
-                 instr.instr.operands[1].mem.base == ZYDIS_REGISTER_RSP &&
-                 instr.instr.operands[1].mem.disp.value == 0x90;
-        }))
-      continue;
+static_assert(sizeof(cache_header_t) == 24u && sizeof(vm_enter_t) == 8u);
 
-    // check for invalid instructions... such as INT instructions...
-    if (vm::locate::find(rtn, [&](const zydis_instr_t& instr) -> bool {
-          const auto& i = instr.instr;
-          return i.mnemonic >= ZYDIS_MNEMONIC_INT &&
-                 i.mnemonic <= ZYDIS_MNEMONIC_INT3;
-        }))
-      continue;
+// hashes size bytes into four independent lanes, 32 bytes at a time, so the
+// multiplies of one lane do not have to wait on the others...
+static void digest(std::uint64_t (&lanes)[4],
+                   const std::uint8_t* data,
+                   std::size_t size) {
+  static const auto round = [](std::uint64_t lane, std::uint64_t value) {
+    lane += value * 0xC2B2AE3D27D4EB4Full;
+    lane = lane << 31 | lane >> 33;
+    return lane * 0x9E3779B97F4A7C15ull;
+  };
 
-    // if code execution gets to here then we can assume this is a legit vm
-    // entry... its time to build a vm_enter_t... first we check to see if an
-    // existing entry already exits...
+  std::size_t idx = 0u;
+  for (; idx + 32u <= size; idx += 32u)
+    for (auto lane = 0u; lane < 4u; ++lane) {
+      std::uint64_t value;
+      std::memcpy(&value, data + idx + lane * 8u, sizeof value);
+      lanes[lane] = round(lanes[lane], value);
+    }
 
-    auto push_val = (std::uint32_t)rtn[0].instr.operands[0].imm.value.u;
-    if (std::find_if(entries.begin(), entries.end(),
-                     [&](const vm_enter_t& vm_enter) -> bool {
-                       return vm_enter.encrypted_rva == push_val;
-                     }) != entries.end())
+  // the tail is padded with zeros, the size goes in as well so that padding
+  // never collides with real zeros...
+  std::uint8_t tail[32] = {};
+  std::memcpy(tail, data + idx, size - idx);
+  for (auto lane = 0u; lane < 4u; ++lane) {
+    std::uint64_t value;
+    std::memcpy(&value, tail + lane * 8u, sizeof value);
+    lanes[lane] = round(lanes[lane], value ^ size);
+  }
+}
+
+std::uint64_t hash(const vm::file_t& file) {
+  std::uint64_t lanes[4] = {0x60EA27EEADC0B5D6ull, 0xC2B2AE3D27D4EB4Full,
+                            0x0ull, 0x61C8864E7A143579ull};
+
+  // vm entries are rvas, so where each section goes counts as much as its
+  // bytes do...
+  for (const auto section : code_sections(file)) {
+    const std::uint32_t layout[] = {section->virtual_address,
+                                    section->virtual_size,
+                                    section->size_raw_data};
+    digest(lanes, reinterpret_cast<const std::uint8_t*>(layout),
+           sizeof layout);
+
+    if (section->ptr_raw_data >= file.size())
       continue;
 
-    vm_enter_t entry{(std::uint32_t)(result - module_base), push_val};
-    entries.push_back(entry);
-  } while (result);
+    digest(lanes, file.data() + section->ptr_raw_data,
+           std::min<std::size_t>(section->size_raw_data,
+                                 file.size() - section->ptr_raw_data));
+  }
+
+  std::uint64_t result = 0u;
+  for (const auto lane : lanes)
+    result = (result ^ lane) * 0x100000001B3ull;
+  return result ^ result >> 29;
+}
+
+std::vector<vm_enter_t> get_vm_entries(const vm::file_t& file,
+                                       const std::string& cache,
+                                       bool* hit) {
+  const auto key = hash(file);
+  char name[32];
+  std::snprintf(name, sizeof name, "%016llx.vmenter",
+                static_cast<unsigned long long>(key));
+  const auto path = (std::filesystem::path(cache) / name).string();
+
+  if (hit)
+    *hit = false;
+
+  // anything which does not look exactly like the cached vm entries of this
+  // file is scanned for again and overwritten...
+  if (std::ifstream in(path, std::ios::binary | std::ios::ate); in) {
+    const auto size = static_cast<std::uint64_t>(in.tellg());
+    in.seekg(0, std::ios::beg);
+
+    cache_header_t header;
+    if (size >= sizeof header &&
+        in.read(reinterpret_cast<char*>(&header), sizeof header) &&
+        header.magic == VMLOCATE_CACHE_MAGIC &&
+        header.version == VMLOCATE_VERSION && header.hash == key &&
+        header.entry_cnt == (size - sizeof header) / sizeof(vm_enter_t) &&
+        !((size - sizeof header) % sizeof(vm_enter_t))) {
+      std::vector<vm_enter_t> entries(header.entry_cnt);
+      if (in.read(reinterpret_cast<char*>(entries.data()),
+                  entries.size() * sizeof(vm_enter_t))) {
+        if (hit)
+          *hit = true;
+        return entries;
+      }
+    }
+  }
+
+  const auto entries = get_vm_entries(file);
+
+  // written under a name of its own first and then renamed over the cached
+  // vm entries, so jobs scanning the same file at once never read half of
+  // one... the process id and a counter keep the names of concurrent jobs and
+  // threads apart. failing to write the cache is not an error.
+  static std::atomic<std::uint32_t> next = 0u;
+#if defined(_WIN32)
+  const auto pid = GetCurrentProcessId();
+#else
+  const auto pid = getpid();
+#endif
+  const auto tmp = path + "." + std::to_string(pid) + "-" +
+                   std::to_string(next++) + ".tmp";
+
+  std::error_code err;
+  std::filesystem::create_directories(cache, err);
+  {
+    std::ofstream out(tmp, std::ios::binary | std::ios::trunc);
+    const cache_header_t header{VMLOCATE_CACHE_MAGIC, VMLOCATE_VERSION, key,
+                                entries.size()};
+    out.write(reinterpret_cast<const char*>(&header), sizeof header);
+    out.write(reinterpret_cast<const char*>(entries.data()),
+              entries.size() * sizeof(vm_enter_t));
+    if (!out.flush()) {
+      out.close();
+      std::filesystem::remove(tmp, err);
+      return entries;
+    }
+  }
+
+  std::filesystem::rename(tmp, path, err);
+  if (err)
+    std::filesystem::remove(tmp, err);
   return entries;
 }
-}  // namespace vm::locate
\ No newline at end of file
+}  // namespace vm::locate
@@ -0,0 +1,29 @@
+#include <vmmem.hpp>
+
+namespace vm::mem {
+arena_t::arena_t()
+    : m_arena(VMMEM_ARENA_CHUNK, std::pmr::new_delete_resource()) {}
+
+void* arena_t::do_allocate(std::size_t bytes, std::size_t align) {
+  std::lock_guard<std::mutex> lock(m_lock);
+  return m_arena.allocate(bytes, align);
+}
+
+void arena_t::do_deallocate(void*, std::size_t, std::size_t) {
+  // everything goes at once when the arena is destroyed...
+}
+
+bool arena_t::do_is_equal(const std::pmr::memory_resource& other) const
+    noexcept {
+  return this == &other;
+}
+
+std::shared_ptr<std::pmr::memory_resource> make(policy_t policy) {
+  if (policy == policy_t::arena)
+    return std::make_shared<arena_t>();
+
+  // owns nothing, the heap outlives everything...
+  return std::shared_ptr<std::pmr::memory_resource>(
+      std::shared_ptr<void>{}, std::pmr::new_delete_resource());
+}
+}  // namespace vm::mem
@@ -0,0 +1,40 @@
+#include <vmpacked.hpp>
+
+namespace vm::instrs {
+packed_vinstrs_t::packed_vinstrs_t(std::pmr::memory_resource* resource)
+    : m_mnemonics(resource),
+      m_stack_sizes(resource),
+      m_imm_sizes(resource),
+      m_imms(resource) {}
+
+void packed_vinstrs_t::push_back(const vinstr_t& vinstr) {
+  m_mnemonics.push_back(vinstr.mnemonic);
+  m_stack_sizes.push_back(vinstr.stack_size);
+
+  if (!vinstr.imm.has_imm) {
+    m_imm_sizes.push_back(0u);
+    return;
+  }
+
+  m_imm_sizes.push_back(VM_PACKED_HAS_IMM | vinstr.imm.size);
+  m_imms.push_back(vinstr.imm.val);
+}
+
+void packed_vinstrs_t::reserve(std::size_t size) {
+  m_mnemonics.reserve(size);
+  m_stack_sizes.reserve(size);
+  m_imm_sizes.reserve(size);
+}
+
+void packed_vinstrs_t::clear() {
+  m_mnemonics.clear();
+  m_stack_sizes.clear();
+  m_imm_sizes.clear();
+  m_imms.clear();
+}
+
+std::size_t packed_vinstrs_t::bytes() const {
+  return m_mnemonics.size() * sizeof(mnemonic_t) + m_stack_sizes.size() +
+         m_imm_sizes.size() + m_imms.size() * sizeof(u64);
+}
+}  // namespace vm::instrs
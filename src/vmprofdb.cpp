@@ -0,0 +1,204 @@
+#include <vmprofdb.hpp>
+#include <vmutils.hpp>
+
+#include <algorithm>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+
+namespace vm::profdb {
+// 64 bit FNV-1a...
+static std::uint64_t fnv(std::uint64_t hash,
+                         const std::uint8_t* data,
+                         std::size_t size) {
+  for (auto idx = 0u; idx < size; ++idx)
+    hash = (hash ^ data[idx]) * 0x100000001B3ull;
+  return hash;
+}
+
+db_t::db_t(const std::string& path)
+    : m_path(path), m_lookups(0u), m_hits(0u), m_inserted(0u) {}
+
+std::unique_ptr<db_t> db_t::open(const std::string& path) {
+  std::unique_ptr<db_t> db(new db_t(path));
+  std::ifstream file(path, std::ios::binary | std::ios::ate);
+  if (!file)
+    return db;
+
+  const auto size = static_cast<std::uint64_t>(file.tellg());
+  file.seekg(0, std::ios::beg);
+
+  header_t header;
+  if (size < sizeof header ||
+      !file.read(reinterpret_cast<char*>(&header), sizeof header) ||
+      header.magic != VMPROFDB_MAGIC || header.version != VMPROFDB_VERSION ||
+      header.record_cnt != (size - sizeof header) / sizeof(record_t))
+    return {};
+
+  std::vector<record_t> records(header.record_cnt);
+  if (!file.read(reinterpret_cast<char*>(records.data()),
+                 records.size() * sizeof(record_t)))
+    return {};
+
+  for (const auto& record : records)
+    db->m_records.insert({record.key, record});
+  return db;
+}
+
+bool db_t::save() {
+  std::vector<record_t> records;
+  {
+    std::lock_guard<std::mutex> lock(m_lock);
+    records.reserve(m_records.size());
+    for (const auto& [key, record] : m_records)
+      records.push_back(record);
+  }
+
+  // written next to the database first so that a failed save leaves the old
+  // one as it was...
+  const auto tmp = m_path + ".tmp";
+  {
+    std::ofstream file(tmp, std::ios::binary | std::ios::trunc);
+    const header_t header{VMPROFDB_MAGIC, VMPROFDB_VERSION, records.size()};
+    file.write(reinterpret_cast<const char*>(&header), sizeof header);
+    file.write(reinterpret_cast<const char*>(records.data()),
+               records.size() * sizeof(record_t));
+    if (!file.flush())
+      return false;
+  }
+
+  std::error_code err;
+  std::filesystem::rename(tmp, m_path, err);
+  return !err;
+}
+
+std::shared_ptr<const db_t::handler_t> db_t::handler(std::uintptr_t rip) {
+  {
+    std::lock_guard<std::mutex> lock(m_lock);
+    if (const auto itr = m_handlers.find(rip); itr != m_handlers.end())
+      return itr->second;
+  }
+
+  // the JMPs are kept, they are executed like every other instruction...
+  zydis_rtn_t rtn;
+  std::shared_ptr<handler_t> result;
+  if (vm::utils::flatten(rtn, rip, true, VMPROFDB_MAX_INSTRS) &&
+      !rtn.empty() && rtn.back().instr.mnemonic == ZYDIS_MNEMONIC_JMP &&
+      rtn.back().instr.operands[0].type == ZYDIS_OPERAND_TYPE_REGISTER) {
+    result = std::make_shared<handler_t>();
+
+    // ...and then left out again the same way flatten would have, before
+    // deobfuscating...
+    zydis_rtn_t kept;
+    for (const auto& instr : rtn) {
+      const auto& i = instr.instr;
+      const auto branch =
+          vm::utils::is_jmp(i) || i.mnemonic == ZYDIS_MNEMONIC_CALL;
+      if (!branch || i.operands[0].type == ZYDIS_OPERAND_TYPE_REGISTER)
+        kept.push_back(instr);
+      result->path.push_back(instr.addr);
+    }
+
+    vm::utils::deobfuscate(kept);
+    result->hash = 0xCBF29CE484222325ull;
+    for (const auto& [instr, raw, addr] : kept) {
+      const auto idx =
+          std::find(result->path.begin(), result->path.end(), addr) -
+          result->path.begin();
+      result->deobfuscated.push_back(idx);
+      result->hash = fnv(result->hash, raw.data(), raw.size());
+    }
+  }
+
+  std::lock_guard<std::mutex> lock(m_lock);
+  return m_handlers.insert({rip, result}).first->second;
+}
+
+bool db_t::find(std::uintptr_t rip,
+                zydis_reg_t vip,
+                zydis_reg_t vsp,
+                record_t& record,
+                site_t& site) {
+  ++m_lookups;
+  const auto handler = this->handler(rip);
+  if (!handler)
+    return false;
+
+  const key_t key{handler->hash, static_cast<std::uint16_t>(vip),
+                  static_cast<std::uint16_t>(vsp), 0u};
+  {
+    std::lock_guard<std::mutex> lock(m_lock);
+    const auto itr = m_records.find(key);
+    if (itr == m_records.end())
+      return false;
+    record = itr->second;
+  }
+
+  if (record.has_imm && record.imm_idx >= handler->deobfuscated.size())
+    return false;
+
+  site.jmp = handler->path.back();
+  site.executed = handler->path.size();
+  site.imm_at = record.has_imm ? handler->deobfuscated[record.imm_idx] : 0u;
+  ++m_hits;
+  return true;
+}
+
+void db_t::insert(std::uintptr_t rip,
+                  zydis_reg_t vip,
+                  zydis_reg_t vsp,
+                  const vm::instrs::vinstr_t& vinstr,
+                  const vm::instrs::hndlr_trace_t& hndlr,
+                  std::uint32_t executed) {
+  if (vinstr.mnemonic == vm::instrs::mnemonic_t::unknown ||
+      vinstr.mnemonic == vm::instrs::mnemonic_t::vmexit ||
+      (vinstr.imm.has_imm && hndlr.m_imm.reg == ZYDIS_REGISTER_NONE))
+    return;
+
+  // the trace only lines up with the flattened handler if nothing branched
+  // off of it...
+  const auto handler = this->handler(rip);
+  if (!handler || handler->path.size() != executed)
+    return;
+
+  record_t record;
+  std::memset(&record, 0, sizeof record);
+  record.key = {handler->hash, static_cast<std::uint16_t>(vip),
+                static_cast<std::uint16_t>(vsp), 0u};
+  record.vip = hndlr.m_vip;
+  record.vsp = hndlr.m_vsp;
+  record.mnemonic = static_cast<std::uint8_t>(vinstr.mnemonic);
+  record.stack_size = vinstr.stack_size;
+  record.has_imm = vinstr.imm.has_imm;
+  record.imm_size = vinstr.imm.size;
+
+  if (vinstr.imm.has_imm) {
+    const auto& deobfuscated = handler->deobfuscated;
+    const auto itr =
+        std::find(deobfuscated.begin(), deobfuscated.end(), hndlr.m_imm.idx);
+    if (itr == deobfuscated.end())
+      return;
+
+    record.imm_idx = itr - deobfuscated.begin();
+    record.imm_reg = hndlr.m_imm.reg;
+  }
+
+  std::lock_guard<std::mutex> lock(m_lock);
+  if (m_records.insert({record.key, record}).second)
+    ++m_inserted;
+}
+
+void db_t::forget() {
+  std::lock_guard<std::mutex> lock(m_lock);
+  m_handlers.clear();
+}
+
+db_t::stats_t db_t::stats() const {
+  return {m_lookups.load(), m_hits.load(), m_inserted.load()};
+}
+
+std::size_t db_t::size() {
+  std::lock_guard<std::mutex> lock(m_lock);
+  return m_records.size();
+}
+}  // namespace vm::profdb
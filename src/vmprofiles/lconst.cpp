@@ -51,12 +51,14 @@ profiler_t lconst = {
       uc_context* backup;
       uc_context_alloc(hndlr.m_uc, &backup);
       uc_context_save(hndlr.m_uc, backup);
-      uc_context_restore(hndlr.m_uc, mov_vsp_imm->m_cpu);
+      uc_context_restore(hndlr.m_uc, get_cpu(hndlr, *mov_vsp_imm));
 
       const uc_x86_reg imm_reg =
-          vm::instrs::reg_map[mov_vsp_imm->m_instr.operands[1].reg.value];
+          vm::instrs::uc_reg(mov_vsp_imm->m_instr.operands[1].reg.value);
 
       uc_reg_read(hndlr.m_uc, imm_reg, &res.imm.val);
+      hndlr.m_imm = {mov_vsp_imm->m_idx,
+                     mov_vsp_imm->m_instr.operands[1].reg.value};
 
       res.imm.val <<= (64 - res.imm.size);
       res.imm.val >>= (64 - res.imm.size);
@@ -52,12 +52,14 @@ profiler_t lreg = {
       uc_context* backup;
       uc_context_alloc(hndlr.m_uc, &backup);
       uc_context_save(hndlr.m_uc, backup);
-      uc_context_restore(hndlr.m_uc, mov_reg_vreg->m_cpu);
+      uc_context_restore(hndlr.m_uc, get_cpu(hndlr, *mov_reg_vreg));
 
       const uc_x86_reg idx_reg =
-          vm::instrs::reg_map[mov_reg_vreg->m_instr.operands[1].mem.index];
+          vm::instrs::uc_reg(mov_reg_vreg->m_instr.operands[1].mem.index);
 
       uc_reg_read(hndlr.m_uc, idx_reg, &res.imm.val);
+      hndlr.m_imm = {mov_reg_vreg->m_idx,
+                     mov_reg_vreg->m_instr.operands[1].mem.index};
 
       res.imm.val <<= (64 - res.imm.size);
       res.imm.val >>= (64 - res.imm.size);
@@ -57,12 +57,14 @@ profiler_t sreg = {
       uc_context* backup;
       uc_context_alloc(hndlr.m_uc, &backup);
       uc_context_save(hndlr.m_uc, backup);
-      uc_context_restore(hndlr.m_uc, mov_vreg_value->m_cpu);
+      uc_context_restore(hndlr.m_uc, get_cpu(hndlr, *mov_vreg_value));
 
       const uc_x86_reg idx_reg =
-          vm::instrs::reg_map[mov_vreg_value->m_instr.operands[0].mem.index];
+          vm::instrs::uc_reg(mov_vreg_value->m_instr.operands[0].mem.index);
 
       uc_reg_read(hndlr.m_uc, idx_reg, &res.imm.val);
+      hndlr.m_imm = {mov_vreg_value->m_idx,
+                     mov_vreg_value->m_instr.operands[0].mem.index};
 
       res.imm.val <<= (64 - res.imm.size);
       res.imm.val >>= (64 - res.imm.size);
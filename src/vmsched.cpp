@@ -0,0 +1,177 @@
+#include <vmsched.hpp>
+
+#include <algorithm>
+#include <chrono>
+#include <iterator>
+
+namespace vm::sched {
+// the scheduler and worker index of the calling thread, if it is a worker...
+static thread_local const scheduler_t* t_scheduler = nullptr;
+static thread_local std::uint32_t t_worker = 0u;
+
+// number of tasks the calling thread is running inline from wait()...
+static thread_local std::uint32_t t_depth = 0u;
+
+scheduler_t::scheduler_t(std::uint32_t threads)
+    : m_queued(0u), m_next(0u), m_stop(false) {
+  if (!threads)
+    threads = std::max(std::thread::hardware_concurrency(), 1u);
+
+  for (auto idx = 0u; idx < threads; ++idx)
+    m_workers.push_back(std::make_unique<worker_t>());
+
+  for (auto idx = 0u; idx < threads; ++idx)
+    m_threads.emplace_back([this, idx]() { run(idx); });
+}
+
+scheduler_t::~scheduler_t() {
+  {
+    std::lock_guard<std::mutex> lock(m_lock);
+    m_stop = true;
+  }
+
+  m_wake.notify_all();
+  for (auto& thread : m_threads)
+    thread.join();
+}
+
+std::uint32_t scheduler_t::current() const {
+  return t_scheduler == this ? t_worker : size();
+}
+
+void scheduler_t::spawn(group_t& group, task_t task) {
+  auto idx = current();
+  if (idx == size())
+    idx = m_next++ % size();
+
+  ++group.m_pending;
+
+  // counted before it is queued so that m_queued is never less than the number
+  // of queued jobs... the lock makes sure a worker which just found nothing is
+  // either already waiting (and gets notified) or has not checked it yet.
+  {
+    std::lock_guard<std::mutex> lock(m_lock);
+    ++m_queued;
+  }
+
+  {
+    std::lock_guard<std::mutex> lock(m_workers[idx]->lock);
+    m_workers[idx]->jobs.push_back({std::move(task), &group});
+  }
+  m_wake.notify_one();
+}
+
+bool scheduler_t::pop(std::uint32_t idx, job_t& job) {
+  auto& worker = *m_workers[idx];
+  std::lock_guard<std::mutex> lock(worker.lock);
+  if (worker.jobs.empty())
+    return false;
+
+  job = std::move(worker.jobs.back());
+  worker.jobs.pop_back();
+  return true;
+}
+
+bool scheduler_t::steal(std::uint32_t idx, job_t& job) {
+  // start with the next worker over so that thieves spread out...
+  for (auto offset = 1u; offset <= size(); ++offset) {
+    auto& victim = *m_workers[(idx + offset) % size()];
+    std::lock_guard<std::mutex> lock(victim.lock);
+    if (victim.jobs.empty())
+      continue;
+
+    job = std::move(victim.jobs.front());
+    victim.jobs.pop_front();
+    return true;
+  }
+  return false;
+}
+
+bool scheduler_t::take(std::uint32_t idx, const group_t& group, job_t& job) {
+  // own deque first and newest first, same order as pop/steal...
+  for (auto offset = 0u; offset < size(); ++offset) {
+    auto& worker = *m_workers[(idx + offset) % size()];
+    std::lock_guard<std::mutex> lock(worker.lock);
+    const auto itr = std::find_if(
+        worker.jobs.rbegin(), worker.jobs.rend(),
+        [&](const job_t& queued) -> bool { return queued.group == &group; });
+
+    if (itr == worker.jobs.rend())
+      continue;
+
+    job = std::move(*itr);
+    worker.jobs.erase(std::next(itr).base());
+    --m_queued;
+    return true;
+  }
+  return false;
+}
+
+bool scheduler_t::find(std::uint32_t idx, job_t& job) {
+  if ((idx < size() && pop(idx, job)) || steal(idx, job)) {
+    --m_queued;
+    return true;
+  }
+  return false;
+}
+
+void scheduler_t::execute(job_t& job) {
+  job.task();
+  if (--job.group->m_pending)
+    return;
+
+  // whoever waits on the group may be asleep... taking the lock makes sure it
+  // either sees the group done or is already waiting and gets notified.
+  {
+    std::lock_guard<std::mutex> lock(m_lock);
+  }
+  m_wake.notify_all();
+}
+
+void scheduler_t::run(std::uint32_t idx) {
+  t_scheduler = this;
+  t_worker = idx;
+
+  job_t job;
+  while (true) {
+    if (find(idx, job)) {
+      execute(job);
+      continue;
+    }
+
+    std::unique_lock<std::mutex> lock(m_lock);
+    m_wake.wait(lock, [&]() -> bool { return m_stop || m_queued.load(); });
+    if (m_stop)
+      return;
+  }
+}
+
+void scheduler_t::wait(group_t& group) {
+  const auto idx = current();
+  job_t job;
+  while (group.pending()) {
+    // past the nesting limit only tasks of this group are run inline, unrelated
+    // tasks could wait on groups of their own and recurse without bound...
+    const auto nested = t_depth >= VM_SCHED_MAX_DEPTH;
+    if (nested ? take(idx % size(), group, job) : find(idx, job)) {
+      ++t_depth;
+      execute(job);
+      --t_depth;
+      continue;
+    }
+
+    // nothing to run, the rest of the group is running elsewhere... when
+    // nested, queued jobs may all belong to other groups so poll instead.
+    std::unique_lock<std::mutex> lock(m_lock);
+    if (nested) {
+      m_wake.wait_for(lock, std::chrono::milliseconds(1),
+                      [&]() -> bool { return !group.pending(); });
+      continue;
+    }
+
+    m_wake.wait(lock, [&]() -> bool {
+      return m_queued.load() || !group.pending();
+    });
+  }
+}
+}  // namespace vm::sched
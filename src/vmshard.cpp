@@ -0,0 +1,102 @@
+#include <vmshard.hpp>
+#include <vmstore.hpp>
+
+#include <algorithm>
+#include <map>
+
+namespace vm::shard {
+std::vector<vm::locate::vm_enter_t> select(
+    const std::vector<vm::locate::vm_enter_t>& entries,
+    std::uint32_t idx,
+    std::uint32_t count) {
+  std::vector<vm::locate::vm_enter_t> selected;
+  for (const auto& entry : entries) {
+    // vm entries are often spaced evenly, mix the rva before taking it mod
+    // count so the shards are about the same size...
+    const auto hash = static_cast<std::uint32_t>(
+        (static_cast<std::uint64_t>(entry.rva) * 0x9E3779B97F4A7C15ull) >> 32);
+    if (hash % count == idx)
+      selected.push_back(entry);
+  }
+  return selected;
+}
+
+bool write(const std::string& path, std::vector<module_t>& modules) {
+  std::sort(modules.begin(), modules.end(),
+            [](const module_t& a, const module_t& b) {
+              return a.name < b.name;
+            });
+
+  const auto writer = vm::store::writer_t::open(path);
+  if (!writer)
+    return false;
+
+  for (auto& module : modules) {
+    std::sort(module.vrtns.begin(), module.vrtns.end(),
+              [](const vm::instrs::vrtn_t& a, const vm::instrs::vrtn_t& b) {
+                return a.m_rva < b.m_rva;
+              });
+
+    writer->begin(module.name);
+    for (const auto& vrtn : module.vrtns)
+      writer->add(vrtn, module.module_base);
+  }
+  return writer->finish();
+}
+
+bool read(const std::string& path, std::vector<module_t>& modules) {
+  const auto view = vm::store::view_t::open(path);
+  if (!view)
+    return false;
+
+  modules.resize(view->size());
+  for (auto idx = 0u; idx < view->size(); ++idx) {
+    const auto module = (*view)[idx];
+    modules[idx].name = module.name();
+    modules[idx].vrtns.clear();
+    modules[idx].module_base = 0u;
+    for (auto rtn = 0u; rtn < module.size(); ++rtn) {
+      modules[idx].vrtns.push_back(module[rtn].get());
+
+      // blocks come out image based, any of them gives the image base...
+      if (const auto& blks = modules[idx].vrtns.back().m_blks; !blks.empty())
+        modules[idx].module_base =
+            blks.front().m_vip.img_based - blks.front().m_vip.rva;
+    }
+  }
+  return true;
+}
+
+bool merge(const std::vector<std::string>& shards, const std::string& path) {
+  // routines are copied from one mapping to the other without ever being
+  // turned back into vrtn_t's...
+  std::vector<std::unique_ptr<vm::store::view_t>> views;
+  std::map<std::string, std::map<std::uint32_t, vm::store::rtn_view_t>> merged;
+  for (const auto& shard : shards) {
+    auto view = vm::store::view_t::open(shard);
+    if (!view) {
+      std::printf("[!] failed to read shard %s...\n", shard.c_str());
+      return false;
+    }
+
+    for (auto idx = 0u; idx < view->size(); ++idx) {
+      const auto module = (*view)[idx];
+      auto& rtns = merged[std::string(module.name())];
+      for (auto rtn = 0u; rtn < module.size(); ++rtn)
+        rtns.emplace(module[rtn].rva(), module[rtn]);
+    }
+    views.push_back(std::move(view));
+  }
+
+  const auto writer = vm::store::writer_t::open(path);
+  if (!writer)
+    return false;
+
+  for (const auto& [name, rtns] : merged) {
+    writer->begin(name);
+    for (const auto& [rva, rtn] : rtns)
+      writer->add(rtn);
+  }
+  return writer->finish();
+}
+}  // namespace vm::shard
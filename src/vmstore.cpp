@@ -0,0 +1,256 @@
+#include <vmstore.hpp>
+
+#include <cstring>
+
+namespace vm::store {
+// true if count records of size bytes at offset lie inside the store and are
+// aligned...
+static bool inside(std::size_t size,
+                   std::uint64_t offset,
+                   std::uint64_t count,
+                   std::size_t record) {
+  return !(offset % VMSTORE_ALIGN) && offset <= size &&
+         count <= (size - offset) / record;
+}
+
+std::array<ZydisRegister, 16> blk_view_t::vmexit_pop_order() const {
+  std::array<ZydisRegister, 16> pops;
+  pops.fill(ZYDIS_REGISTER_NONE);
+  for (auto idx = 0u; idx < std::min<std::size_t>(m_blk->pop_cnt, 16u); ++idx)
+    pops[idx] = static_cast<ZydisRegister>(m_blk->pops[idx]);
+  return pops;
+}
+
+std::span<const vm::instrs::vinstr_t> blk_view_t::vinstrs() const {
+  if (!inside(m_size, m_blk->vinstrs, m_blk->vinstr_cnt,
+              sizeof(vm::instrs::vinstr_t)))
+    return {};
+
+  return {reinterpret_cast<const vm::instrs::vinstr_t*>(m_base +
+                                                        m_blk->vinstrs),
+          m_blk->vinstr_cnt};
+}
+
+std::span<const std::uintptr_t> blk_view_t::branches() const {
+  if (!inside(m_size, m_blk->branches, m_blk->branch_cnt,
+              sizeof(std::uintptr_t)))
+    return {};
+
+  return {reinterpret_cast<const std::uintptr_t*>(m_base + m_blk->branches),
+          m_blk->branch_cnt};
+}
+
+vm::instrs::vblk_t blk_view_t::get() const {
+  vm::instrs::vblk_t blk{};
+  blk.is_branch = is_branch();
+  blk.m_vip = {vip().rva, vip().img_based};
+  blk.m_vm = {vm().vip, vm().vsp};
+  blk.m_jmp.m_vm = {jmp().vm.vip, jmp().vm.vsp};
+  blk.m_jmp.rip = jmp().img_based;
+  blk.vmexit_pop_order = vmexit_pop_order();
+  blk.branch_type = branch_type();
+
+  const auto vinstrs = this->vinstrs();
+  const auto branches = this->branches();
+  blk.m_vinstrs.assign(vinstrs.begin(), vinstrs.end());
+  blk.branches.assign(branches.begin(), branches.end());
+  return blk;
+}
+
+vm::instrs::vrtn_t rtn_view_t::get() const {
+  vm::instrs::vrtn_t vrtn{rva(), {}};
+  vrtn.m_blks.reserve(size());
+  for (auto idx = 0u; idx < size(); ++idx)
+    vrtn.m_blks.push_back((*this)[idx].get());
+  return vrtn;
+}
+
+view_t::view_t(std::unique_ptr<vm::file_t> file)
+    : m_file(std::move(file)),
+      m_header(reinterpret_cast<const header_t*>(m_file->data())) {}
+
+std::unique_ptr<view_t> view_t::open(const std::string& path) {
+  auto file = vm::file_t::open(path);
+  if (!file || file->size() < sizeof(header_t))
+    return {};
+
+  const auto base = file->data();
+  const auto size = file->size();
+  const auto header = reinterpret_cast<const header_t*>(base);
+  if (header->magic != VMSTORE_MAGIC || header->version != VMSTORE_VERSION ||
+      !header->modules ||
+      !inside(size, header->modules, header->module_cnt, sizeof(module_t)))
+    return {};
+
+  // the tables are checked once here so that views can index them blindly...
+  const auto modules =
+      reinterpret_cast<const module_t*>(base + header->modules);
+  for (auto idx = 0u; idx < header->module_cnt; ++idx) {
+    const auto& module = modules[idx];
+    if (!inside(size, module.name, module.name_size, 1u) ||
+        !inside(size, module.rtns, module.rtn_cnt, sizeof(rtn_t)))
+      return {};
+
+    const auto rtns = reinterpret_cast<const rtn_t*>(base + module.rtns);
+    for (auto rtn = 0u; rtn < module.rtn_cnt; ++rtn)
+      if (!inside(size, rtns[rtn].blks, rtns[rtn].blk_cnt, sizeof(blk_t)))
+        return {};
+  }
+
+  return std::unique_ptr<view_t>(new view_t(std::move(file)));
+}
+
+writer_t::writer_t(std::ofstream&& file)
+    : m_file(std::move(file)), m_offset(0u), m_in_module(false) {}
+
+std::unique_ptr<writer_t> writer_t::open(const std::string& path) {
+  std::ofstream file(path, std::ios::binary | std::ios::trunc);
+  if (!file)
+    return {};
+
+  std::unique_ptr<writer_t> writer(new writer_t(std::move(file)));
+
+  // the header is written again by finish() once the module table exists...
+  const header_t header{VMSTORE_MAGIC, VMSTORE_VERSION, 0u, 0u, 0u};
+  writer->write(&header, sizeof header);
+  return writer;
+}
+
+std::uint64_t writer_t::write(const void* data, std::size_t size) {
+  static const std::uint8_t zeros[VMSTORE_ALIGN] = {};
+  const auto offset = m_offset;
+  m_file.write(reinterpret_cast<const char*>(data), size);
+
+  const auto pad = (VMSTORE_ALIGN - size % VMSTORE_ALIGN) % VMSTORE_ALIGN;
+  m_file.write(reinterpret_cast<const char*>(zeros), pad);
+  m_offset += size + pad;
+  return offset;
+}
+
+void writer_t::begin(const std::string& name) {
+  if (m_in_module)
+    end_module();
+
+  m_name = name;
+  m_in_module = true;
+}
+
+void writer_t::add(blk_t& blk,
+                   std::span<const vm::instrs::vinstr_t> vinstrs,
+                   std::span<const std::uintptr_t> branches) {
+  blk.vinstr_cnt = vinstrs.size();
+  blk.branch_cnt = branches.size();
+  blk.vinstrs = write(vinstrs.data(), vinstrs.size_bytes());
+  blk.branches = write(branches.data(), branches.size_bytes());
+  m_blks.push_back(blk);
+}
+
+void writer_t::add(const vm::instrs::vblk_t& blk,
+                   std::uintptr_t module_base) {
+  blk_t rec;
+  std::memset(&rec, 0, sizeof rec);
+  rec.img_based = blk.m_vip.img_based;
+
+  // the jmp handler is wherever the binary happened to be mapped, which is
+  // different in every process...
+  rec.jmp_img_based =
+      blk.m_jmp.rip - module_base + (blk.m_vip.img_based - blk.m_vip.rva);
+  rec.rva = blk.m_vip.rva;
+  rec.vip = blk.m_vm.vip;
+  rec.vsp = blk.m_vm.vsp;
+  rec.jmp_vip = blk.m_jmp.m_vm.vip;
+  rec.jmp_vsp = blk.m_jmp.m_vm.vsp;
+  rec.branch_type = static_cast<std::uint8_t>(blk.branch_type);
+  rec.is_branch = blk.is_branch;
+
+  // only the registers a vm exit actually pops...
+  for (const auto reg : blk.vmexit_pop_order) {
+    if (reg == ZYDIS_REGISTER_NONE)
+      break;
+    rec.pops[rec.pop_cnt++] = reg;
+  }
+
+  // copied so that the padding inside of every vinstr_t is zero and the same
+  // results always give the same bytes...
+  std::vector<vm::instrs::vinstr_t> vinstrs(blk.m_vinstrs.size());
+  std::memset(vinstrs.data(), 0, vinstrs.size() * sizeof(vinstrs[0]));
+  for (auto idx = 0u; idx < vinstrs.size(); ++idx) {
+    vinstrs[idx].mnemonic = blk.m_vinstrs[idx].mnemonic;
+    vinstrs[idx].stack_size = blk.m_vinstrs[idx].stack_size;
+    vinstrs[idx].imm.has_imm = blk.m_vinstrs[idx].imm.has_imm;
+    vinstrs[idx].imm.size = blk.m_vinstrs[idx].imm.size;
+    vinstrs[idx].imm.val = blk.m_vinstrs[idx].imm.val;
+  }
+
+  add(rec, vinstrs, blk.branches);
+}
+
+void writer_t::add(const blk_view_t& blk) {
+  blk_t rec;
+  std::memset(&rec, 0, sizeof rec);
+  rec.img_based = blk.vip().img_based;
+  rec.jmp_img_based = blk.jmp().img_based;
+  rec.rva = blk.vip().rva;
+  rec.vip = blk.vm().vip;
+  rec.vsp = blk.vm().vsp;
+  rec.jmp_vip = blk.jmp().vm.vip;
+  rec.jmp_vsp = blk.jmp().vm.vsp;
+  rec.branch_type = static_cast<std::uint8_t>(blk.branch_type());
+  rec.is_branch = blk.is_branch();
+
+  for (const auto reg : blk.vmexit_pop_order()) {
+    if (reg == ZYDIS_REGISTER_NONE)
+      break;
+    rec.pops[rec.pop_cnt++] = reg;
+  }
+
+  // already laid out the way they are stored...
+  add(rec, blk.vinstrs(), blk.branches());
+}
+
+void writer_t::end(std::uint32_t rva) {
+  rtn_t rtn{0u, rva, static_cast<std::uint32_t>(m_blks.size())};
+  rtn.blks = write(m_blks.data(), m_blks.size() * sizeof(blk_t));
+  m_rtns.push_back(rtn);
+  m_blks.clear();
+}
+
+void writer_t::add(const vm::instrs::vrtn_t& vrtn,
+                   std::uintptr_t module_base) {
+  for (const auto& blk : vrtn.m_blks)
+    add(blk, module_base);
+  end(vrtn.m_rva);
+}
+
+void writer_t::add(const rtn_view_t& rtn) {
+  for (auto idx = 0u; idx < rtn.size(); ++idx)
+    add(rtn[idx]);
+  end(rtn.rva());
+}
+
+void writer_t::end_module() {
+  module_t module;
+  std::memset(&module, 0, sizeof module);
+  module.name_size = m_name.size();
+  module.rtn_cnt = m_rtns.size();
+  module.name = write(m_name.data(), m_name.size());
+  module.rtns = write(m_rtns.data(), m_rtns.size() * sizeof(rtn_t));
+  m_modules.push_back(module);
+  m_rtns.clear();
+  m_in_module = false;
+}
+
+bool writer_t::finish() {
+  if (m_in_module)
+    end_module();
+
+  header_t header{VMSTORE_MAGIC, VMSTORE_VERSION, 0u, 0u, 0u};
+  header.module_cnt = m_modules.size();
+  header.modules =
+      write(m_modules.data(), m_modules.size() * sizeof(module_t));
+
+  m_file.seekp(0, std::ios::beg);
+  m_file.write(reinterpret_cast<const char*>(&header), sizeof header);
+  return static_cast<bool>(m_file.flush());
+}
+}  // namespace vm::store
@@ -0,0 +1,241 @@
+#include <uc_allocation_tracker.hpp>
+#include <vmimage.hpp>
+#include <vmtrace.hpp>
+
+// handlers which run longer than this are given up on... the hooks count the
+// instructions themselves, a count passed to uc_emu_start would make unicorn
+// install a hook of its own on every instruction.
+#define EMU_TRACE_MAX_INSTRS 0x2000u
+
+namespace vm::emu {
+// the jmp reg into the next vm handler or the ret of a vm exit...
+static bool is_terminal(const zydis_decoded_instr_t& instr) {
+  return (instr.mnemonic == ZYDIS_MNEMONIC_JMP &&
+          instr.operands[0].type == ZYDIS_OPERAND_TYPE_REGISTER) ||
+         instr.mnemonic == ZYDIS_MNEMONIC_RET;
+}
+
+const std::vector<zydis_decoded_instr_t>* decode_cache_t::get(
+    std::uintptr_t addr,
+    std::uint32_t size) {
+  // unicorn-engine can split the same code into blocks of different sizes, for
+  // example when a translation block gets flushed... only reuse exact matches.
+  const auto cached = m_blocks.find(addr);
+  if (cached != m_blocks.end() && cached->second.size == size)
+    return &cached->second.instrs;
+
+  vm::image_t::touch(addr, size);
+  block_t block{size};
+  zydis_decoded_instr_t instr;
+  std::uint32_t offset = 0u;
+
+  while (offset < size &&
+         ZYAN_SUCCESS(ZydisDecoderDecodeBuffer(
+             vm::utils::g_decoder.get(),
+             reinterpret_cast<void*>(addr + offset), size - offset, &instr))) {
+    block.instrs.push_back(instr);
+    offset += instr.length;
+  }
+
+  if (offset != size)
+    return nullptr;
+
+  return &(m_blocks[addr] = std::move(block)).instrs;
+}
+
+tracer_t::tracer_t(uc_engine* uc,
+                   state_t& state,
+                   trace_mode_t mode,
+                   std::uintptr_t module_base,
+                   std::uintptr_t image_size)
+    : m_uc(uc),
+      m_state(state),
+      m_mode(mode),
+      m_hook(0),
+      m_hndlr(nullptr),
+      m_active(false),
+      m_done(false),
+      m_ret(false),
+      m_failed(false),
+      m_next(0u),
+      m_executed(0u),
+      m_module_base(module_base),
+      m_image_size(image_size) {
+  // vm handlers only ever live inside of the module... the hook still covers
+  // all of memory so that the first instruction after a ret out of the module
+  // is seen and emulation stops there.
+  const auto callback =
+      mode == trace_mode_t::block
+          ? reinterpret_cast<void*>(&tracer_t::on_block)
+          : reinterpret_cast<void*>(&tracer_t::on_code);
+
+  if (uc_hook_add(uc, &m_hook,
+                  mode == trace_mode_t::block ? UC_HOOK_BLOCK : UC_HOOK_CODE,
+                  callback, this, 1ull, 0ull))
+    std::printf("[!] failed to install trace hook...\n");
+}
+
+tracer_t::~tracer_t() {
+  if (m_hook)
+    uc_hook_del(m_uc, m_hook);
+}
+
+bool tracer_t::trace(std::uintptr_t rip,
+                     zydis_reg_t vip,
+                     zydis_reg_t vsp,
+                     vm::instrs::hndlr_trace_t& hndlr,
+                     std::uintptr_t& next) {
+  vm::instrs::release(hndlr);
+  hndlr.m_uc = m_uc;
+  hndlr.m_begin = rip;
+  hndlr.m_vip = vip;
+  hndlr.m_vsp = vsp;
+  hndlr.m_materialize = nullptr;
+  hndlr.m_imm = {0u, ZYDIS_REGISTER_NONE};
+
+  // lazily traced contexts are replayed from the state at the first
+  // instruction of the handler...
+  if (m_mode == trace_mode_t::block) {
+    m_state.checkpoint();
+    hndlr.m_materialize = [this](std::uint32_t idx) -> uc_context* {
+      return materialize(idx);
+    };
+  }
+
+  m_hndlr = &hndlr;
+  m_active = true;
+  m_done = m_ret = m_failed = false;
+  m_next = 0u;
+  m_executed = 0u;
+
+  const auto err = uc_emu_start(m_uc, rip, 0ull, 0ull, 0ull);
+  m_active = false;
+
+  // the hook stops emulation right before the first instruction after the
+  // jmp reg, rip must be sitting on it... a vm exit may return to an address
+  // which is not mapped, so anything after a ret is fine.
+  std::uintptr_t stopped_at = 0u;
+  uc_reg_read(m_uc, UC_X86_REG_RIP, &stopped_at);
+
+  if (m_failed || !m_done ||
+      (!m_ret && (err || stopped_at != m_next))) {
+    std::printf("[!] failed to trace vm handler at = 0x%p, reason = %s\n",
+                reinterpret_cast<void*>(rip),
+                err ? uc_strerror(err) : "did not reach jmp reg or ret");
+    return false;
+  }
+
+  next = m_ret ? 0u : m_next;
+  return true;
+}
+
+void tracer_t::on_code(uc_engine* uc,
+                       std::uint64_t addr,
+                       std::uint32_t size,
+                       tracer_t* tracer) {
+  if (!tracer->m_active)
+    return;
+
+  if (tracer->m_done) {
+    tracer->m_next = addr;
+    uc_emu_stop(uc);
+    return;
+  }
+
+  if (addr < tracer->m_module_base ||
+      addr + size > tracer->m_module_base + tracer->m_image_size) {
+    tracer->m_failed = true;
+    uc_emu_stop(uc);
+    return;
+  }
+
+  if (tracer->m_executed >= EMU_TRACE_MAX_INSTRS) {
+    uc_emu_stop(uc);
+    return;
+  }
+
+  vm::instrs::emu_instr_t instr{{}, nullptr, tracer->m_executed++};
+  if (!ZYAN_SUCCESS(ZydisDecoderDecodeBuffer(vm::utils::g_decoder.get(),
+                                             reinterpret_cast<void*>(addr),
+                                             size, &instr.m_instr))) {
+    tracer->m_failed = true;
+    uc_emu_stop(uc);
+    return;
+  }
+
+  uct_context_alloc(uc, &instr.m_cpu);
+  uc_context_save(uc, instr.m_cpu);
+  tracer->m_hndlr->m_instrs.push_back(instr);
+
+  if (is_terminal(instr.m_instr)) {
+    tracer->m_done = true;
+    tracer->m_ret = instr.m_instr.mnemonic == ZYDIS_MNEMONIC_RET;
+  }
+}
+
+void tracer_t::on_block(uc_engine* uc,
+                        std::uint64_t addr,
+                        std::uint32_t size,
+                        tracer_t* tracer) {
+  if (!tracer->m_active)
+    return;
+
+  if (tracer->m_done) {
+    tracer->m_next = addr;
+    uc_emu_stop(uc);
+    return;
+  }
+
+  const auto block =
+      addr >= tracer->m_module_base &&
+              addr + size <= tracer->m_module_base + tracer->m_image_size
+          ? tracer->m_cache.get(addr, size)
+          : nullptr;
+
+  if (!block) {
+    tracer->m_failed = true;
+    uc_emu_stop(uc);
+    return;
+  }
+
+  if (tracer->m_executed >= EMU_TRACE_MAX_INSTRS) {
+    uc_emu_stop(uc);
+    return;
+  }
+
+  // no cpu contexts here, they are materialized on demand...
+  for (const auto& instr : *block) {
+    tracer->m_hndlr->m_instrs.push_back({instr, nullptr, tracer->m_executed++});
+    if (is_terminal(instr)) {
+      tracer->m_done = true;
+      tracer->m_ret = instr.mnemonic == ZYDIS_MNEMONIC_RET;
+      break;
+    }
+  }
+}
+
+uc_context* tracer_t::materialize(std::uint32_t idx) {
+  const auto total = m_executed;
+  if (idx >= total)
+    return nullptr;
+
+  // back to the first instruction of the handler, run up to the instruction,
+  // snapshot, then run the rest of the handler so that the engine is left
+  // exactly as the trace left it...
+  m_state.rollback();
+
+  uc_context* cpu = nullptr;
+  if ((idx && uc_emu_start(m_uc, m_hndlr->m_begin, 0ull, 0ull, idx)) ||
+      uct_context_alloc(m_uc, &cpu) || uc_context_save(m_uc, cpu)) {
+    uct_context_free(cpu);
+    cpu = nullptr;
+  }
+
+  std::uintptr_t rip = m_hndlr->m_begin;
+  uc_reg_read(m_uc, UC_X86_REG_RIP, &rip);
+
+  // a ret out of the module may fault on the fetch after it, which is fine...
+  uc_emu_start(m_uc, rip, 0ull, 0ull, total - idx);
+  return cpu;
+}
+}  // namespace vm::emu
@@ -1,5 +1,10 @@
+#include <vmimage.hpp>
 #include <vmutils.hpp>
 
+#include <algorithm>
+#include <iterator>
+#include <vector>
+
 namespace vm::utils {
 void print(const zydis_decoded_instr_t& instr) {
   char buffer[256];
@@ -43,12 +48,36 @@ bool flatten(zydis_rtn_t& routine,
              bool keep_jmps,
              std::uint32_t max_instrs,
              std::uintptr_t module_base) {
+  const auto first = routine_addr;
+  return flatten(
+      routine, routine_addr,
+      [&](std::uintptr_t addr, std::size_t& size) -> const std::uint8_t* {
+        // optional sanity checking...
+        if (module_base && addr != first &&
+            !vm::utils::scn::executable(module_base, addr))
+          return nullptr;
+
+        // relocates the instruction first if the image is relocated lazily...
+        vm::image_t::touch(addr, ZYDIS_MAX_INSTRUCTION_LENGTH);
+        size = 0x1000;
+        return reinterpret_cast<const std::uint8_t*>(addr);
+      },
+      keep_jmps, max_instrs);
+}
+
+bool flatten(zydis_rtn_t& routine,
+             std::uintptr_t routine_addr,
+             const reader_t& reader,
+             bool keep_jmps,
+             std::uint32_t max_instrs) {
   zydis_decoded_instr_t instr;
   std::uint32_t instr_cnt = 0u;
+  std::size_t size = 0u;
+  const std::uint8_t* code = nullptr;
 
-  while (ZYAN_SUCCESS(ZydisDecoderDecodeBuffer(
-      vm::utils::g_decoder.get(), reinterpret_cast<void*>(routine_addr), 0x1000,
-      &instr))) {
+  while ((code = reader(routine_addr, size)) &&
+         ZYAN_SUCCESS(ZydisDecoderDecodeBuffer(vm::utils::g_decoder.get(), code,
+                                               size, &instr))) {
     if (++instr_cnt > max_instrs)
       return false;
     // detect if we have already been at this instruction... if so that means
@@ -60,8 +89,7 @@ bool flatten(zydis_rtn_t& routine,
       return true;
 
     std::vector<u8> raw_instr;
-    raw_instr.insert(raw_instr.begin(), (u8*)routine_addr,
-                     (u8*)routine_addr + instr.length);
+    raw_instr.insert(raw_instr.begin(), code, code + instr.length);
 
     if (is_jmp(instr) ||
         instr.mnemonic == ZYDIS_MNEMONIC_CALL &&
@@ -82,10 +110,6 @@ bool flatten(zydis_rtn_t& routine,
       routine.push_back({instr, raw_instr, routine_addr});
       routine_addr += instr.length;
     }
-
-    // optional sanity checking...
-    if (module_base && !vm::utils::scn::executable(module_base, routine_addr))
-      return false;
   }
   return false;
 }
@@ -210,35 +234,103 @@ bool compare(zydis_reg_t a, zydis_reg_t b) {
 }
 }  // namespace reg
 
-namespace scn {
-bool read_only(std::uint64_t module_base, std::uint64_t ptr) {
-  auto win_image = reinterpret_cast<win::image_t<>*>(module_base);
-  auto section_count = win_image->get_file_header()->num_sections;
-  auto sections = win_image->get_nt_headers()->get_sections();
+bool valid_pe(const std::uint8_t* file, std::size_t file_size) {
+  if (file_size < sizeof(win::dos_header_t))
+    return false;
 
-  for (auto idx = 0u; idx < section_count; ++idx)
-    if (ptr >= sections[idx].virtual_address + module_base &&
-        ptr < sections[idx].virtual_address + sections[idx].virtual_size +
-                  module_base)
-      return !(sections[idx].characteristics.mem_discardable) &&
-             !(sections[idx].characteristics.mem_write);
+  // the nt headers can be anywhere e_lfanew says, check that they fit before
+  // reading a single field of them...
+  const auto dos_header = reinterpret_cast<const win::dos_header_t*>(file);
+  if (dos_header->e_magic != 0x5A4D ||  // "MZ"
+      dos_header->e_lfanew < 0 ||
+      static_cast<std::size_t>(dos_header->e_lfanew) > file_size)
+    return false;
 
-  return false;
+  const auto img = reinterpret_cast<const win::image_t<>*>(file);
+  const auto nt_headers = img->get_nt_headers();
+  if (sizeof(*nt_headers) > file_size - dos_header->e_lfanew ||
+      nt_headers->signature != 0x00004550 ||  // "PE\0\0"
+      nt_headers->optional_header.magic != 0x20B)
+    return false;
+
+  // the section table follows the optional header, whose size is only a
+  // field of the file header...
+  const auto sections = reinterpret_cast<std::uintptr_t>(
+      nt_headers->get_sections());
+  const auto offset = sections - reinterpret_cast<std::uintptr_t>(file);
+  return offset <= file_size &&
+         nt_headers->file_header.num_sections <=
+             (file_size - offset) / sizeof(win::section_header_t);
 }
 
-bool executable(std::uint64_t module_base, std::uint64_t ptr) {
-  auto win_image = reinterpret_cast<win::image_t<>*>(module_base);
-  auto section_count = win_image->get_file_header()->num_sections;
-  auto sections = win_image->get_nt_headers()->get_sections();
+namespace scn {
+// a section of the module as a range of linear virtual addresses...
+struct range_t {
+  std::uint64_t begin, end;
+  bool read_only, executable;
+};
+
+// the sections of the last module asked about on this thread, sorted by
+// address... vm::locate and flatten ask for every address they read, always
+// about the same module. the time stamp and image size tell another module
+// mapped at the same address apart.
+static thread_local std::uint64_t t_module_base = 0u;
+static thread_local std::uint32_t t_stamp = 0u, t_image_size = 0u;
+static thread_local std::vector<range_t> t_ranges;
+
+static const range_t* find(std::uint64_t module_base, std::uint64_t ptr) {
+  const auto win_image = reinterpret_cast<win::image_t<>*>(module_base);
+  const auto nt_headers = win_image->get_nt_headers();
+  const auto stamp = nt_headers->file_header.timedate_stamp;
+  const auto image_size = nt_headers->optional_header.size_image;
+
+  if (module_base != t_module_base || stamp != t_stamp ||
+      image_size != t_image_size) {
+    const auto section_count = nt_headers->file_header.num_sections;
+    const auto sections = nt_headers->get_sections();
+
+    t_ranges.clear();
+    for (auto idx = 0u; idx < section_count; ++idx)
+      t_ranges.push_back(
+          {sections[idx].virtual_address + module_base,
+           sections[idx].virtual_address + sections[idx].virtual_size +
+               module_base,
+           !sections[idx].characteristics.mem_discardable &&
+               !sections[idx].characteristics.mem_write,
+           !sections[idx].characteristics.mem_discardable &&
+               sections[idx].characteristics.mem_execute});
+
+    // the sections of a loaded image do not overlap...
+    std::sort(t_ranges.begin(), t_ranges.end(),
+              [](const range_t& a, const range_t& b) -> bool {
+                return a.begin < b.begin;
+              });
+
+    t_module_base = module_base;
+    t_stamp = stamp;
+    t_image_size = image_size;
+  }
 
-  for (auto idx = 0u; idx < section_count; ++idx)
-    if (ptr >= sections[idx].virtual_address + module_base &&
-        ptr < sections[idx].virtual_address + sections[idx].virtual_size +
-                  module_base)
-      return !(sections[idx].characteristics.mem_discardable) &&
-             sections[idx].characteristics.mem_execute;
+  // the last section which begins at or below ptr...
+  const auto itr = std::upper_bound(
+      t_ranges.begin(), t_ranges.end(), ptr,
+      [](std::uint64_t ptr, const range_t& range) -> bool {
+        return ptr < range.begin;
+      });
 
-  return false;
+  if (itr == t_ranges.begin() || ptr >= std::prev(itr)->end)
+    return nullptr;
+  return &*std::prev(itr);
+}
+
+bool read_only(std::uint64_t module_base, std::uint64_t ptr) {
+  const auto range = find(module_base, ptr);
+  return range && range->read_only;
+}
+
+bool executable(std::uint64_t module_base, std::uint64_t ptr) {
+  const auto range = find(module_base, ptr);
+  return range && range->executable;
 }
 }  // namespace scn
 }  // namespace vm::utils
\ No newline at end of file
@@ -0,0 +1,34 @@
+#pragma once
+#include <vector>
+#include <vmprofiler.hpp>
+
+namespace vm::tests {
+/// <summary>
+/// compares everything about two sets of virtual routines which must not
+/// depend on how they were explored...
+/// </summary>
+inline bool same(const std::vector<vm::instrs::vrtn_t>& a,
+                 const std::vector<vm::instrs::vrtn_t>& b) {
+  if (a.size() != b.size())
+    return false;
+
+  for (auto rtn = 0u; rtn < a.size(); ++rtn) {
+    const auto &x = a[rtn], &y = b[rtn];
+    if (x.m_rva != y.m_rva || x.m_blks.size() != y.m_blks.size())
+      return false;
+
+    for (auto blk = 0u; blk < x.m_blks.size(); ++blk) {
+      const auto &p = x.m_blks[blk], &q = y.m_blks[blk];
+      if (p.m_vip.rva != q.m_vip.rva || p.branch_type != q.branch_type ||
+          p.branches != q.branches || p.m_vinstrs.size() != q.m_vinstrs.size())
+        return false;
+
+      for (auto idx = 0u; idx < p.m_vinstrs.size(); ++idx)
+        if (p.m_vinstrs[idx].mnemonic != q.m_vinstrs[idx].mnemonic ||
+            p.m_vinstrs[idx].imm.val != q.m_vinstrs[idx].imm.val)
+          return false;
+    }
+  }
+  return true;
+}
+}  // namespace vm::tests
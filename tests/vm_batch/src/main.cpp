@@ -0,0 +1,275 @@
+#include <cli-parser.hpp>
+#include <cctype>
+#include <chrono>
+#include <filesystem>
+#include <vmprofiler.hpp>
+
+// a directory means every file in it, a PE file means just that file and
+// anything else is a text file with one path per line...
+static std::vector<std::string> list_binaries(const std::string& path) {
+  std::vector<std::string> bins;
+  if (std::filesystem::is_directory(path)) {
+    for (const auto& entry : std::filesystem::directory_iterator(path))
+      if (entry.is_regular_file())
+        bins.push_back(entry.path().string());
+
+    std::sort(bins.begin(), bins.end());
+    return bins;
+  }
+
+  std::ifstream list(path, std::ios::binary);
+  char magic[2] = {};
+  if (list.read(magic, sizeof magic) && magic[0] == 'M' && magic[1] == 'Z')
+    return {path};
+
+  list.clear();
+  list.seekg(0, std::ios::beg);
+  for (std::string line; std::getline(list, line);) {
+    while (!line.empty() &&
+           std::isspace(static_cast<std::uint8_t>(line.back())))
+      line.pop_back();
+
+    if (!line.empty())
+      bins.push_back(line);
+  }
+  return bins;
+}
+
+// one hex rva per line, the same entries are used for every binary...
+static std::vector<vm::locate::vm_enter_t> list_entries(
+    const std::string& path) {
+  std::vector<vm::locate::vm_enter_t> entries;
+  std::ifstream list(path);
+  for (std::string line; std::getline(list, line);)
+    if (const auto rva = std::strtoull(line.c_str(), nullptr, 16))
+      entries.push_back({static_cast<std::uint32_t>(rva), 0u});
+
+  return entries;
+}
+
+int __cdecl main(int argc, const char* argv[]) {
+  argparse::argument_parser_t parser(
+      "VMBatch", "devirtualizes every vm entry of many binaries at once");
+  parser.add_argument()
+      .name("--bins")
+      .description(
+          "a binary, a directory of binaries or a file listing one binary per "
+          "line...");
+
+  parser.add_argument()
+      .name("--entries")
+      .description(
+          "file with one vm entry rva (hex) per line, used for every binary... "
+          "vm entries are located automatically if this is not given");
+
+  parser.add_argument()
+      .name("--entcache")
+      .description(
+          "directory to cache located vm entries in... binaries which were "
+          "located before are not scanned again");
+
+  parser.add_argument()
+      .name("--shard")
+      .description(
+          "k/n, only devirtualize the vm entries which belong to shard k of "
+          "n... needs --out");
+
+  parser.add_argument()
+      .name("--out")
+      .description("file to write the devirtualized routines to...");
+
+  parser.add_argument()
+      .name("--merge")
+      .description(
+          "a directory of shard files or a file listing one per line... merges "
+          "them into --out instead of devirtualizing anything");
+
+  parser.add_argument()
+      .name("--profdb")
+      .description(
+          "vm handler profile database to use and update... known vm handlers "
+          "are not traced again, created if it does not exist");
+
+  parser.add_argument()
+      .name("--threads")
+      .description("number of worker threads, defaults to the number of "
+                   "cores...");
+
+  parser.enable_help();
+  auto result = parser.parse(argc, argv);
+
+  if (result) {
+    std::printf("[!] error parsing commandline arguments... reason = %s\n",
+                result.what().c_str());
+    return -1;
+  }
+
+  if (parser.exists("help")) {
+    parser.print_help();
+    return 0;
+  }
+
+  if (parser.exists("merge")) {
+    if (!parser.exists("out")) {
+      std::printf("[!] --merge needs --out...\n");
+      return -1;
+    }
+
+    const auto shards = list_binaries(parser.get<std::string>("merge"));
+    if (!vm::shard::merge(shards, parser.get<std::string>("out"))) {
+      std::printf("[!] failed to merge shards...\n");
+      return -1;
+    }
+
+    std::printf("> merged %d shards into %s\n", shards.size(),
+                parser.get<std::string>("out").c_str());
+    return 0;
+  }
+
+  if (!parser.exists("bins")) {
+    std::printf("[!] --bins is required...\n");
+    return -1;
+  }
+
+  // shard k of n... every process sees the same vm entries and keeps its own
+  // share of them, the shards are combined later with --merge.
+  std::uint32_t shard = 0u, shards = 1u;
+  if (parser.exists("shard")) {
+    const auto spec = parser.get<std::string>("shard");
+    char* end = nullptr;
+    shard = std::strtoul(spec.c_str(), &end, 10);
+    shards = *end == '/' ? std::strtoul(end + 1, nullptr, 10) : 0u;
+    if (!shards || shard >= shards || !parser.exists("out")) {
+      std::printf("[!] --shard must be k/n with k < n and needs --out...\n");
+      return -1;
+    }
+  }
+
+  const auto bins = list_binaries(parser.get<std::string>("bins"));
+  const auto listed = parser.exists("entries")
+                          ? list_entries(parser.get<std::string>("entries"))
+                          : std::vector<vm::locate::vm_enter_t>{};
+
+  const auto threads =
+      parser.exists("threads")
+          ? std::strtoul(parser.get<std::string>("threads").c_str(), nullptr,
+                         10)
+          : 0ul;
+
+  // one database for every binary, builds of the same product share most of
+  // their vm handlers...
+  std::unique_ptr<vm::profdb::db_t> db;
+  if (parser.exists("profdb") &&
+      !(db = vm::profdb::db_t::open(parser.get<std::string>("profdb")))) {
+    std::printf("[!] %s is not a vm handler profile database...\n",
+                parser.get<std::string>("profdb").c_str());
+    return -1;
+  }
+
+  // one bounded set of workers for everything... every binary gets its own
+  // engine pool (and the decode caches of its tracers) and vm enter cache,
+  // which live for as long as that binary is being worked on.
+  vm::sched::scheduler_t sched(threads);
+  std::printf("> %d binaries, %d worker threads\n", bins.size(), sched.size());
+
+  std::size_t total_entries = 0u, total_vrtns = 0u, total_blks = 0u,
+              total_handlers = 0u, cached = 0u;
+  const auto start = std::chrono::steady_clock::now();
+  std::vector<vm::shard::module_t> modules;
+
+  for (const auto& bin : bins) {
+    const auto bin_start = std::chrono::steady_clock::now();
+    const auto image = vm::image_t::load(bin);
+    if (!image) {
+      std::printf("[!] failed to open or map %s...\n", bin.c_str());
+      continue;
+    }
+
+    // the raw file is enough to find the vm entries...
+    auto entries = listed;
+    if (entries.empty())
+      if (const auto file = vm::file_t::open(bin)) {
+        auto hit = false;
+        entries = parser.exists("entcache")
+                      ? vm::locate::get_vm_entries(
+                            *file, parser.get<std::string>("entcache"), &hit)
+                      : vm::locate::get_vm_entries(*file);
+        cached += hit;
+      }
+
+    if (shards > 1u)
+      entries = vm::shard::select(entries, shard, shards);
+
+    vm::emu::engine_pool_t engines(*image, sched.size() + 1u);
+    vm::vmenter_cache_t enters;
+    auto vrtns =
+        vm::devirt(*image, entries, sched, engines, enters,
+                   vm::mem::policy_t::arena, nullptr, nullptr, db.get());
+
+    // the next binary may well be mapped where this one was...
+    if (db)
+      db->forget();
+
+    std::size_t blks = 0u, handlers = 0u;
+    for (auto& vrtn : vrtns) {
+      blks += vrtn.m_blks.size();
+      for (const auto& blk : vrtn.m_blks)
+        handlers += blk.m_vinstrs.size();
+
+      vm::emu::release(vrtn);
+    }
+
+    std::printf(
+        "> %s: %d vm entries, %d routines, %d blocks, %d vm handlers, %d vm "
+        "enters, %f s\n",
+        bin.c_str(), entries.size(), vrtns.size(), blks, handlers,
+        enters.size(),
+        std::chrono::duration<double>(std::chrono::steady_clock::now() -
+                                      bin_start)
+            .count());
+
+    total_entries += entries.size();
+    total_vrtns += vrtns.size();
+    total_blks += blks;
+    total_handlers += handlers;
+
+    if (parser.exists("out"))
+      modules.push_back({std::filesystem::path(bin).filename().string(),
+                         std::move(vrtns), image->m_module_base});
+  }
+
+  if (parser.exists("out") &&
+      !vm::shard::write(parser.get<std::string>("out"), modules)) {
+    std::printf("[!] failed to write %s...\n",
+                parser.get<std::string>("out").c_str());
+    return -1;
+  }
+
+  const auto time =
+      std::chrono::duration<double>(std::chrono::steady_clock::now() - start)
+          .count();
+
+  if (parser.exists("entcache"))
+    std::printf("> vm entries of %d/%d binaries were cached\n", cached,
+                bins.size());
+
+  if (db) {
+    const auto stats = db->stats();
+    std::printf(
+        "> %llu/%llu vm handlers untraced (%f%%), %llu profiles added, %d "
+        "known\n",
+        stats.hits, stats.lookups,
+        stats.lookups ? stats.hits * 100.0 / stats.lookups : 0.0,
+        stats.inserted, db->size());
+
+    if (!db->save())
+      std::printf("[!] failed to save %s...\n",
+                  parser.get<std::string>("profdb").c_str());
+  }
+
+  std::printf(
+      "> %d vm entries, %d routines, %d blocks, %d vm handlers in %f s... %f "
+      "entries/s, %f handlers/s\n",
+      total_entries, total_vrtns, total_blks, total_handlers, time,
+      total_entries / time, total_handlers / time);
+}
@@ -0,0 +1,185 @@
+#pragma once
+#include <chrono>
+#include <vmprofiler.hpp>
+#include <vmtests.hpp>
+
+namespace vm::bench {
+/// <summary>
+/// a mapped and relocated module along with the vm entries located in it...
+/// </summary>
+struct module_t {
+  const vm::image_t* image;
+  std::uintptr_t module_base, image_base, image_size;
+  std::vector<vm::locate::vm_enter_t> entries;
+};
+
+/// <summary>
+/// seconds elapsed since start...
+/// </summary>
+inline double elapsed(std::chrono::steady_clock::time_point start) {
+  return std::chrono::duration<double>(std::chrono::steady_clock::now() - start)
+      .count();
+}
+
+/// <summary>
+/// peak resident set size of the process in bytes...
+/// </summary>
+std::size_t peak_rss();
+
+/// <summary>
+/// resets the peak resident set size where the os allows it, otherwise
+/// benchmarks run from the smallest expected peak to the largest...
+/// </summary>
+void reset_peak_rss();
+
+using vm::tests::same;
+
+/// <summary>
+/// emulate the vm enter up until the JMP REG into the first vm handler...
+/// </summary>
+inline bool run_vm_enter(uc_engine* uc,
+                         const module_t& module,
+                         const vm::vmctx_t& vmctx) {
+  const auto begin = module.module_base + vmctx.m_vm_entry_rva;
+  const auto until = vmctx.get_vm_enter().back().addr;
+  return uc_emu_start(uc, begin, until, 0ull, 0ull) == UC_ERR_OK;
+}
+
+/// <summary>
+/// loads the binary with vm::image_t::load, with open_binary_file and
+/// vm::image_t::map, and by reading it one byte at a time like open_binary_file
+/// used to... reports load time and peak resident set size for each.
+/// </summary>
+void load(const std::string& path);
+
+/// <summary>
+/// loads the binary with every vm::reloc_mode_t, parallel both with and
+/// without a running scheduler, and reports the time it takes until the first
+/// vm entry is located and its vmctx_t is initialized...
+/// </summary>
+void reloc(const std::string& path);
+
+/// <summary>
+/// locates the vm entries straight from the raw file and from the mapped image,
+/// reports time and peak resident set size for both and checks that they found
+/// the same vm entries...
+/// </summary>
+void locate(const std::string& path);
+
+/// <summary>
+/// locates the vm entries without a cache, then cold and warm through the vm
+/// entry cache, reports the time of each and checks that a copy of the binary
+/// with one byte changed misses the cache...
+/// </summary>
+void entcache(const std::string& path);
+
+/// <summary>
+/// emulates every vm enter with a fresh uc_engine per vm entry and then again
+/// with engines leased from a vm::emu::engine_pool_t, both with the image
+/// mapped read only and with copy-on-write views of the image...
+/// </summary>
+void pool(const module_t& module);
+
+/// <summary>
+/// measures the cost of the dirty page write hook on vm enter emulation and
+/// compares a vm::emu::state_t rollback against restoring a full stack copy...
+/// </summary>
+void state(const module_t& module);
+
+/// <summary>
+/// traces and profiles the vm handlers reached from every vm enter, once with
+/// a UC_HOOK_CODE per instruction and once with UC_HOOK_BLOCK and lazily
+/// materialized cpu contexts, and reports handlers/s for both...
+/// </summary>
+void trace(const module_t& module);
+
+/// <summary>
+/// runs the flattened vm handlers reached from every vm enter natively with
+/// vm::emu::eval_t and with unicorn-engine, and reports handlers/s for both...
+/// </summary>
+void eval(const module_t& module);
+
+/// <summary>
+/// devirtualizes every vm entry with vm::devirt on 1 to 64 threads, reports the
+/// speedup over a single thread and checks that every thread count gives the
+/// same virtual routines...
+/// </summary>
+void sched(const module_t& module);
+
+/// <summary>
+/// initializes a vmctx_t for up to 1000 distinct vm entries one by one and
+/// again with a shared vm::vmenter_cache_t, and checks that both give the same
+/// vm enters...
+/// </summary>
+void vmctx(const module_t& module);
+
+/// <summary>
+/// devirtualizes every vm entry and writes and reads the virtual routines back
+/// as a vm::store and as json, reports file size and time for both...
+/// </summary>
+void store(const module_t& module);
+
+/// <summary>
+/// explores every vm entry, streaming each block into a vm::store as soon as
+/// it is done and again keeping every routine whole, and reports the most
+/// uc_context's alive and peak resident set size for both...
+/// </summary>
+void sink(const module_t& module);
+
+/// <summary>
+/// devirtualizes the largest routine and then every vm entry with every
+/// vm::mem::policy_t, and reports the number of operator new calls and the
+/// time for each...
+/// </summary>
+void arena(const module_t& module);
+
+/// <summary>
+/// scans millions of virtual instructions stored as vectors of vinstr_t and as
+/// vm::instrs::packed_vinstrs_t, once reading every field and once only the
+/// mnemonics, and reports the time and size of both...
+/// </summary>
+void packed(const module_t& module);
+
+/// <summary>
+/// devirtualizes every vm entry without and then with a vm::emu::blk_cache_t,
+/// reports the hit rate and the blocks and vm handlers that did not have to be
+/// emulated again, and checks that both give the same virtual routines...
+/// </summary>
+void blkcache(const module_t& module);
+
+/// <summary>
+/// explores the routine with the most blocks on 1 to 64 threads, reports
+/// blocks/s and the speedup over a single thread and checks that every thread
+/// count gives the same blocks in the same order...
+/// </summary>
+void routine(const module_t& module);
+
+/// <summary>
+/// explores every vm entry and reports how many jump tables were resolved,
+/// how many table entries were evaluated and the time per entry next to the
+/// time it takes to emulate a whole block...
+/// </summary>
+void table(const module_t& module);
+
+/// <summary>
+/// explores the routine with the most virtual JCCs and reports the time per
+/// round, the pages each block entry fork copied and the time per fork next
+/// to a copy of the whole stack...
+/// </summary>
+void fork(const module_t& module);
+
+/// <summary>
+/// explores every vm entry with every vm::compact::codec_t, reports the bytes
+/// of JMP handler state kept per block next to a full cpu context and stack,
+/// and checks that every rehydrated state leads to one of the block's
+/// branches...
+/// </summary>
+void compact(const module_t& module);
+
+/// <summary>
+/// devirtualizes every vm entry twice with a vm handler profile database, the
+/// second time from what the first one saved, and reports the time of each
+/// and how many vm handlers were run untraced...
+/// </summary>
+void profdb(const module_t& module);
+}  // namespace vm::bench
@@ -0,0 +1,93 @@
+#include <atomic>
+#include <cstdlib>
+#include <new>
+#include <vmbench.hpp>
+
+#define ARENA_BENCH_ROUNDS 10u
+
+static constexpr vm::mem::policy_t g_policies[] = {vm::mem::policy_t::heap,
+                                                   vm::mem::policy_t::arena};
+
+// every operator new of the process is counted, unicorn-engine allocates with
+// malloc and is left out...
+static std::atomic<std::size_t> g_news = 0u;
+
+void* operator new(std::size_t size) {
+  ++g_news;
+  if (const auto ptr = std::malloc(size ? size : 1u))
+    return ptr;
+  throw std::bad_alloc();
+}
+
+void operator delete(void* ptr) noexcept {
+  std::free(ptr);
+}
+
+void operator delete(void* ptr, std::size_t size) noexcept {
+  std::free(ptr);
+}
+
+namespace vm::bench {
+static const char* name(vm::mem::policy_t policy) {
+  return policy == vm::mem::policy_t::arena ? "arena" : "heap";
+}
+
+void arena(const module_t& module) {
+  vm::sched::scheduler_t sched;
+  vm::emu::engine_pool_t engines(*module.image, sched.size() + 1u);
+  vm::vmenter_cache_t enters;
+
+  // the routine with the most blocks...
+  auto vrtns = vm::devirt(*module.image, module.entries, sched, engines,
+                          enters, vm::mem::policy_t::heap);
+  if (vrtns.empty())
+    return;
+
+  const auto largest = std::max_element(
+      vrtns.begin(), vrtns.end(),
+      [](const vm::instrs::vrtn_t& a, const vm::instrs::vrtn_t& b) {
+        return a.m_blks.size() < b.m_blks.size();
+      });
+
+  const std::vector<vm::locate::vm_enter_t> entry = {{largest->m_rva, 0u}};
+  std::printf("> largest routine at rva 0x%x, %d blocks, %d rounds\n",
+              largest->m_rva, largest->m_blks.size(), ARENA_BENCH_ROUNDS);
+
+  for (auto& vrtn : vrtns)
+    vm::emu::release(vrtn);
+  vrtns.clear();
+
+  for (const auto policy : g_policies) {
+    const auto news = g_news.load();
+    const auto start = std::chrono::steady_clock::now();
+    for (auto round = 0u; round < ARENA_BENCH_ROUNDS; ++round) {
+      auto result = vm::devirt(*module.image, entry, sched, engines, enters,
+                               policy);
+      for (auto& vrtn : result)
+        vm::emu::release(vrtn);
+    }
+
+    std::printf("> largest routine, %s: %d operator new per round, %f s\n",
+                name(policy), (g_news.load() - news) / ARENA_BENCH_ROUNDS,
+                elapsed(start) / ARENA_BENCH_ROUNDS);
+  }
+
+  for (const auto policy : g_policies) {
+    const auto news = g_news.load();
+    const auto start = std::chrono::steady_clock::now();
+    auto result = vm::devirt(*module.image, module.entries, sched, engines,
+                             enters, policy);
+    const auto time = elapsed(start);
+
+    // the routines are freed with their arena, or block by block...
+    const auto freed = std::chrono::steady_clock::now();
+    for (auto& vrtn : result)
+      vm::emu::release(vrtn);
+    result.clear();
+
+    std::printf(
+        "> every vm entry, %s: %d operator new, %f s, freed in %f s\n",
+        name(policy), g_news.load() - news, time, elapsed(freed));
+  }
+}
+}  // namespace vm::bench
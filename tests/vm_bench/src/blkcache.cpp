@@ -0,0 +1,50 @@
+#include <vmbench.hpp>
+
+namespace vm::bench {
+void blkcache(const module_t& module) {
+  std::size_t blks = 0u, vinstrs = 0u;
+  auto start = std::chrono::steady_clock::now();
+  auto expected = vm::devirt(*module.image, module.entries);
+  const auto base_time = elapsed(start);
+
+  for (const auto& vrtn : expected)
+    for (const auto& blk : vrtn.m_blks) {
+      ++blks;
+      vinstrs += blk.m_vinstrs.size();
+    }
+
+  std::printf("> no cache: %d routines, %d blocks, %d vm handlers, %f s\n",
+              expected.size(), blks, vinstrs, base_time);
+
+  // the first pass only shares blocks between vm entries, the second one
+  // finds every block already cached...
+  vm::emu::blk_cache_t cache;
+  for (auto pass = 0u; pass < 2u; ++pass) {
+    const auto before = cache.stats();
+    start = std::chrono::steady_clock::now();
+    auto vrtns = vm::devirt(*module.image, module.entries, 0u,
+                            vm::mem::policy_t::arena, &cache);
+    const auto time = elapsed(start);
+    const auto stats = cache.stats();
+
+    const auto lookups = stats.lookups - before.lookups;
+    const auto hits = stats.hits - before.hits;
+    const auto replayed = stats.blks - before.blks;
+    std::printf(
+        "> %s cache: %f s (%fx), %llu cached blocks, %llu/%llu hits (%f%%)\n",
+        pass ? "warm" : "cold", time, base_time / time, cache.size(), hits,
+        lookups, lookups ? hits * 100.0 / lookups : 0.0);
+    std::printf(
+        "> %llu blocks (%f%%) and %llu vm handlers not emulated again%s\n",
+        replayed, blks ? replayed * 100.0 / blks : 0.0,
+        stats.vinstrs - before.vinstrs,
+        same(expected, vrtns) ? "" : " [!] differs from no cache");
+
+    for (auto& vrtn : vrtns)
+      vm::emu::release(vrtn);
+  }
+
+  for (auto& vrtn : expected)
+    vm::emu::release(vrtn);
+}
+}  // namespace vm::bench
@@ -0,0 +1,84 @@
+#include <vmbench.hpp>
+
+static constexpr vm::compact::codec_t g_codecs[] = {
+    vm::compact::codec_t::none, vm::compact::codec_t::zrle};
+
+namespace vm::bench {
+static const char* name(vm::compact::codec_t codec) {
+  return codec == vm::compact::codec_t::zrle ? "zrle" : "none";
+}
+
+void compact(const module_t& module) {
+  vm::sched::scheduler_t sched;
+  vm::emu::engine_pool_t engines(*module.image, sched.size() + 1u);
+  vm::vmenter_cache_t enters;
+
+  // what every block used to keep, a cpu context and a copy of the stack...
+  std::size_t ctx_size = 0u;
+  {
+    auto lease = engines.lease();
+    ctx_size = uc_context_size(lease.uc());
+  }
+
+  const auto before = ctx_size + EMU_STACK_SIZE;
+  std::printf("> before: %llu bytes per block\n", before);
+
+  for (const auto codec : g_codecs) {
+    std::vector<vm::instrs::vrtn_t> vrtns;
+    const auto start = std::chrono::steady_clock::now();
+    for (const auto& entry : module.entries) {
+      vm::vmctx_t vmctx(module.module_base, module.image_base,
+                        module.image_size, entry.rva);
+      if (!vmctx.init(enters))
+        continue;
+
+      vm::emu::emu_t emu(&vmctx, engines, &sched, vm::mem::policy_t::arena,
+                         nullptr, codec);
+      vm::instrs::vrtn_t vrtn;
+      if (emu.init() && emu.get_trace(vrtn))
+        vrtns.push_back(std::move(vrtn));
+    }
+    const auto time = elapsed(start);
+
+    // rehydrated, the value on top of the virtual stack is the branch the
+    // JMP took...
+    std::size_t blks = 0u, bytes = 0u, restored = 0u, wrong = 0u;
+    double restore_time = 0.0;
+    auto lease = engines.lease();
+    for (const auto& vrtn : vrtns)
+      for (const auto& blk : vrtn.m_blks) {
+        if (!blk.m_jmp.state)
+          continue;
+
+        ++blks;
+        bytes += blk.m_jmp.state->size();
+
+        const auto restore_start = std::chrono::steady_clock::now();
+        const auto ok = blk.m_jmp.state->restore(lease);
+        restore_time += elapsed(restore_start);
+
+        std::uintptr_t vsp = 0u, branch = 0u;
+        uc_reg_read(lease.uc(), vm::instrs::uc_reg(blk.m_jmp.m_vm.vsp), &vsp);
+        uc_mem_read(lease.uc(), vsp, &branch, sizeof branch);
+        branch = branch - module.module_base + module.image_base;
+
+        ++restored;
+        if (!ok || std::find(blk.branches.begin(), blk.branches.end(),
+                             branch) == blk.branches.end())
+          ++wrong;
+      }
+
+    const auto count = blks ? blks : 1u;
+    std::printf(
+        "> %s: %d blocks, %f s, %llu bytes per block (%fx smaller), %f us "
+        "per restore%s\n",
+        name(codec), blks, time, bytes / count,
+        bytes ? static_cast<double>(before) * blks / bytes : 0.0,
+        restore_time * 1e6 / count,
+        wrong ? " [!] restored state does not lead to the branch" : "");
+
+    for (auto& vrtn : vrtns)
+      vm::emu::release(vrtn);
+  }
+}
+}  // namespace vm::bench
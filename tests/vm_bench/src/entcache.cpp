@@ -0,0 +1,98 @@
+#include <filesystem>
+#include <fstream>
+#include <vmbench.hpp>
+
+namespace vm::bench {
+static bool same(const std::vector<vm::locate::vm_enter_t>& a,
+                 const std::vector<vm::locate::vm_enter_t>& b) {
+  return a.size() == b.size() &&
+         std::equal(a.begin(), a.end(), b.begin(),
+                    [](const vm::locate::vm_enter_t& x,
+                       const vm::locate::vm_enter_t& y) {
+                      return x.rva == y.rva &&
+                             x.encrypted_rva == y.encrypted_rva;
+                    });
+}
+
+// locates the vm entries of the file at path through the cache the way a job
+// starting up would, opening the file included...
+static std::vector<vm::locate::vm_enter_t> run(const std::string& path,
+                                               const std::string& cache,
+                                               bool& hit,
+                                               double& time) {
+  const auto start = std::chrono::steady_clock::now();
+  std::vector<vm::locate::vm_enter_t> entries;
+  hit = false;
+  if (const auto file = vm::file_t::open(path))
+    entries = cache.empty() ? vm::locate::get_vm_entries(*file)
+                            : vm::locate::get_vm_entries(*file, cache, &hit);
+  time = elapsed(start);
+  return entries;
+}
+
+// copies the file at path flipping one byte of its first executable section,
+// which has to change its hash...
+static bool patched_copy(const std::string& path, const std::string& copy) {
+  const auto file = vm::file_t::open(path);
+  if (!file || file->size() < sizeof(win::dos_header_t))
+    return false;
+
+  const auto img = reinterpret_cast<const win::image_t<>*>(file->data());
+  const auto nt_headers = img->get_nt_headers();
+  const auto sections = nt_headers->get_sections();
+  for (auto idx = 0u; idx < nt_headers->file_header.num_sections; ++idx) {
+    const auto& section = sections[idx];
+    if (!section.characteristics.mem_execute ||
+        section.characteristics.mem_discardable || !section.size_raw_data ||
+        section.ptr_raw_data >= file->size())
+      continue;
+
+    std::vector<std::uint8_t> data(file->data(), file->data() + file->size());
+    data[section.ptr_raw_data] ^= 0xFFu;
+    std::ofstream out(copy, std::ios::binary | std::ios::trunc);
+    out.write(reinterpret_cast<const char*>(data.data()), data.size());
+    return static_cast<bool>(out.flush());
+  }
+  return false;
+}
+
+void entcache(const std::string& path) {
+  const auto tmp = std::filesystem::temp_directory_path();
+  const auto cache = (tmp / "vm_bench.vmenter").string();
+  std::filesystem::remove_all(cache);
+
+  bool hit;
+  double time, base_time;
+  const auto expected = run(path, {}, hit, base_time);
+  std::printf("> no cache: %zu vm entries, %f ms\n", expected.size(),
+              base_time * 1000.0);
+
+  // the first start scans and fills the cache, every start after it is warm...
+  const auto cold = run(path, cache, hit, time);
+  std::printf("> cold start: %f ms, %s%s\n", time * 1000.0,
+              hit ? "hit" : "miss", same(expected, cold) ? "" : " [!] differs");
+
+  double warm_time = 0.0;
+  auto warm_hits = 0u;
+  for (auto idx = 0u; idx < 10u; ++idx) {
+    const auto warm = run(path, cache, hit, time);
+    warm_time += time;
+    warm_hits += hit && same(expected, warm);
+  }
+
+  std::printf("> warm start: %f ms (%fx), %u/10 hits\n", warm_time * 100.0,
+              warm_time ? base_time * 10.0 / warm_time : 0.0, warm_hits);
+
+  // the vm entries of the original file are still cached, the patched copy
+  // has to miss...
+  const auto copy = (tmp / "vm_bench.patched").string();
+  if (patched_copy(path, copy)) {
+    run(copy, cache, hit, time);
+    std::printf("> patched copy: %f ms, %s\n", time * 1000.0,
+                hit ? "[!] hit the original's vm entries" : "miss");
+    std::filesystem::remove(copy);
+  }
+
+  std::filesystem::remove_all(cache);
+}
+}  // namespace vm::bench
@@ -0,0 +1,72 @@
+#include <vmbench.hpp>
+
+#define BENCH_EVAL_MAX_HANDLERS 64u
+#define BENCH_EVAL_ROUNDS 16u
+
+namespace vm::bench {
+void eval(const module_t& module) {
+  vm::emu::engine_pool_t engines(*module.image, 1u);
+  auto lease = engines.lease();
+  if (!lease)
+    return;
+
+  auto& state = lease.state();
+  vm::emu::eval_t evaluator(lease);
+
+  std::uint32_t total = 0u, native = 0u, unicorn = 0u;
+  double native_time = 0.0, unicorn_time = 0.0;
+
+  for (const auto& entry : module.entries) {
+    vm::vmctx_t vmctx(module.module_base, module.image_base, module.image_size,
+                      entry.rva);
+    if (!vmctx.init())
+      continue;
+
+    vm::emu::engine_pool_t::reset(lease.engine());
+    if (!run_vm_enter(lease.uc(), module, vmctx))
+      continue;
+
+    std::uintptr_t rip = 0u;
+    const auto jmp = vmctx.get_vm_enter().back().instr;
+    uc_reg_read(lease.uc(), vm::instrs::uc_reg(jmp.operands[0].reg.value),
+                &rip);
+
+    // walk the handlers with unicorn-engine, timing both ways of running each
+    // of them from the same checkpoint...
+    for (auto idx = 0u; rip && idx < BENCH_EVAL_MAX_HANDLERS; ++idx) {
+      zydis_rtn_t rtn;
+      uc_reg_write(lease.uc(), UC_X86_REG_RIP, &rip);
+      if (!vm::utils::flatten(rtn, rip, true, 500, module.module_base))
+        break;
+
+      state.checkpoint();
+      auto start = std::chrono::steady_clock::now();
+      for (auto round = 0u; round < BENCH_EVAL_ROUNDS; ++round) {
+        state.rollback();
+        native += evaluator.run(rtn);
+      }
+      native_time += elapsed(start);
+
+      start = std::chrono::steady_clock::now();
+      for (auto round = 0u; round < BENCH_EVAL_ROUNDS; ++round) {
+        state.rollback();
+        unicorn += !uc_emu_start(lease.uc(), rip, 0ull, 0ull, rtn.size());
+      }
+      unicorn_time += elapsed(start);
+      total += BENCH_EVAL_ROUNDS;
+
+      if (rtn.back().instr.mnemonic == ZYDIS_MNEMONIC_RET)
+        break;
+
+      uc_reg_read(lease.uc(), UC_X86_REG_RIP, &rip);
+    }
+  }
+
+  std::printf("> %d handler runs, %d instructions handed to unicorn-engine\n",
+              total, evaluator.fallbacks());
+  std::printf("> unicorn-engine: %d ok, %f handlers/s\n", unicorn,
+              total / unicorn_time);
+  std::printf("> native evaluator: %d ok, %f handlers/s (%fx)\n", native,
+              total / native_time, unicorn_time / native_time);
+}
+}  // namespace vm::bench
@@ -0,0 +1,82 @@
+#include <vmbench.hpp>
+
+#define FORK_BENCH_ROUNDS 10u
+
+namespace vm::bench {
+void fork(const module_t& module) {
+  vm::sched::scheduler_t sched;
+  vm::emu::engine_pool_t engines(*module.image, sched.size() + 1u);
+  vm::vmenter_cache_t enters;
+
+  // the routine with the most virtual JCCs...
+  auto vrtns = vm::devirt(*module.image, module.entries, sched, engines,
+                          enters);
+  if (vrtns.empty())
+    return;
+
+  const auto jccs = [](const vm::instrs::vrtn_t& vrtn) {
+    return std::count_if(vrtn.m_blks.begin(), vrtn.m_blks.end(),
+                         [](const vm::instrs::vblk_t& blk) {
+                           return blk.branch_type ==
+                                  vm::instrs::vbranch_type::jcc;
+                         });
+  };
+
+  const auto largest = std::max_element(
+      vrtns.begin(), vrtns.end(),
+      [&](const vm::instrs::vrtn_t& a, const vm::instrs::vrtn_t& b) {
+        return jccs(a) < jccs(b);
+      });
+
+  const auto rva = largest->m_rva;
+  std::printf("> routine at rva 0x%x, %d blocks, %d jccs, %d rounds\n", rva,
+              largest->m_blks.size(), jccs(*largest), FORK_BENCH_ROUNDS);
+
+  for (auto& vrtn : vrtns)
+    vm::emu::release(vrtn);
+  vrtns.clear();
+
+  vm::emu::emu_t::fork_stats_t forks{0u, 0u, 0.0};
+  const auto start = std::chrono::steady_clock::now();
+  for (auto round = 0u; round < FORK_BENCH_ROUNDS; ++round) {
+    vm::vmctx_t vmctx(module.module_base, module.image_base, module.image_size,
+                      rva);
+    if (!vmctx.init(enters))
+      return;
+
+    vm::emu::emu_t emu(&vmctx, engines, &sched);
+    vm::instrs::vrtn_t vrtn;
+    if (!emu.init() || !emu.get_trace(vrtn))
+      return;
+
+    const auto stats = emu.forks();
+    forks.forks += stats.forks;
+    forks.pages += stats.pages;
+    forks.seconds += stats.seconds;
+    vm::emu::release(vrtn);
+  }
+  const auto time = elapsed(start) / FORK_BENCH_ROUNDS;
+
+  // what every block entry used to cost, a copy of the whole stack...
+  std::vector<std::uint8_t> copy;
+  const auto copy_start = std::chrono::steady_clock::now();
+  {
+    auto lease = engines.lease();
+    for (auto idx = 0u; idx < forks.forks; ++idx) {
+      std::vector<std::uint8_t> stack(lease.stack(),
+                                      lease.stack() + EMU_STACK_SIZE);
+      copy.swap(stack);
+    }
+  }
+  const auto copy_time = elapsed(copy_start);
+
+  const auto count = forks.forks ? forks.forks : 1u;
+  std::printf("> exploration: %f s per round\n", time);
+  std::printf(
+      "> %llu forks, %f pages copied per fork out of %llu, %f us per fork\n",
+      forks.forks, static_cast<double>(forks.pages) / count,
+      EMU_STACK_SIZE / EMU_PAGE_SIZE, forks.seconds * 1e6 / count);
+  std::printf("> full stack copy: %f us each, %llu KiB each\n",
+              copy_time * 1e6 / count, EMU_STACK_SIZE >> 10);
+}
+}  // namespace vm::bench
@@ -0,0 +1,81 @@
+#include <vmbench.hpp>
+
+#include <iterator>
+
+#if defined(_WIN32)
+#include <Windows.h>
+#include <psapi.h>
+#else
+#include <sys/resource.h>
+#endif
+
+namespace vm::bench {
+std::size_t peak_rss() {
+#if defined(_WIN32)
+  PROCESS_MEMORY_COUNTERS counters{};
+  GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof counters);
+  return counters.PeakWorkingSetSize;
+#else
+  rusage usage{};
+  getrusage(RUSAGE_SELF, &usage);
+  return static_cast<std::size_t>(usage.ru_maxrss) * 1024u;
+#endif
+}
+
+void reset_peak_rss() {
+#if !defined(_WIN32)
+  if (const auto file = std::fopen("/proc/self/clear_refs", "w")) {
+    std::fputs("5", file);
+    std::fclose(file);
+  }
+#endif
+}
+
+// the way open_binary_file used to read files, one byte at a time...
+static bool read_bytewise(const std::string& path,
+                          std::vector<std::uint8_t>& data) {
+  std::ifstream fstr(path, std::ios::binary);
+  if (!fstr.is_open())
+    return false;
+
+  fstr.unsetf(std::ios::skipws);
+  data.insert(data.begin(), std::istream_iterator<std::uint8_t>(fstr),
+              std::istream_iterator<std::uint8_t>());
+  return true;
+}
+
+void load(const std::string& path) {
+  const auto run = [&](const char* name, auto&& loader) {
+    reset_peak_rss();
+    const auto start = std::chrono::steady_clock::now();
+    const auto image = loader();
+    const auto time = elapsed(start);
+
+    if (!image) {
+      std::printf("[!] %s failed to load %s...\n", name, path.c_str());
+      return;
+    }
+
+    std::printf("> %s: %f ms, image size = 0x%llx, peak rss = %llu MiB\n",
+                name, time * 1000.0, image->m_image_size,
+                peak_rss() >> 20);
+  };
+
+  run("mmap (image_t::load)",
+      [&]() { return vm::image_t::load(path); });
+
+  run("read (open_binary_file) + image_t::map", [&]() {
+    std::vector<std::uint8_t> data;
+    return vm::utils::open_binary_file(path, data)
+               ? vm::image_t::map(data.data(), data.size())
+               : nullptr;
+  });
+
+  run("byte by byte istream_iterator + image_t::map", [&]() {
+    std::vector<std::uint8_t> data;
+    return read_bytewise(path, data)
+               ? vm::image_t::map(data.data(), data.size())
+               : nullptr;
+  });
+}
+}  // namespace vm::bench
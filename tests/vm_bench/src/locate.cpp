@@ -0,0 +1,42 @@
+#include <vmbench.hpp>
+
+namespace vm::bench {
+void locate(const std::string& path) {
+  // the raw file goes first, it is expected to have the smaller peak...
+  reset_peak_rss();
+  auto start = std::chrono::steady_clock::now();
+  std::vector<vm::locate::vm_enter_t> raw;
+  if (const auto file = vm::file_t::open(path))
+    raw = vm::locate::get_vm_entries(*file);
+
+  const auto raw_time = elapsed(start);
+  const auto raw_rss = peak_rss();
+
+  reset_peak_rss();
+  start = std::chrono::steady_clock::now();
+  std::vector<vm::locate::vm_enter_t> mapped;
+  if (const auto image = vm::image_t::load(path))
+    mapped = vm::locate::get_vm_entries(image->m_module_base,
+                                        image->m_image_size);
+
+  const auto mapped_time = elapsed(start);
+  const auto mapped_rss = peak_rss();
+
+  std::printf("> raw file: %d vm entries, %f ms, peak rss = %llu MiB\n",
+              raw.size(), raw_time * 1000.0, raw_rss >> 20);
+  std::printf("> mapped image: %d vm entries, %f ms, peak rss = %llu MiB\n",
+              mapped.size(), mapped_time * 1000.0, mapped_rss >> 20);
+
+  const auto same =
+      raw.size() == mapped.size() &&
+      std::equal(raw.begin(), raw.end(), mapped.begin(),
+                 [](const vm::locate::vm_enter_t& a,
+                    const vm::locate::vm_enter_t& b) {
+                   return a.rva == b.rva && a.encrypted_rva == b.encrypted_rva;
+                 });
+
+  if (!same)
+    std::printf("[!] the raw file and the mapped image have different vm "
+                "entries...\n");
+}
+}  // namespace vm::bench
@@ -0,0 +1,107 @@
+#include <cli-parser.hpp>
+#include <vmbench.hpp>
+
+int __cdecl main(int argc, const char* argv[]) {
+  argparse::argument_parser_t parser("VMBench",
+                                     "vmprofiler performance benchmarks");
+  parser.add_argument()
+      .name("--bin")
+      .description("path to unpacked virtualized binary...")
+      .required(true);
+
+  parser.add_argument()
+      .name("--bench")
+      .description(
+          "benchmark to run... load, reloc, locate, entcache, pool, state, "
+          "trace, eval, sched, vmctx, store, sink, arena, packed, blkcache, "
+          "routine, table, fork, compact, profdb")
+      .required(true);
+
+  parser.enable_help();
+  auto result = parser.parse(argc, argv);
+
+  if (result) {
+    std::printf("[!] error parsing commandline arguments... reason = %s\n",
+                result.what().c_str());
+    return -1;
+  }
+
+  if (parser.exists("help")) {
+    parser.print_help();
+    return 0;
+  }
+
+  vm::utils::init();
+  const auto bench = parser.get<std::string>("bench");
+  if (bench == "load") {
+    vm::bench::load(parser.get<std::string>("bin"));
+    return 0;
+  }
+
+  if (bench == "reloc") {
+    vm::bench::reloc(parser.get<std::string>("bin"));
+    return 0;
+  }
+
+  if (bench == "locate") {
+    vm::bench::locate(parser.get<std::string>("bin"));
+    return 0;
+  }
+
+  if (bench == "entcache") {
+    vm::bench::entcache(parser.get<std::string>("bin"));
+    return 0;
+  }
+
+  const auto image = vm::image_t::load(parser.get<std::string>("bin"));
+  if (!image) {
+    std::printf("[!] failed to open or map binary file...\n");
+    return -1;
+  }
+
+  const auto module_base = image->m_module_base;
+  const auto image_base = image->m_image_base;
+  const auto image_size = image->m_image_size;
+
+  vm::bench::module_t module{image.get(), module_base, image_base,
+                             image_size};
+  module.entries = vm::locate::get_vm_entries(module_base, image_size);
+  std::printf("> number of vm entries = %d\n", module.entries.size());
+
+  if (bench == "pool")
+    vm::bench::pool(module);
+  else if (bench == "state")
+    vm::bench::state(module);
+  else if (bench == "trace")
+    vm::bench::trace(module);
+  else if (bench == "eval")
+    vm::bench::eval(module);
+  else if (bench == "sched")
+    vm::bench::sched(module);
+  else if (bench == "vmctx")
+    vm::bench::vmctx(module);
+  else if (bench == "store")
+    vm::bench::store(module);
+  else if (bench == "sink")
+    vm::bench::sink(module);
+  else if (bench == "arena")
+    vm::bench::arena(module);
+  else if (bench == "packed")
+    vm::bench::packed(module);
+  else if (bench == "blkcache")
+    vm::bench::blkcache(module);
+  else if (bench == "routine")
+    vm::bench::routine(module);
+  else if (bench == "table")
+    vm::bench::table(module);
+  else if (bench == "fork")
+    vm::bench::fork(module);
+  else if (bench == "compact")
+    vm::bench::compact(module);
+  else if (bench == "profdb")
+    vm::bench::profdb(module);
+  else {
+    std::printf("[!] unknown benchmark... %s\n", bench.c_str());
+    return -1;
+  }
+}
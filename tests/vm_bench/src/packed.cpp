@@ -0,0 +1,81 @@
+#include <vmbench.hpp>
+
+#define PACKED_BENCH_VINSTRS 0x400000u
+#define PACKED_BENCH_ROUNDS 10u
+
+namespace vm::bench {
+void packed(const module_t& module) {
+  auto vrtns = vm::devirt(*module.image, module.entries);
+
+  // the blocks of every routine, repeated until there are enough virtual
+  // instructions that neither layout fits in the cache...
+  std::vector<std::vector<vm::instrs::vinstr_t>> unpacked;
+  std::vector<vm::instrs::packed_vinstrs_t> packed;
+  std::size_t count = 0u, unpacked_bytes = 0u, packed_bytes = 0u;
+  while (count < PACKED_BENCH_VINSTRS) {
+    const auto before = count;
+    for (const auto& vrtn : vrtns)
+      for (const auto& blk : vrtn.m_blks) {
+        unpacked.emplace_back(blk.m_vinstrs.begin(), blk.m_vinstrs.end());
+        packed.emplace_back(blk.m_vinstrs);
+        count += blk.m_vinstrs.size();
+        unpacked_bytes += blk.m_vinstrs.size() * sizeof(vm::instrs::vinstr_t);
+        packed_bytes += packed.back().bytes();
+      }
+
+    if (count == before)
+      break;
+  }
+
+  for (auto& vrtn : vrtns)
+    vm::emu::release(vrtn);
+
+  std::printf("> %d blocks, %d virtual instructions, vector %d bytes, packed "
+              "%d bytes\n",
+              packed.size(), count, unpacked_bytes, packed_bytes);
+
+  // every field of every virtual instruction...
+  std::uint64_t sum = 0u;
+  auto start = std::chrono::steady_clock::now();
+  for (auto round = 0u; round < PACKED_BENCH_ROUNDS; ++round)
+    for (const auto& vinstrs : unpacked)
+      for (const auto& vinstr : vinstrs)
+        sum += static_cast<std::uint64_t>(vinstr.mnemonic) +
+               vinstr.stack_size + vinstr.imm.val;
+  const auto unpacked_full = elapsed(start) / PACKED_BENCH_ROUNDS;
+
+  std::uint64_t packed_sum = 0u;
+  start = std::chrono::steady_clock::now();
+  for (auto round = 0u; round < PACKED_BENCH_ROUNDS; ++round)
+    for (const auto& vinstrs : packed)
+      for (const auto vinstr : vinstrs)
+        packed_sum += static_cast<std::uint64_t>(vinstr.mnemonic) +
+                      vinstr.stack_size + vinstr.imm.val;
+  const auto packed_full = elapsed(start) / PACKED_BENCH_ROUNDS;
+
+  // only mnemonics, the way most passes look for a virtual instruction...
+  std::size_t lconsts = 0u;
+  start = std::chrono::steady_clock::now();
+  for (auto round = 0u; round < PACKED_BENCH_ROUNDS; ++round)
+    for (const auto& vinstrs : unpacked)
+      for (const auto& vinstr : vinstrs)
+        lconsts += vinstr.mnemonic == vm::instrs::mnemonic_t::lconst;
+  const auto unpacked_mnemonics = elapsed(start) / PACKED_BENCH_ROUNDS;
+
+  std::size_t packed_lconsts = 0u;
+  start = std::chrono::steady_clock::now();
+  for (auto round = 0u; round < PACKED_BENCH_ROUNDS; ++round)
+    for (const auto& vinstrs : packed)
+      for (const auto mnemonic : vinstrs.mnemonics())
+        packed_lconsts += mnemonic == vm::instrs::mnemonic_t::lconst;
+  const auto packed_mnemonics = elapsed(start) / PACKED_BENCH_ROUNDS;
+
+  std::printf("> full scan: vector %f s, packed %f s (%fx)%s\n", unpacked_full,
+              packed_full, unpacked_full / packed_full,
+              sum == packed_sum ? "" : " [!] results differ");
+  std::printf("> mnemonic scan: vector %f s, packed %f s (%fx)%s\n",
+              unpacked_mnemonics, packed_mnemonics,
+              unpacked_mnemonics / packed_mnemonics,
+              lconsts == packed_lconsts ? "" : " [!] results differ");
+}
+}  // namespace vm::bench
@@ -0,0 +1,57 @@
+#include <vmbench.hpp>
+
+namespace vm::bench {
+void pool(const module_t& module) {
+  std::vector<vm::vmctx_t> vmctxs;
+  for (const auto& entry : module.entries) {
+    vm::vmctx_t vmctx(module.module_base, module.image_base, module.image_size,
+                      entry.rva);
+    if (vmctx.init())
+      vmctxs.push_back(std::move(vmctx));
+  }
+
+  std::printf("> emulating %d vm enters...\n", vmctxs.size());
+
+  auto start = std::chrono::steady_clock::now();
+  std::uint32_t fresh_ok = 0u;
+  for (const auto& vmctx : vmctxs) {
+    const auto engine =
+        vm::emu::engine_pool_t::create(module.module_base, module.image_size);
+    if (!engine)
+      return;
+
+    fresh_ok += run_vm_enter(engine->uc, module, vmctx);
+    vm::emu::engine_pool_t::destroy(engine);
+  }
+
+  const auto fresh_time = elapsed(start);
+
+  // lease, emulate and return every vm enter through a single pooled engine...
+  const auto run_pooled = [&](vm::emu::engine_pool_t& engines,
+                              std::uint32_t& ok) -> double {
+    const auto start = std::chrono::steady_clock::now();
+    for (const auto& vmctx : vmctxs) {
+      auto lease = engines.lease();
+      if (!lease)
+        break;
+
+      ok += run_vm_enter(lease.uc(), module, vmctx);
+    }
+    return elapsed(start);
+  };
+
+  std::uint32_t pooled_ok = 0u, cow_ok = 0u;
+  vm::emu::engine_pool_t engines(module.module_base, module.image_size, 1u);
+  vm::emu::engine_pool_t cow_engines(*module.image, 1u);
+
+  const auto pooled_time = run_pooled(engines, pooled_ok);
+  const auto cow_time = run_pooled(cow_engines, cow_ok);
+
+  std::printf("> fresh engine per entry: %d ok, %f entries/s\n", fresh_ok,
+              vmctxs.size() / fresh_time);
+  std::printf("> pooled engine: %d ok, %f entries/s (%fx)\n", pooled_ok,
+              vmctxs.size() / pooled_time, fresh_time / pooled_time);
+  std::printf("> pooled engine, copy-on-write image: %d ok, %f entries/s (%fx)\n",
+              cow_ok, vmctxs.size() / cow_time, fresh_time / cow_time);
+}
+}  // namespace vm::bench
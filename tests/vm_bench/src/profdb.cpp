@@ -0,0 +1,58 @@
+#include <filesystem>
+#include <vmbench.hpp>
+
+namespace vm::bench {
+void profdb(const module_t& module) {
+  auto start = std::chrono::steady_clock::now();
+  auto expected = vm::devirt(*module.image, module.entries);
+  const auto base_time = elapsed(start);
+
+  std::size_t vinstrs = 0u;
+  for (const auto& vrtn : expected)
+    for (const auto& blk : vrtn.m_blks)
+      vinstrs += blk.m_vinstrs.size();
+
+  std::printf("> no database: %d routines, %d vm handlers, %f s\n",
+              expected.size(), vinstrs, base_time);
+
+  const auto path =
+      (std::filesystem::temp_directory_path() / "vm_bench.vmpd").string();
+  std::filesystem::remove(path);
+
+  // the second analysis starts from what the first one saved, the same as
+  // analyzing the next build would...
+  for (auto run = 0u; run < 2u; ++run) {
+    const auto db = vm::profdb::db_t::open(path);
+    if (!db) {
+      std::printf("[!] failed to open %s...\n", path.c_str());
+      break;
+    }
+
+    const auto known = db->size();
+    start = std::chrono::steady_clock::now();
+    auto vrtns = vm::devirt(*module.image, module.entries, 0u,
+                            vm::mem::policy_t::arena, nullptr, nullptr,
+                            db.get());
+    const auto time = elapsed(start);
+    const auto stats = db->stats();
+
+    std::printf(
+        "> %s analysis: %f s (%fx), %d profiles known, %llu/%llu vm handlers "
+        "untraced (%f%%), %llu profiles added%s\n",
+        run ? "second" : "first", time, base_time / time, known, stats.hits,
+        stats.lookups, stats.lookups ? stats.hits * 100.0 / stats.lookups : 0.0,
+        stats.inserted,
+        same(expected, vrtns) ? "" : " [!] differs from no database");
+
+    if (!db->save())
+      std::printf("[!] failed to save %s...\n", path.c_str());
+
+    for (auto& vrtn : vrtns)
+      vm::emu::release(vrtn);
+  }
+
+  for (auto& vrtn : expected)
+    vm::emu::release(vrtn);
+  std::filesystem::remove(path);
+}
+}  // namespace vm::bench
@@ -0,0 +1,43 @@
+#include <vmbench.hpp>
+
+namespace vm::bench {
+void reloc(const std::string& path) {
+  // a scheduler which is already running, the way a job mapping more than
+  // one image passes its own...
+  vm::sched::scheduler_t sched;
+  const std::tuple<const char*, vm::reloc_mode_t, vm::sched::scheduler_t*>
+      modes[] = {{"eager", vm::reloc_mode_t::eager, nullptr},
+                 {"parallel", vm::reloc_mode_t::parallel, nullptr},
+                 {"parallel (shared scheduler)", vm::reloc_mode_t::parallel,
+                  &sched},
+                 {"lazy", vm::reloc_mode_t::lazy, nullptr}};
+
+  for (const auto& [name, mode, shared] : modes) {
+    const auto start = std::chrono::steady_clock::now();
+    const auto image = vm::image_t::load(path, mode, shared);
+    if (!image) {
+      std::printf("[!] failed to load %s...\n", path.c_str());
+      return;
+    }
+
+    const auto load_time = elapsed(start);
+    const auto entries =
+        vm::locate::get_vm_entries(image->m_module_base, image->m_image_size);
+
+    // time to first analysis... the first vm entry which initializes...
+    std::uint32_t analyzed = 0u;
+    for (const auto& entry : entries) {
+      vm::vmctx_t vmctx(image->m_module_base, image->m_image_base,
+                        image->m_image_size, entry.rva);
+      if (vmctx.init() && ++analyzed)
+        break;
+    }
+
+    std::printf(
+        "> %s: load %f ms, first analysis %f ms, %d vm entries, %d pages "
+        "never relocated\n",
+        name, load_time * 1000.0, elapsed(start) * 1000.0, entries.size(),
+        image->pending());
+  }
+}
+}  // namespace vm::bench
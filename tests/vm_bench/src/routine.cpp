@@ -0,0 +1,63 @@
+#include <vmbench.hpp>
+
+#define ROUTINE_BENCH_BLKS 5000u
+
+namespace vm::bench {
+void routine(const module_t& module) {
+  // the routine with the most blocks...
+  auto vrtns = vm::devirt(*module.image, module.entries);
+  if (vrtns.empty())
+    return;
+
+  const auto largest = std::max_element(
+      vrtns.begin(), vrtns.end(),
+      [](const vm::instrs::vrtn_t& a, const vm::instrs::vrtn_t& b) {
+        return a.m_blks.size() < b.m_blks.size();
+      });
+
+  const std::vector<vm::locate::vm_enter_t> entry = {{largest->m_rva, 0u}};
+  std::printf("> largest routine at rva 0x%x, %d blocks\n", largest->m_rva,
+              largest->m_blks.size());
+
+  if (largest->m_blks.size() < ROUTINE_BENCH_BLKS)
+    std::printf("[!] less than %d blocks, scaling will be limited...\n",
+                ROUTINE_BENCH_BLKS);
+
+  for (auto& vrtn : vrtns)
+    vm::emu::release(vrtn);
+  vrtns.clear();
+
+  std::vector<vm::instrs::vrtn_t> expected;
+  double base_time = 0.0;
+
+  // only the blocks of the one routine are spread over the threads...
+  for (auto threads = 1u; threads <= 64u; threads *= 2u) {
+    vm::sched::scheduler_t sched(threads);
+    vm::emu::engine_pool_t engines(*module.image, sched.size() + 1u);
+    vm::vmenter_cache_t enters;
+
+    const auto start = std::chrono::steady_clock::now();
+    auto result = vm::devirt(*module.image, entry, sched, engines, enters);
+    const auto time = elapsed(start);
+    const auto blks = result.empty() ? 0u : result[0].m_blks.size();
+
+    if (threads == 1u) {
+      base_time = time;
+      expected = std::move(result);
+      std::printf("> 1 thread: %d blocks, %f s, %f blocks/s\n", blks, time,
+                  blks / time);
+      continue;
+    }
+
+    std::printf("> %d threads: %d blocks, %f s, %f blocks/s (%fx)%s\n",
+                threads, blks, time, blks / time, base_time / time,
+                same(expected, result) ? "" : " [!] differs from 1 thread");
+
+    for (auto& vrtn : result)
+      vm::emu::release(vrtn);
+  }
+
+  for (auto& vrtn : expected)
+    vm::emu::release(vrtn);
+}
+}  // namespace vm::bench
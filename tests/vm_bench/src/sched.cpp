@@ -0,0 +1,36 @@
+#include <vmbench.hpp>
+
+namespace vm::bench {
+void sched(const module_t& module) {
+  std::vector<vm::instrs::vrtn_t> expected;
+  double base_time = 0.0;
+
+  for (auto threads = 1u; threads <= 64u; threads *= 2u) {
+    const auto start = std::chrono::steady_clock::now();
+    auto vrtns = vm::devirt(*module.image, module.entries, threads);
+    const auto time = elapsed(start);
+
+    std::size_t blks = 0u;
+    for (const auto& vrtn : vrtns)
+      blks += vrtn.m_blks.size();
+
+    if (threads == 1u) {
+      base_time = time;
+      expected = std::move(vrtns);
+      std::printf("> 1 thread: %d routines, %d blocks, %f s\n", expected.size(),
+                  blks, time);
+      continue;
+    }
+
+    std::printf("> %d threads: %d routines, %d blocks, %f s (%fx)%s\n",
+                threads, vrtns.size(), blks, time, base_time / time,
+                same(expected, vrtns) ? "" : " [!] differs from 1 thread");
+
+    for (auto& vrtn : vrtns)
+      vm::emu::release(vrtn);
+  }
+
+  for (auto& vrtn : expected)
+    vm::emu::release(vrtn);
+}
+}  // namespace vm::bench
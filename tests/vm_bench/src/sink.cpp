@@ -0,0 +1,82 @@
+#include <filesystem>
+#include <vmbench.hpp>
+
+namespace vm::bench {
+void sink(const module_t& module) {
+  vm::sched::scheduler_t sched;
+  vm::emu::engine_pool_t engines(*module.image, sched.size() + 1u);
+  vm::vmenter_cache_t enters;
+  const auto path =
+      (std::filesystem::temp_directory_path() / "vm_bench.vmst").string();
+
+  // streamed first since its peak is expected to be the smaller one... every
+  // block goes straight into a store, the way a lifter would consume it.
+  reset_peak_rss();
+  const auto base = g_allocation_tracker.load();
+  std::size_t streamed = 0u, most_live = 0u;
+  auto start = std::chrono::steady_clock::now();
+  {
+    const auto writer = vm::store::writer_t::open(path);
+    writer->begin("bench");
+    for (const auto& entry : module.entries) {
+      vm::vmctx_t vmctx(module.module_base, module.image_base,
+                        module.image_size, entry.rva);
+      if (!vmctx.init(enters))
+        continue;
+
+      vm::emu::emu_t emu(&vmctx, engines, &sched);
+      if (!emu.init())
+        continue;
+
+      emu.get_trace([&](vm::instrs::vblk_t& blk) {
+        const auto live = g_allocation_tracker.load() - base;
+        most_live = std::max<std::size_t>(most_live, live);
+        writer->add(blk, module.module_base);
+        ++streamed;
+      });
+      writer->end(entry.rva);
+    }
+    writer->finish();
+  }
+  const auto stream_time = elapsed(start);
+  const auto stream_rss = peak_rss();
+
+  std::printf(
+      "> streamed: %d blocks, %f s, at most %d uc_contexts alive, peak rss = "
+      "%llu MiB\n",
+      streamed, stream_time, most_live, stream_rss >> 20);
+
+  // every routine is kept whole until the last one is done, the way devirt
+  // hands them back...
+  reset_peak_rss();
+  std::size_t kept = 0u;
+  std::vector<vm::instrs::vrtn_t> vrtns;
+  start = std::chrono::steady_clock::now();
+  for (const auto& entry : module.entries) {
+    vm::vmctx_t vmctx(module.module_base, module.image_base, module.image_size,
+                      entry.rva);
+    if (!vmctx.init(enters))
+      continue;
+
+    vm::emu::emu_t emu(&vmctx, engines, &sched);
+    vm::instrs::vrtn_t vrtn;
+    if (!emu.init() || !emu.get_trace(vrtn))
+      continue;
+
+    kept += vrtn.m_blks.size();
+    vrtns.push_back(std::move(vrtn));
+  }
+  const auto keep_time = elapsed(start);
+  const auto keep_live = g_allocation_tracker.load() - base;
+
+  std::printf(
+      "> kept: %d blocks, %f s, %d uc_contexts alive at the end, peak rss = "
+      "%llu MiB\n",
+      kept, keep_time, keep_live, peak_rss() >> 20);
+
+  for (auto& vrtn : vrtns)
+    vm::emu::release(vrtn);
+
+  std::filesystem::remove(path);
+}
+}  // namespace vm::bench
@@ -0,0 +1,74 @@
+#include <vmbench.hpp>
+
+namespace vm::bench {
+void state(const module_t& module) {
+  std::vector<vm::vmctx_t> vmctxs;
+  for (const auto& entry : module.entries) {
+    vm::vmctx_t vmctx(module.module_base, module.image_base, module.image_size,
+                      entry.rva);
+    if (vmctx.init())
+      vmctxs.push_back(std::move(vmctx));
+  }
+
+  std::printf("> emulating %d vm enters...\n", vmctxs.size());
+  vm::emu::engine_pool_t plain_engines(*module.image, 1u),
+      tracked_engines(*module.image, 1u);
+
+  double plain_time = 0.0, tracked_time = 0.0, rollback_time = 0.0,
+         copy_time = 0.0;
+  std::size_t dirty_pages = 0u;
+
+  auto stack_copy = std::make_unique<std::uint8_t[]>(EMU_STACK_SIZE);
+  for (const auto& vmctx : vmctxs) {
+    const auto begin = module.module_base + vmctx.m_vm_entry_rva;
+    const auto until = vmctx.get_vm_enter().back().addr;
+    {
+      auto lease = plain_engines.lease();
+      const auto start = std::chrono::steady_clock::now();
+      uc_emu_start(lease.uc(), begin, until, 0ull, 0ull);
+      plain_time += elapsed(start);
+    }
+
+    auto lease = tracked_engines.lease();
+    auto& state = lease.state();
+
+    // the old way of getting back to the checkpoint, a copy of the whole
+    // stack and a saved context...
+    uc_context* ctx;
+    uct_context_alloc(lease.uc(), &ctx);
+    uc_context_save(lease.uc(), ctx);
+    std::memcpy(stack_copy.get(), lease.stack(), EMU_STACK_SIZE);
+
+    state.checkpoint();
+    auto start = std::chrono::steady_clock::now();
+    uc_emu_start(lease.uc(), begin, until, 0ull, 0ull);
+    tracked_time += elapsed(start);
+    dirty_pages += state.dirty();
+
+    start = std::chrono::steady_clock::now();
+    std::memcpy(lease.stack(), stack_copy.get(), EMU_STACK_SIZE);
+    uc_context_restore(lease.uc(), ctx);
+    copy_time += elapsed(start);
+    uct_context_free(ctx);
+
+    // dirty the same pages again so the rollback has something to restore...
+    uc_emu_start(lease.uc(), begin, until, 0ull, 0ull);
+    start = std::chrono::steady_clock::now();
+    state.rollback();
+    rollback_time += elapsed(start);
+  }
+
+  const auto count = std::max<std::size_t>(vmctxs.size(), 1u);
+  std::printf("> emulation without write hook: %f us/entry\n",
+              plain_time / count * 1e6);
+  std::printf("> emulation with write hook: %f us/entry (%f%% overhead)\n",
+              tracked_time / count * 1e6,
+              (tracked_time - plain_time) / plain_time * 100.0);
+  std::printf("> average dirty pages: %f\n",
+              static_cast<double>(dirty_pages) / count);
+  std::printf("> full stack copy restore: %f us/entry\n",
+              copy_time / count * 1e6);
+  std::printf("> dirty page rollback: %f us/entry (%fx)\n",
+              rollback_time / count * 1e6, copy_time / rollback_time);
+}
+}  // namespace vm::bench
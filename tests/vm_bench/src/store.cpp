@@ -0,0 +1,271 @@
+#include <filesystem>
+#include <vmbench.hpp>
+
+#define STORE_BENCH_ROUNDS 10u
+
+namespace vm::bench {
+// the same fields vm::store::writer_t stores, as json...
+static std::string to_json(const std::vector<vm::instrs::vrtn_t>& vrtns) {
+  std::string json = "[";
+  char buf[64];
+  const auto num = [&](const char* key, std::uint64_t val) {
+    std::snprintf(buf, sizeof buf, "\"%s\":%llu,", key, val);
+    json += buf;
+  };
+
+  for (const auto& vrtn : vrtns) {
+    json += "{";
+    num("rva", vrtn.m_rva);
+    json += "\"blks\":[";
+    for (const auto& blk : vrtn.m_blks) {
+      json += "{";
+      num("rva", blk.m_vip.rva);
+      num("img_based", blk.m_vip.img_based);
+      num("vip", blk.m_vm.vip);
+      num("vsp", blk.m_vm.vsp);
+      num("jmp_rip", blk.m_jmp.rip);
+      num("jmp_vip", blk.m_jmp.m_vm.vip);
+      num("jmp_vsp", blk.m_jmp.m_vm.vsp);
+      num("branch_type", static_cast<std::uint64_t>(blk.branch_type));
+      num("is_branch", blk.is_branch);
+      json += "\"pops\":[";
+      for (const auto reg : blk.vmexit_pop_order) {
+        if (reg == ZYDIS_REGISTER_NONE)
+          break;
+        json += std::to_string(reg) + ",";
+      }
+      if (json.back() == ',')
+        json.pop_back();
+      json += "],\"vinstrs\":[";
+      for (const auto& vinstr : blk.m_vinstrs) {
+        json += "{";
+        num("mnemonic", static_cast<std::uint64_t>(vinstr.mnemonic));
+        num("stack_size", vinstr.stack_size);
+        num("has_imm", vinstr.imm.has_imm);
+        num("imm_size", vinstr.imm.size);
+        num("imm", vinstr.imm.val);
+        json.back() = '}';
+        json += ",";
+      }
+      if (json.back() == ',')
+        json.pop_back();
+      json += "],\"branches\":[";
+      for (const auto branch : blk.branches)
+        json += std::to_string(branch) + ",";
+      if (json.back() == ',')
+        json.pop_back();
+      json += "]},";
+    }
+    if (json.back() == ',')
+      json.pop_back();
+    json += "]},";
+  }
+  if (json.back() == ',')
+    json.pop_back();
+  return json += "]";
+}
+
+// just enough of a json parser for what to_json writes...
+class json_t {
+ public:
+  explicit json_t(const std::string& json) : m_pos(json.c_str()) {}
+
+  std::uint64_t num() {
+    char* end = nullptr;
+    const auto val = std::strtoull(m_pos, &end, 10);
+    m_pos = end;
+    return val;
+  }
+
+  template <class T>
+  void array(T&& element) {
+    ++m_pos;  // [
+    while (*m_pos != ']') {
+      element();
+      if (*m_pos == ',')
+        ++m_pos;
+    }
+    ++m_pos;
+  }
+
+  template <class T>
+  void object(T&& member) {
+    ++m_pos;  // {
+    while (*m_pos != '}') {
+      const auto key = ++m_pos;  // "
+      while (*m_pos != '"')
+        ++m_pos;
+      const std::string_view name(key, m_pos - key);
+      m_pos += 2;  // ":
+      member(name);
+      if (*m_pos == ',')
+        ++m_pos;
+    }
+    ++m_pos;
+  }
+
+ private:
+  const char* m_pos;
+};
+
+static std::vector<vm::instrs::vrtn_t> from_json(const std::string& data) {
+  std::vector<vm::instrs::vrtn_t> vrtns;
+  json_t json(data);
+  json.array([&]() {
+    auto& vrtn = vrtns.emplace_back();
+    json.object([&](std::string_view key) {
+      if (key == "rva")
+        vrtn.m_rva = json.num();
+      else if (key == "blks")
+        json.array([&]() {
+          auto& blk = vrtn.m_blks.emplace_back();
+          blk.vmexit_pop_order.fill(ZYDIS_REGISTER_NONE);
+          json.object([&](std::string_view key) {
+            if (key == "rva")
+              blk.m_vip.rva = json.num();
+            else if (key == "img_based")
+              blk.m_vip.img_based = json.num();
+            else if (key == "vip")
+              blk.m_vm.vip = static_cast<zydis_reg_t>(json.num());
+            else if (key == "vsp")
+              blk.m_vm.vsp = static_cast<zydis_reg_t>(json.num());
+            else if (key == "jmp_rip")
+              blk.m_jmp.rip = json.num();
+            else if (key == "jmp_vip")
+              blk.m_jmp.m_vm.vip = static_cast<zydis_reg_t>(json.num());
+            else if (key == "jmp_vsp")
+              blk.m_jmp.m_vm.vsp = static_cast<zydis_reg_t>(json.num());
+            else if (key == "branch_type")
+              blk.branch_type =
+                  static_cast<vm::instrs::vbranch_type>(json.num());
+            else if (key == "is_branch")
+              blk.is_branch = json.num();
+            else if (key == "pops") {
+              auto idx = 0u;
+              json.array([&]() {
+                blk.vmexit_pop_order[idx++] =
+                    static_cast<ZydisRegister>(json.num());
+              });
+            } else if (key == "vinstrs")
+              json.array([&]() {
+                auto& vinstr = blk.m_vinstrs.emplace_back();
+                json.object([&](std::string_view key) {
+                  const auto val = json.num();
+                  if (key == "mnemonic")
+                    vinstr.mnemonic = static_cast<vm::instrs::mnemonic_t>(val);
+                  else if (key == "stack_size")
+                    vinstr.stack_size = val;
+                  else if (key == "has_imm")
+                    vinstr.imm.has_imm = val;
+                  else if (key == "imm_size")
+                    vinstr.imm.size = val;
+                  else if (key == "imm")
+                    vinstr.imm.val = val;
+                });
+              });
+            else if (key == "branches")
+              json.array([&]() { blk.branches.push_back(json.num()); });
+          });
+        });
+    });
+  });
+  return vrtns;
+}
+
+// sums every virtual instruction immediate so that nothing can be skipped...
+static std::uint64_t checksum(const std::vector<vm::instrs::vrtn_t>& vrtns) {
+  std::uint64_t sum = 0u;
+  for (const auto& vrtn : vrtns)
+    for (const auto& blk : vrtn.m_blks)
+      for (const auto& vinstr : blk.m_vinstrs)
+        sum += vinstr.imm.val + static_cast<std::uint64_t>(vinstr.mnemonic);
+  return sum;
+}
+
+void store(const module_t& module) {
+  auto vrtns = vm::devirt(*module.image, module.entries);
+  for (auto& vrtn : vrtns)
+    vm::emu::release(vrtn);
+
+  const auto expected = checksum(vrtns);
+  const auto dir = std::filesystem::temp_directory_path();
+  const auto store_path = (dir / "vm_bench.vmst").string();
+  const auto json_path = (dir / "vm_bench.json").string();
+  std::printf("> %d routines, checksum %llx, %d rounds\n", vrtns.size(),
+              expected, STORE_BENCH_ROUNDS);
+
+  // streamed straight to disk, one routine at a time...
+  auto start = std::chrono::steady_clock::now();
+  for (auto round = 0u; round < STORE_BENCH_ROUNDS; ++round) {
+    const auto writer = vm::store::writer_t::open(store_path);
+    writer->begin("bench");
+    for (const auto& vrtn : vrtns)
+      writer->add(vrtn, module.module_base);
+    writer->finish();
+  }
+  const auto store_write = elapsed(start) / STORE_BENCH_ROUNDS;
+
+  // walked in place through the mapping, no copies...
+  std::uint64_t sum = 0u;
+  start = std::chrono::steady_clock::now();
+  for (auto round = 0u; round < STORE_BENCH_ROUNDS; ++round) {
+    const auto view = vm::store::view_t::open(store_path);
+    const auto rtns = (*view)[0];
+    sum = 0u;
+    for (auto rtn = 0u; rtn < rtns.size(); ++rtn)
+      for (auto blk = 0u; blk < rtns[rtn].size(); ++blk)
+        for (const auto& vinstr : rtns[rtn][blk].vinstrs())
+          sum += vinstr.imm.val + static_cast<std::uint64_t>(vinstr.mnemonic);
+  }
+  const auto store_view = elapsed(start) / STORE_BENCH_ROUNDS;
+
+  // copied back into vrtn_t's, the same as the json has to be...
+  std::vector<vm::instrs::vrtn_t> loaded;
+  start = std::chrono::steady_clock::now();
+  for (auto round = 0u; round < STORE_BENCH_ROUNDS; ++round) {
+    const auto view = vm::store::view_t::open(store_path);
+    const auto rtns = (*view)[0];
+    loaded.clear();
+    for (auto rtn = 0u; rtn < rtns.size(); ++rtn)
+      loaded.push_back(rtns[rtn].get());
+  }
+  const auto store_load = elapsed(start) / STORE_BENCH_ROUNDS;
+  const auto store_ok = sum == expected && checksum(loaded) == expected;
+
+  start = std::chrono::steady_clock::now();
+  for (auto round = 0u; round < STORE_BENCH_ROUNDS; ++round) {
+    const auto json = to_json(vrtns);
+    std::ofstream file(json_path, std::ios::binary | std::ios::trunc);
+    file.write(json.data(), json.size());
+  }
+  const auto json_write = elapsed(start) / STORE_BENCH_ROUNDS;
+
+  start = std::chrono::steady_clock::now();
+  for (auto round = 0u; round < STORE_BENCH_ROUNDS; ++round) {
+    std::vector<std::uint8_t> data;
+    vm::utils::open_binary_file(json_path, data);
+    loaded = from_json(std::string(data.begin(), data.end()));
+  }
+  const auto json_load = elapsed(start) / STORE_BENCH_ROUNDS;
+  const auto json_ok = checksum(loaded) == expected;
+
+  const auto store_size = std::filesystem::file_size(store_path);
+  const auto json_size = std::filesystem::file_size(json_path);
+
+  std::printf(
+      "> store: %d bytes, write %f s (%f MB/s), view %f s, load %f s%s\n",
+      store_size, store_write, store_size / store_write / 1e6, store_view,
+      store_load, store_ok ? "" : " [!] checksum mismatch");
+  std::printf("> json: %d bytes, write %f s (%f MB/s), load %f s%s\n",
+              json_size, json_write, json_size / json_write / 1e6, json_load,
+              json_ok ? "" : " [!] checksum mismatch");
+  std::printf("> store is %fx smaller, writes %fx and loads %fx faster, %fx "
+              "faster viewed in place\n",
+              static_cast<double>(json_size) / store_size,
+              json_write / store_write, json_load / store_load,
+              json_load / store_view);
+
+  std::filesystem::remove(store_path);
+  std::filesystem::remove(json_path);
+}
+}  // namespace vm::bench
@@ -0,0 +1,47 @@
+#include <vmbench.hpp>
+
+namespace vm::bench {
+void table(const module_t& module) {
+  vm::sched::scheduler_t sched;
+  vm::emu::engine_pool_t engines(*module.image, sched.size() + 1u);
+  vm::vmenter_cache_t enters;
+
+  std::size_t blks = 0u, branches = 0u;
+  vm::emu::emu_t::table_stats_t tables{0u, 0u, 0.0};
+  const auto start = std::chrono::steady_clock::now();
+  for (const auto& entry : module.entries) {
+    vm::vmctx_t vmctx(module.module_base, module.image_base, module.image_size,
+                      entry.rva);
+    if (!vmctx.init(enters))
+      continue;
+
+    vm::emu::emu_t emu(&vmctx, engines, &sched);
+    vm::instrs::vrtn_t vrtn;
+    if (!emu.init() || !emu.get_trace(vrtn))
+      continue;
+
+    blks += vrtn.m_blks.size();
+    for (const auto& blk : vrtn.m_blks)
+      if (blk.branch_type == vm::instrs::vbranch_type::table)
+        branches += blk.branches.size();
+
+    const auto stats = emu.tables();
+    tables.tables += stats.tables;
+    tables.entries += stats.entries;
+    tables.seconds += stats.seconds;
+    vm::emu::release(vrtn);
+  }
+  const auto time = elapsed(start);
+
+  std::printf("> %d blocks, %f s, %f us per block emulated\n", blks, time,
+              blks ? time * 1e6 / blks : 0.0);
+
+  // the time is summed over every thread, the same as the time per block is
+  // over the wall clock... compare it to the time per block.
+  std::printf(
+      "> %llu jump tables, %llu entries evaluated, %d branches, %f s, %f us "
+      "per entry\n",
+      tables.tables, tables.entries, branches, tables.seconds,
+      tables.entries ? tables.seconds * 1e6 / tables.entries : 0.0);
+}
+}  // namespace vm::bench
@@ -0,0 +1,86 @@
+#include <vmbench.hpp>
+
+#define BENCH_TRACE_MAX_HANDLERS 64u
+
+namespace vm::bench {
+// trace, deobfuscate and profile up to BENCH_TRACE_MAX_HANDLERS vm handlers
+// along the path the vm enter takes... returns the number of handlers traced.
+static std::uint32_t trace_path(vm::emu::lease_t& lease,
+                                vm::emu::trace_mode_t mode,
+                                const module_t& module,
+                                const vm::vmctx_t& vmctx) {
+  auto& tracer = lease.tracer(mode);
+  if (!run_vm_enter(lease.uc(), module, vmctx))
+    return 0u;
+
+  // the vm enter ends with a JMP REG into the first vm handler...
+  std::uintptr_t rip = 0u;
+  const auto jmp = vmctx.get_vm_enter().back().instr;
+  uc_reg_read(lease.uc(), vm::instrs::uc_reg(jmp.operands[0].reg.value), &rip);
+
+  vm::instrs::hndlr_trace_t hndlr{};
+  zydis_reg_t vip = vmctx.get_vip(), vsp = vmctx.get_vsp();
+  std::uint32_t traced = 0u;
+
+  while (rip && traced < BENCH_TRACE_MAX_HANDLERS) {
+    std::uintptr_t next = 0u;
+    if (!tracer.trace(rip, vip, vsp, hndlr, next))
+      break;
+
+    vm::instrs::deobfuscate(hndlr);
+    vm::instrs::determine(hndlr);
+
+    vip = hndlr.m_vip;
+    vsp = hndlr.m_vsp;
+    rip = next;
+    ++traced;
+  }
+
+  vm::instrs::release(hndlr);
+  return traced;
+}
+
+void trace(const module_t& module) {
+  vm::instrs::init();
+  std::vector<vm::vmctx_t> vmctxs;
+  for (const auto& entry : module.entries) {
+    vm::vmctx_t vmctx(module.module_base, module.image_base, module.image_size,
+                      entry.rva);
+    if (vmctx.init())
+      vmctxs.push_back(std::move(vmctx));
+  }
+
+  std::printf("> tracing from %d vm enters...\n", vmctxs.size());
+  vm::emu::engine_pool_t engines(*module.image, 1u);
+
+  const auto run = [&](vm::emu::trace_mode_t mode,
+                       std::uint32_t& handlers) -> double {
+    const auto start = std::chrono::steady_clock::now();
+    for (const auto& vmctx : vmctxs) {
+      auto lease = engines.lease();
+      if (!lease)
+        break;
+
+      handlers += trace_path(lease, mode, module, vmctx);
+    }
+
+    return elapsed(start);
+  };
+
+  // warm up run, so that neither mode pays for the first touch of the image...
+  std::uint32_t warm = 0u, instr_handlers = 0u, block_handlers = 0u;
+  run(vm::emu::trace_mode_t::block, warm);
+
+  const auto instr_time = run(vm::emu::trace_mode_t::instr, instr_handlers);
+  const auto block_time = run(vm::emu::trace_mode_t::block, block_handlers);
+
+  std::printf("> UC_HOOK_CODE: %d handlers, %f handlers/s\n", instr_handlers,
+              instr_handlers / instr_time);
+  std::printf("> UC_HOOK_BLOCK: %d handlers, %f handlers/s (%fx)\n",
+              block_handlers, block_handlers / block_time,
+              (block_handlers / block_time) / (instr_handlers / instr_time));
+
+  if (instr_handlers != block_handlers)
+    std::printf("[!] both modes should trace the same handlers...\n");
+}
+}  // namespace vm::bench
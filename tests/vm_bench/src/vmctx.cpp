@@ -0,0 +1,64 @@
+#include <vmbench.hpp>
+
+#define BENCH_VMCTX_ENTRIES 1000u
+
+namespace vm::bench {
+void vmctx(const module_t& module) {
+  if (module.entries.empty())
+    return;
+
+  // every vm entry once, a repeated one would only ever hit the cache...
+  const std::vector<vm::locate::vm_enter_t> entries(
+      module.entries.begin(),
+      module.entries.begin() +
+          std::min<std::size_t>(module.entries.size(), BENCH_VMCTX_ENTRIES));
+
+  std::printf("> initializing %zu vmctx_t's for distinct vm entries...\n",
+              entries.size());
+
+  auto start = std::chrono::steady_clock::now();
+  std::vector<vm::vmctx_t> separate;
+  for (const auto& entry : entries) {
+    vm::vmctx_t vmctx(module.module_base, module.image_base, module.image_size,
+                      entry.rva);
+    if (vmctx.init())
+      separate.push_back(std::move(vmctx));
+  }
+  const auto separate_time = elapsed(start);
+
+  start = std::chrono::steady_clock::now();
+  vm::vmenter_cache_t cache;
+  std::vector<vm::vmctx_t> batched;
+  for (const auto& entry : entries) {
+    vm::vmctx_t vmctx(module.module_base, module.image_base, module.image_size,
+                      entry.rva);
+    if (vmctx.init(cache))
+      batched.push_back(std::move(vmctx));
+  }
+  const auto batched_time = elapsed(start);
+
+  // the shared analysis must give every vm entry the same vm enter...
+  std::uint32_t mismatches = separate.size() != batched.size();
+  for (auto idx = 0u; !mismatches && idx < separate.size(); ++idx) {
+    const auto &a = separate[idx], &b = batched[idx];
+    const auto x = a.get_vm_enter(), y = b.get_vm_enter();
+    if (a.get_vip() != b.get_vip() || a.get_vsp() != b.get_vsp() ||
+        a.get_vmentry_push_order() != b.get_vmentry_push_order() ||
+        x.size() != y.size() ||
+        !std::equal(x.begin(), x.end(), y.begin(),
+                    [](const zydis_instr_t& i, const zydis_instr_t& j) {
+                      return i.addr == j.addr && i.raw == j.raw;
+                    }))
+      ++mismatches;
+  }
+
+  std::printf("> separate init: %d ok, %f ms\n", separate.size(),
+              separate_time * 1000.0);
+  std::printf("> shared vm enter analysis: %d ok, %d distinct vm enters, %f ms "
+              "(%fx)\n",
+              batched.size(), cache.size(), batched_time * 1000.0,
+              separate_time / batched_time);
+  if (mismatches)
+    std::printf("[!] shared analysis differs from separate init...\n");
+}
+}  // namespace vm::bench
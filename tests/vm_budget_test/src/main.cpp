@@ -0,0 +1,223 @@
+#include <cli-parser.hpp>
+#include <array>
+#include <map>
+#include <set>
+#include <vmprofiler.hpp>
+#include <vmtests.hpp>
+
+#define BUDGET_TEST_BLKS 20000u
+#define BUDGET_TEST_CAP 0x100000u
+
+// stands in for the module, the synthetic routine never executes any of it...
+alignas(0x1000) static std::uint8_t g_module[0x1000];
+
+static const vm::compact::codec_t g_codecs[] = {vm::compact::codec_t::none,
+                                                vm::compact::codec_t::zrle};
+
+static const uc_x86_reg g_regs[] = {
+    UC_X86_REG_RAX, UC_X86_REG_RCX, UC_X86_REG_RDX, UC_X86_REG_RBX,
+    UC_X86_REG_RSP, UC_X86_REG_RBP, UC_X86_REG_RSI, UC_X86_REG_RDI,
+    UC_X86_REG_R8,  UC_X86_REG_R9,  UC_X86_REG_R10, UC_X86_REG_R11,
+    UC_X86_REG_R12, UC_X86_REG_R13, UC_X86_REG_R14, UC_X86_REG_R15,
+    UC_X86_REG_RIP, UC_X86_REG_RFLAGS};
+
+static std::uint64_t mix(std::uint64_t value) {
+  value ^= value >> 33;
+  value *= 0xFF51AFD7ED558CCDull;
+  value ^= value >> 33;
+  value *= 0xC4CEB9FE1A85EC53ull;
+  return value ^ value >> 33;
+}
+
+// successors of a synthetic block, two like a JCC...
+static std::array<std::uint32_t, 2> successors(std::uint32_t blk) {
+  return {(blk * 7u + 1u) % BUDGET_TEST_BLKS,
+          (blk * 13u + 5u) % BUDGET_TEST_BLKS};
+}
+
+// puts a state derived from seed into the engine... RBP plays VSP, and the
+// stack is mostly zeros the way a vm context is.
+static void seed(vm::emu::lease_t& lease, std::uint64_t seed) {
+  const auto top = EMU_STACK_BASE + EMU_STACK_SIZE;
+  const auto depth = (0x200u + mix(seed) % 0x1E00u) & ~7ull;
+  const auto rsp = top - depth;
+
+  for (auto idx = 0u; idx < std::size(g_regs); ++idx) {
+    std::uint64_t value = mix(seed + idx);
+    if (g_regs[idx] == UC_X86_REG_RSP)
+      value = rsp;
+    else if (g_regs[idx] == UC_X86_REG_RBP)
+      value = rsp + (value % (depth / 2u) & ~7ull);
+    else if (g_regs[idx] == UC_X86_REG_RIP)
+      value = reinterpret_cast<std::uintptr_t>(g_module);
+    else if (g_regs[idx] == UC_X86_REG_RFLAGS)
+      value = 0x202u;
+    uc_reg_write(lease.uc(), g_regs[idx], &value);
+  }
+
+  const auto stack = reinterpret_cast<std::uint64_t*>(
+      lease.stack() + (rsp - EMU_STACK_BASE));
+  for (auto idx = 0u; idx < depth / 8u; ++idx)
+    stack[idx] = idx % 3u ? 0u : mix(seed ^ idx);
+}
+
+// hash of the registers and of the stack from RSP up...
+static std::uint64_t hash(vm::emu::lease_t& lease) {
+  std::uint64_t result = 0u, rsp = 0u;
+  for (const auto reg : g_regs) {
+    std::uint64_t value = 0u;
+    uc_reg_read(lease.uc(), reg, &value);
+    result = mix(result ^ value);
+    if (reg == UC_X86_REG_RSP)
+      rsp = value;
+  }
+
+  const auto top = EMU_STACK_BASE + EMU_STACK_SIZE;
+  const auto stack = reinterpret_cast<const std::uint64_t*>(
+      lease.stack() + (rsp - EMU_STACK_BASE));
+  for (auto idx = 0u; idx < (top - rsp) / 8u; ++idx)
+    result = mix(result ^ stack[idx]);
+  return result;
+}
+
+// explores the synthetic routine depth first the way vm::emu::emu_t does
+// without a scheduler... every block's state is derived from the state its
+// predecessor started from, so one byte paged back in wrong changes every
+// block after it.
+static bool explore(vm::emu::engine_pool_t& engines,
+                    vm::compact::codec_t codec,
+                    vm::compact::budget_t* budget,
+                    std::map<std::uint32_t, std::uint64_t>& blks) {
+  struct pending_t {
+    std::uint32_t blk;
+    std::shared_ptr<const vm::compact::snapshot_t> state;
+  };
+
+  auto lease = engines.lease();
+  if (!lease)
+    return false;
+
+  seed(lease, 0u);
+  std::vector<pending_t> worklist = {
+      {0u, vm::compact::snapshot_t::capture(lease, ZYDIS_REGISTER_RBP, codec,
+                                            budget)}};
+  std::set<std::uint32_t> queued = {0u};
+
+  while (!worklist.empty()) {
+    const auto pending = std::move(worklist.back());
+    worklist.pop_back();
+    if (!pending.state || !pending.state->restore(lease)) {
+      std::printf("[!] failed to restore block %d...\n", pending.blk);
+      return false;
+    }
+
+    const auto value = hash(lease);
+    blks[pending.blk] = value;
+
+    for (const auto next : successors(pending.blk)) {
+      if (!queued.insert(next).second)
+        continue;
+
+      seed(lease, value ^ next);
+      worklist.push_back(
+          {next, vm::compact::snapshot_t::capture(lease, ZYDIS_REGISTER_RBP,
+                                                  codec, budget)});
+    }
+  }
+  return true;
+}
+
+static bool synthetic(std::size_t cap) {
+  vm::emu::engine_pool_t engines(reinterpret_cast<std::uintptr_t>(g_module),
+                                 sizeof g_module, 1u);
+  auto passed = true;
+
+  for (const auto codec : g_codecs) {
+    std::map<std::uint32_t, std::uint64_t> expected, blks;
+    vm::compact::budget_t budget(cap);
+    if (!explore(engines, codec, nullptr, expected) ||
+        !explore(engines, codec, &budget, blks))
+      return false;
+
+    // the snapshot in use is never spilled, it can go over the cap by one
+    // stack window...
+    const auto stats = budget.stats();
+    const auto ok = blks == expected && stats.spills && stats.loads &&
+                    stats.peak <= cap + EMU_STACK_SIZE;
+
+    std::printf(
+        "> %s: %d blocks, %d spills, %d loads, peak %d bytes of %d, %s\n",
+        codec == vm::compact::codec_t::zrle ? "zrle" : "none", blks.size(),
+        stats.spills, stats.loads, stats.peak, cap, ok ? "passed" : "FAILED");
+    passed &= ok;
+  }
+  return passed;
+}
+
+// devirtualizes the whole binary with and without the budget...
+static bool binary(const std::string& bin, std::size_t cap) {
+  const auto image = vm::image_t::load(bin);
+  if (!image) {
+    std::printf("[!] failed to open or map binary file...\n");
+    return false;
+  }
+
+  const auto entries =
+      vm::locate::get_vm_entries(image->m_module_base, image->m_image_size);
+
+  vm::compact::budget_t budget(cap);
+  auto expected = vm::devirt(*image, entries);
+  auto vrtns = vm::devirt(*image, entries, 0u, vm::mem::policy_t::arena,
+                          nullptr, &budget);
+
+  const auto stats = budget.stats();
+  const auto ok = vm::tests::same(expected, vrtns);
+  std::printf("> %s: %d routines, %d spills, %d loads, peak %d bytes, %s\n",
+              bin.c_str(), vrtns.size(), stats.spills, stats.loads,
+              stats.peak, ok ? "passed" : "FAILED");
+
+  for (auto& vrtn : expected)
+    vm::emu::release(vrtn);
+  for (auto& vrtn : vrtns)
+    vm::emu::release(vrtn);
+  return ok;
+}
+
+int __cdecl main(int argc, const char* argv[]) {
+  argparse::argument_parser_t parser(
+      "VMBudgetTest",
+      "checks that exploring under a tight memory budget gives the same "
+      "results as an unbounded run");
+  parser.add_argument()
+      .name("--bin")
+      .description("optional unpacked virtualized binary to devirtualize as "
+                   "well...");
+
+  parser.add_argument()
+      .name("--cap")
+      .description("budget in bytes, defaults to 1MB...");
+
+  parser.enable_help();
+  auto result = parser.parse(argc, argv);
+
+  if (result) {
+    std::printf("[!] error parsing commandline arguments... reason = %s\n",
+                result.what().c_str());
+    return -1;
+  }
+
+  if (parser.exists("help")) {
+    parser.print_help();
+    return 0;
+  }
+
+  const auto cap =
+      parser.exists("cap")
+          ? std::strtoull(parser.get<std::string>("cap").c_str(), nullptr, 0)
+          : BUDGET_TEST_CAP;
+
+  auto passed = synthetic(cap);
+  if (parser.exists("bin"))
+    passed &= binary(parser.get<std::string>("bin"), cap);
+  return passed ? 0 : -1;
+}
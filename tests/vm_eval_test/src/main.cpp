@@ -0,0 +1,143 @@
+#include <cli-parser.hpp>
+#include <vmprofiler.hpp>
+
+#define EVAL_TEST_MAX_HANDLERS 64u
+
+// registers compared between the evaluator and unicorn-engine...
+static const std::pair<const char*, uc_x86_reg> g_regs[] = {
+    {"rax", UC_X86_REG_RAX},      {"rcx", UC_X86_REG_RCX},
+    {"rdx", UC_X86_REG_RDX},      {"rbx", UC_X86_REG_RBX},
+    {"rsp", UC_X86_REG_RSP},      {"rbp", UC_X86_REG_RBP},
+    {"rsi", UC_X86_REG_RSI},      {"rdi", UC_X86_REG_RDI},
+    {"r8", UC_X86_REG_R8},        {"r9", UC_X86_REG_R9},
+    {"r10", UC_X86_REG_R10},      {"r11", UC_X86_REG_R11},
+    {"r12", UC_X86_REG_R12},      {"r13", UC_X86_REG_R13},
+    {"r14", UC_X86_REG_R14},      {"r15", UC_X86_REG_R15},
+    {"rip", UC_X86_REG_RIP},      {"rflags", UC_X86_REG_RFLAGS}};
+
+struct snapshot_t {
+  std::uint64_t regs[std::size(g_regs)];
+  std::vector<std::uint8_t> stack;
+};
+
+static void take(vm::emu::lease_t& lease, snapshot_t& snapshot) {
+  for (auto idx = 0u; idx < std::size(g_regs); ++idx)
+    uc_reg_read(lease.uc(), g_regs[idx].second, &snapshot.regs[idx]);
+  snapshot.stack.assign(lease.stack(), lease.stack() + EMU_STACK_SIZE);
+}
+
+int __cdecl main(int argc, const char* argv[]) {
+  argparse::argument_parser_t parser(
+      "VMEvalTest", "validates vm::emu::eval_t against unicorn-engine");
+  parser.add_argument()
+      .name("--bin")
+      .description("path to unpacked virtualized binary...")
+      .required(true);
+
+  parser.enable_help();
+  auto result = parser.parse(argc, argv);
+
+  if (result) {
+    std::printf("[!] error parsing commandline arguments... reason = %s\n",
+                result.what().c_str());
+    return -1;
+  }
+
+  if (parser.exists("help")) {
+    parser.print_help();
+    return 0;
+  }
+
+  vm::utils::init();
+  const auto image = vm::image_t::load(parser.get<std::string>("bin"));
+  if (!image) {
+    std::printf("[!] failed to open or map binary file...\n");
+    return -1;
+  }
+
+  const auto module_base = image->m_module_base;
+  const auto entries =
+      vm::locate::get_vm_entries(module_base, image->m_image_size);
+  std::printf("> number of vm entries = %d\n", entries.size());
+
+  vm::emu::engine_pool_t engines(*image, 1u);
+  std::uint32_t handlers = 0u, mismatches = 0u, diverged = 0u, fallbacks = 0u;
+
+  // every vm handler reached from every vm entry is one sample: the handler is
+  // flattened, evaluated from the state unicorn-engine left it in, rolled back
+  // and emulated again by unicorn-engine for the same number of instructions.
+  for (const auto& entry : entries) {
+    vm::vmctx_t vmctx(module_base, image->m_image_base, image->m_image_size,
+                      entry.rva);
+    if (!vmctx.init())
+      continue;
+
+    auto lease = engines.lease();
+    auto& state = lease.state();
+    vm::emu::eval_t eval(lease);
+
+    const auto& vm_enter = vmctx.get_vm_enter();
+    if (uc_emu_start(lease.uc(), module_base + entry.rva, vm_enter.back().addr,
+                     0ull, 0ull))
+      continue;
+
+    std::uintptr_t rip = 0u;
+    const auto& jmp = vm_enter.back().instr;
+    uc_reg_read(lease.uc(), vm::instrs::uc_reg(jmp.operands[0].reg.value),
+                &rip);
+
+    for (auto idx = 0u; rip && idx < EVAL_TEST_MAX_HANDLERS; ++idx) {
+      zydis_rtn_t rtn;
+      uc_reg_write(lease.uc(), UC_X86_REG_RIP, &rip);
+      if (!vm::utils::flatten(rtn, rip, true, 500, module_base))
+        break;
+
+      snapshot_t evaluated, emulated;
+      state.checkpoint();
+
+      const auto before = eval.fallbacks();
+      const auto ok = eval.run(rtn);
+      fallbacks += eval.fallbacks() - before;
+      take(lease, evaluated);
+
+      state.rollback();
+      if (uc_emu_start(lease.uc(), rip, 0ull, 0ull, rtn.size()))
+        break;
+      take(lease, emulated);
+
+      ++handlers;
+      if (!ok) {
+        // a JCC went the other way than flatten assumed, nothing to compare...
+        ++diverged;
+        break;
+      }
+
+      bool match = evaluated.stack == emulated.stack;
+      for (auto reg = 0u; reg < std::size(g_regs); ++reg) {
+        if (evaluated.regs[reg] == emulated.regs[reg])
+          continue;
+
+        std::printf("[!] handler at 0x%p, %s = 0x%p, expected 0x%p\n", rip,
+                    g_regs[reg].first, evaluated.regs[reg],
+                    emulated.regs[reg]);
+        match = false;
+      }
+
+      if (!match) {
+        ++mismatches;
+        vm::utils::print(rtn);
+      }
+
+      rip = rtn.back().instr.mnemonic == ZYDIS_MNEMONIC_RET
+                ? 0u
+                : emulated.regs[std::size(g_regs) - 2];
+    }
+  }
+
+  std::printf(
+      "> %d vm handlers evaluated, %d mismatched, %d diverged, %d instructions "
+      "handed to unicorn-engine\n",
+      handlers, mismatches, diverged, fallbacks);
+
+  return mismatches ? -1 : 0;
+}
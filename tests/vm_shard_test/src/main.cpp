@@ -0,0 +1,151 @@
+#include <cli-parser.hpp>
+#include <atomic>
+#include <filesystem>
+#include <thread>
+#include <vmprofiler.hpp>
+
+// devirtualizes the vm entries of shard idx of count and writes them to
+// path... a count of 1 is the whole binary in one go.
+static bool run(const std::string& bin,
+                std::uint32_t idx,
+                std::uint32_t count,
+                const std::string& path) {
+  const auto image = vm::image_t::load(bin);
+  if (!image) {
+    std::printf("[!] failed to open or map binary file...\n");
+    return false;
+  }
+
+  const auto entries = vm::shard::select(
+      vm::locate::get_vm_entries(image->m_module_base, image->m_image_size),
+      idx, count);
+
+  auto vrtns = vm::devirt(*image, entries);
+  for (auto& vrtn : vrtns)
+    vm::emu::release(vrtn);
+
+  std::printf("> shard %d/%d: %d vm entries, %d routines\n", idx, count,
+              entries.size(), vrtns.size());
+
+  std::vector<vm::shard::module_t> modules = {
+      {std::filesystem::path(bin).filename().string(), std::move(vrtns),
+       image->m_module_base}};
+  return vm::shard::write(path, modules);
+}
+
+int __cdecl main(int argc, const char* argv[]) {
+  argparse::argument_parser_t parser(
+      "VMShardTest",
+      "checks that merged shards are byte identical to a single process run");
+  parser.add_argument()
+      .name("--bin")
+      .description("path to unpacked virtualized binary...")
+      .required(true);
+
+  parser.add_argument()
+      .name("--shards")
+      .description("number of shard processes, defaults to 4...");
+
+  parser.add_argument()
+      .name("--shard")
+      .description("k/n, used by the shard processes this test starts...");
+
+  parser.add_argument()
+      .name("--out")
+      .description("file the shard process writes to...");
+
+  parser.enable_help();
+  auto result = parser.parse(argc, argv);
+
+  if (result) {
+    std::printf("[!] error parsing commandline arguments... reason = %s\n",
+                result.what().c_str());
+    return -1;
+  }
+
+  if (parser.exists("help")) {
+    parser.print_help();
+    return 0;
+  }
+
+  const auto bin = parser.get<std::string>("bin");
+  if (parser.exists("shard")) {
+    const auto spec = parser.get<std::string>("shard");
+    char* end = nullptr;
+    const auto idx = std::strtoul(spec.c_str(), &end, 10);
+    const auto count = *end == '/' ? std::strtoul(end + 1, nullptr, 10) : 0u;
+    if (!count || idx >= count || !parser.exists("out")) {
+      std::printf("[!] --shard must be k/n with k < n and needs --out...\n");
+      return -1;
+    }
+    return run(bin, idx, count, parser.get<std::string>("out")) ? 0 : -1;
+  }
+
+  const auto count =
+      parser.exists("shards")
+          ? std::strtoul(parser.get<std::string>("shards").c_str(), nullptr, 10)
+          : 4ul;
+
+  if (!count) {
+    std::printf("[!] --shards must be at least 1...\n");
+    return -1;
+  }
+
+  const auto dir = std::filesystem::temp_directory_path() / "vm_shard_test";
+  std::filesystem::create_directories(dir);
+
+  const auto expected = (dir / "single.vmst").string();
+  if (!run(bin, 0u, 1u, expected))
+    return -1;
+
+  // every shard is its own process, started at the same time...
+  std::vector<std::string> shards;
+  for (auto idx = 0u; idx < count; ++idx)
+    shards.push_back(
+        (dir / ("shard" + std::to_string(idx) + ".vmst")).string());
+
+  std::atomic<std::uint32_t> failed = 0u;
+  std::vector<std::thread> procs;
+  for (auto idx = 0u; idx < count; ++idx)
+    procs.emplace_back([&, idx]() {
+      const auto cmd = "\"" + std::string(argv[0]) + "\" --bin \"" + bin +
+                       "\" --shard " + std::to_string(idx) + "/" +
+                       std::to_string(count) + " --out \"" + shards[idx] +
+                       "\"";
+      if (std::system(cmd.c_str()))
+        ++failed;
+    });
+
+  for (auto& proc : procs)
+    proc.join();
+
+  if (failed) {
+    std::printf("[!] %d shard processes failed...\n", failed.load());
+    return -1;
+  }
+
+  // merged in reverse as well, the order shards are given in must not matter...
+  const auto merged = (dir / "merged.vmst").string();
+  const auto reversed = (dir / "reversed.vmst").string();
+  if (!vm::shard::merge(shards, merged) ||
+      !vm::shard::merge({shards.rbegin(), shards.rend()}, reversed)) {
+    std::printf("[!] failed to merge shards...\n");
+    return -1;
+  }
+
+  std::vector<std::uint8_t> single, forward, backward;
+  if (!vm::utils::open_binary_file(expected, single) ||
+      !vm::utils::open_binary_file(merged, forward) ||
+      !vm::utils::open_binary_file(reversed, backward)) {
+    std::printf("[!] failed to read back results...\n");
+    return -1;
+  }
+
+  const auto identical = single == forward && single == backward;
+  std::printf("> single process %d bytes, merged %d bytes, %s\n",
+              single.size(), forward.size(),
+              identical ? "identical" : "DIFFERENT");
+
+  std::filesystem::remove_all(dir);
+  return identical ? 0 : -1;
+}
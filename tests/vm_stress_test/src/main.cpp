@@ -0,0 +1,154 @@
+#include <cli-parser.hpp>
+#include <thread>
+#include <vmprofiler.hpp>
+
+#define STRESS_TEST_MAX_HANDLERS 32u
+
+// everything one analysis of a vm entry produced, flattened into numbers so
+// that results from different threads can be compared with ==...
+using digest_t = std::vector<std::uint64_t>;
+
+static digest_t analyze(vm::emu::engine_pool_t& engines,
+                        const vm::image_t& image,
+                        std::uint32_t vm_entry_rva) {
+  vm::vmctx_t vmctx(image.m_module_base, image.m_image_base,
+                    image.m_image_size, vm_entry_rva);
+  if (!vmctx.init())
+    return {};
+
+  const auto& vm_enter = vmctx.get_vm_enter();
+  digest_t digest = {vmctx.get_vip(), vmctx.get_vsp(), vm_enter.size()};
+  for (const auto reg : vmctx.get_vmentry_push_order())
+    digest.push_back(reg);
+
+  auto lease = engines.lease();
+  if (!lease)
+    return digest;
+
+  auto& tracer = lease.tracer();
+  if (uc_emu_start(lease.uc(), image.m_module_base + vm_entry_rva,
+                   vm_enter.back().addr, 0ull, 0ull))
+    return digest;
+
+  std::uintptr_t rip = 0u;
+  const auto& jmp = vm_enter.back().instr;
+  uc_reg_read(lease.uc(), vm::instrs::uc_reg(jmp.operands[0].reg.value), &rip);
+
+  vm::instrs::hndlr_trace_t hndlr{};
+  zydis_reg_t vip = vmctx.get_vip(), vsp = vmctx.get_vsp();
+
+  for (auto idx = 0u; rip && idx < STRESS_TEST_MAX_HANDLERS; ++idx) {
+    std::uintptr_t next = 0u;
+    if (!tracer.trace(rip, vip, vsp, hndlr, next))
+      break;
+
+    vm::instrs::deobfuscate(hndlr);
+    const auto vinstr = vm::instrs::determine(hndlr);
+    digest.push_back(static_cast<std::uint64_t>(vinstr.mnemonic));
+    digest.push_back(vinstr.stack_size);
+    digest.push_back(vinstr.imm.has_imm ? vinstr.imm.val : 0ull);
+
+    vip = hndlr.m_vip;
+    vsp = hndlr.m_vsp;
+    rip = next;
+  }
+
+  vm::instrs::release(hndlr);
+  return digest;
+}
+
+int __cdecl main(int argc, const char* argv[]) {
+  argparse::argument_parser_t parser(
+      "VMStressTest", "runs many vmctx_t analyses on many threads at once");
+  parser.add_argument()
+      .name("--bin")
+      .description("path to unpacked virtualized binary...")
+      .required(true);
+
+  parser.add_argument()
+      .name("--threads")
+      .description("number of threads, defaults to the number of cores...");
+
+  parser.add_argument()
+      .name("--rounds")
+      .description("number of times each thread analyzes every vm entry...");
+
+  parser.enable_help();
+  auto result = parser.parse(argc, argv);
+
+  if (result) {
+    std::printf("[!] error parsing commandline arguments... reason = %s\n",
+                result.what().c_str());
+    return -1;
+  }
+
+  if (parser.exists("help")) {
+    parser.print_help();
+    return 0;
+  }
+
+  const auto threads =
+      parser.exists("threads")
+          ? std::strtoul(parser.get<std::string>("threads").c_str(), nullptr,
+                         10)
+          : std::max(std::thread::hardware_concurrency(), 2u);
+  const auto rounds =
+      parser.exists("rounds")
+          ? std::strtoul(parser.get<std::string>("rounds").c_str(), nullptr, 10)
+          : 4ul;
+
+  const auto image = vm::image_t::load(parser.get<std::string>("bin"));
+  if (!image) {
+    std::printf("[!] failed to open or map binary file...\n");
+    return -1;
+  }
+
+  const auto entries =
+      vm::locate::get_vm_entries(image->m_module_base, image->m_image_size);
+  std::printf("> number of vm entries = %d\n", entries.size());
+
+  // the engines of the pool hold uc_contexts of their own (the clean state
+  // and the checkpoint of their state_t) until the pool is destroyed, engines
+  // the threads create as they go included... leaks are counted after that.
+  const auto allocations = g_allocation_tracker.load();
+  std::atomic<std::uint32_t> analyses = 0u, mismatches = 0u;
+  {
+    // single threaded results everything else is compared against...
+    vm::emu::engine_pool_t engines(*image, threads);
+    std::vector<digest_t> expected;
+    for (const auto& entry : entries)
+      expected.push_back(analyze(engines, *image, entry.rva));
+
+    std::vector<std::thread> workers;
+
+    // no vm::utils::init or vm::instrs::init on these threads on purpose...
+    // each thread starts at a different entry so they all collide on
+    // everything.
+    for (auto thread = 0u; thread < threads; ++thread)
+      workers.emplace_back([&, thread]() {
+        for (auto round = 0u; round < rounds; ++round) {
+          for (auto idx = 0u; idx < entries.size(); ++idx) {
+            const auto entry = (idx + thread) % entries.size();
+            if (analyze(engines, *image, entries[entry].rva) !=
+                expected[entry]) {
+              std::printf(
+                  "[!] thread %d got a different result for rva 0x%x\n",
+                  thread, entries[entry].rva);
+              ++mismatches;
+            }
+            ++analyses;
+          }
+        }
+      });
+
+    for (auto& worker : workers)
+      worker.join();
+  }
+
+  const auto leaked = g_allocation_tracker.load() - allocations;
+  std::printf(
+      "> %d analyses on %d threads, %d mismatched, %d uc_context leaked\n",
+      analyses.load(), threads, mismatches.load(), leaked);
+
+  return mismatches || leaked ? -1 : 0;
+}